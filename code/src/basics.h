@@ -1,26 +1,270 @@
 #pragma once
 #include "vec.h"
 #include <time.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
 
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <string>
 
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include "field-kernels.h"
+#include "field-expression.h"
+#include "parallel.h"
 #include <sstream>
 
-// ScalarField2D. Represents a 2D field (nx * ny) of scalar values. Can represent a heightfield.
-class ScalarField2D
+// FieldStatisticsT. Result of the single pass reduction over a field, min and max in the scalar type of the field.
+template<typename T>
+struct FieldStatisticsT
 {
+	T min, max;
+	double mean, variance;
+};
+
+typedef FieldStatisticsT<float> FieldStatistics;
+
+// ScalarField2DViewT. Non-owning view over a rectangle of a 2D field (nx * ny), rows are stride values apart.
+// T is the scalar type (float or double) for a mutable view, const for a read-only one. Views are cheap to copy and
+// never own memory: the viewed field must outlive them.
+template<typename T>
+class ScalarField2DViewT
+{
+public:
+	typedef typename std::remove_const<T>::type Scalar;
+protected:
+	T* data;
+	int nx, ny;
+	int stride;
+
+public:
+	/*
+	\brief Constructor
+	\param data first value of the rectangle
+	\param nx size in x axis
+	\param ny size in y axis
+	\param stride distance between two rows, in values
+	*/
+	inline ScalarField2DViewT(T* data, int nx, int ny, int stride) : data(data), nx(nx), ny(ny), stride(stride)
+	{
+		// Empty
+	}
+
+	/*
+	\brief Conversion from a mutable view to a read-only view
+	*/
+	template<typename U>
+	inline ScalarField2DViewT(const ScalarField2DViewT<U>& view) : data(view.Data()), nx(view.SizeX()), ny(view.SizeY()), stride(view.Stride())
+	{
+		// Empty
+	}
+
+	/*!
+	\brief Returns the view of a sub-rectangle.
+	\param row, column first row and column of the rectangle
+	\param sx, sy size of the rectangle
+	*/
+	inline ScalarField2DViewT SubView(int row, int column, int sx, int sy) const
+	{
+		return ScalarField2DViewT(data + size_t(row) * stride + column, sx, sy, stride);
+	}
+
+	/*!
+	\brief Returns the value of the field at a given coordinate.
+	*/
+	inline T& Get(int row, int column) const
+	{
+		return data[size_t(row) * stride + column];
+	}
+
+	/*!
+	\brief Set a given value at a given coordinate.
+	*/
+	inline void Set(int row, int column, Scalar v) const
+	{
+		data[size_t(row) * stride + column] = v;
+	}
+
+	/*!
+	\brief Returns a pointer on the first value of a row.
+	*/
+	inline T* Row(int row) const
+	{
+		return data + size_t(row) * stride;
+	}
+
+	/*!
+	\brief Check if the rows are contiguous, i.e. if the view covers whole rows.
+	*/
+	inline bool IsContiguous() const
+	{
+		return stride == nx || ny <= 1;
+	}
+
+	inline T* Data() const { return data; }
+	inline int SizeX() const { return nx; }
+	inline int SizeY() const { return ny; }
+	inline int Stride() const { return stride; }
+
+	/*!
+	\brief Number of rows processed by each thread of the parallel algorithms, about 64k values.
+	*/
+	inline int RowGrain() const
+	{
+		return std::max(1, 65536 / std::max(1, nx));
+	}
+
+	/*!
+	\brief Compute the minimum, maximum, mean and variance of the field in a single (vectorized and parallel) pass.
+	*/
+	inline FieldStatisticsT<Scalar> Statistics() const
+	{
+		FieldStatisticsT<Scalar> stats = { Scalar(0), Scalar(0), 0.0, 0.0 };
+		if (nx * ny == 0)
+			return stats;
+		Scalar min = data[0], max = data[0];
+		double sum = 0.0, sumsq = 0.0;
+		std::mutex mutex;
+		ParallelFor(0, ny, RowGrain(), [&](int begin, int end) {
+			Scalar bmin = data[0], bmax = data[0];
+			double bsum = 0.0, bsumsq = 0.0;
+			for (int i = begin; i < end; i++)
+				FieldKernels::Statistics(Row(i), nx, bmin, bmax, bsum, bsumsq);
+			std::lock_guard<std::mutex> lock(mutex);
+			min = std::min(min, bmin);
+			max = std::max(max, bmax);
+			sum += bsum;
+			sumsq += bsumsq;
+		});
+		double n = double(nx) * ny;
+		stats.min = min;
+		stats.max = max;
+		stats.mean = sum / n;
+		stats.variance = std::max(0.0, sumsq / n - stats.mean * stats.mean);
+		return stats;
+	}
+
+	/*!
+	\brief Compute the maximum of the field.
+	*/
+	inline Scalar Max() const
+	{
+		return Statistics().max;
+	}
+
+	/*!
+	\brief Compute the minimum of the field.
+	*/
+	inline Scalar Min() const
+	{
+		return Statistics().min;
+	}
+
+	/*!
+	\brief Compute the average value of the field.
+	*/
+	inline float Average() const
+	{
+		return float(Statistics().mean);
+	}
+
+	/*
+	\brief Affine transform the field with the formula v' = a*v+b
+	*/
+	inline void AffineTransform(Scalar a, Scalar b = 0) const
+	{
+		ParallelFor(0, ny, RowGrain(), [&](int begin, int end) {
+			for (int i = begin; i < end; i++)
+				FieldKernels::Affine(Row(i), nx, a, b);
+		});
+	}
+
+	/*
+	\brief Normalize the field then apply the affine transform v' = a*v+b, in a single pass after the statistics
+	*/
+	inline void NormalizeField(Scalar a = 1, Scalar b = 0) const
+	{
+		FieldStatisticsT<Scalar> stats = Statistics();
+		ParallelFor(0, ny, RowGrain(), [&](int begin, int end) {
+			for (int i = begin; i < end; i++)
+				FieldKernels::Normalize(Row(i), nx, stats.min, stats.max, a, b);
+		});
+	}
+
+	/*!
+	\brief Fill the field with a given value.
+	*/
+	inline void Fill(Scalar v) const
+	{
+		for (int i = 0; i < ny; i++)
+			std::fill(Row(i), Row(i) + nx, v);
+	}
+
+	/*
+	\brief Export in PGM format (ASCII), normalized to 16 bits
+	\param filename name of the file
+	*/
+	inline void SavePGM(std::string filename) const
+	{
+		std::ofstream pgmfile(filename);
+		pgmfile << "P2" << std::endl;
+		pgmfile << nx << " "<<ny << std::endl;
+		pgmfile << "65535" << std::endl;
+		FieldStatisticsT<Scalar> stats = Statistics();
+		float min = float(stats.min); // 16-bit output
+		float max = float(stats.max);
+
+		// rows formatted in parallel, by bands written in order
+		const int band = 256;
+		std::vector<std::string> rows(size_t(std::min(ny, band)));
+		for (int i0 = 0; i0 < ny; i0 += band) {
+			int i1 = std::min(ny, i0 + band);
+			ParallelFor(i0, i1, 1, [&](int begin, int end) {
+				char buffer[16];
+				for (int i = begin; i < end; i++) {
+					std::string& row = rows[i - i0];
+					row.clear();
+					for (int j = 0; j < nx; j++) {
+						float val = Get(i, j);
+						int ival = int((val - min) / (max - min) * 65535.0f);
+						row.append(buffer, size_t(snprintf(buffer, sizeof(buffer), "%d\n", ival)));
+					}
+				}
+			});
+			for (int i = i0; i < i1; i++)
+				pgmfile.write(rows[i - i0].data(), std::streamsize(rows[i - i0].size()));
+		}
+	}
+};
+
+typedef ScalarField2DViewT<float> ScalarField2DView;
+typedef ScalarField2DViewT<const float> ConstScalarField2DView;
+
+// ScalarField2DT. Represents a 2D field (nx * ny) of scalar values of type T. Can represent a heightfield.
+// ScalarField2D (float) is the field of the solver and of the maps, ScalarField2DD (double) the one of the reference
+// solutions. Assigning a field, or an expression, of the other type converts the values.
+// Arithmetic operators build expression templates, evaluated in a single loop on assignment (see field-expression.h).
+template<typename T>
+class ScalarField2DT : public FieldExpression<ScalarField2DT<T> >
+{
+public:
+	typedef ScalarField2DViewT<T> View2D;
+	typedef ScalarField2DViewT<const T> ConstView2D;
 protected:
 	int nx, ny;
-	std::vector<float> values;
+	std::vector<T> values;
 
 public:
 	/*
 	\brief Default Constructor
 	*/
-	inline ScalarField2D() : nx(0), ny(0)
+	inline ScalarField2DT() : nx(0), ny(0)
 	{
 		// Empty
 	}
@@ -31,7 +275,7 @@ public:
 	\param ny size in z axis
 	\param bbox bounding box of the domain in world coordinates
 	*/
-	inline ScalarField2D(int nx, int ny) : nx(nx), ny(ny)
+	inline ScalarField2DT(int nx, int ny) : nx(nx), ny(ny)
 	{
 		values.resize(size_t(nx * ny));
 	}
@@ -40,7 +284,7 @@ public:
 	\brief Constructor
 	\param name name of the file to read (format ASCII PGM required)
 	*/
-	inline ScalarField2D(std::string name)
+	inline ScalarField2DT(std::string name) : nx(0), ny(0)
 	{
 		std::string line;
 		std::ifstream pgmfile (name);
@@ -57,13 +301,42 @@ public:
 		int max;
 		pgmfile>>max;
 		values.resize(size_t(nx * ny));
-		for (int i=0;i<ny;i++) {
-			for (int j=0;j<nx;j++) {
-				int val;
-				pgmfile>>val;
-				Set(i,j,float(val)/float(max));
+
+		// the values in chunks of the text that start at a value: the values of each chunk are counted, then parsed
+		// in parallel at the index of their first value
+		std::string text((std::istreambuf_iterator<char>(pgmfile)), std::istreambuf_iterator<char>());
+		auto space = [&](size_t p) { return isspace((unsigned char)(text[p])) != 0; };
+		int chunks = std::max(1, std::min(1024, int(text.size() >> 16)));
+		std::vector<size_t> start(size_t(chunks + 1), text.size());
+		for (int c = 0; c < chunks; c++) {
+			start[c] = text.size() * size_t(c) / size_t(chunks);
+			while (start[c] > 0 && start[c] < text.size() && !space(start[c] - 1))
+				start[c]++;
+		}
+		std::vector<int> first(size_t(chunks + 1), 0);
+		ParallelFor(0, chunks, 1, [&](int begin, int end) {
+			for (int c = begin; c < end; c++)
+				for (size_t p = start[c]; p < start[c + 1]; p++)
+					first[c + 1] += !space(p) && (p == 0 || space(p - 1));
+		});
+		for (int c = 0; c < chunks; c++)
+			first[c + 1] += first[c];
+		ParallelFor(0, chunks, 1, [&](int begin, int end) {
+			for (int c = begin; c < end; c++) {
+				size_t p = start[c];
+				for (int k = first[c]; k < first[c + 1]; k++) {
+					while (space(p))
+						p++;
+					char* next;
+					long val = strtol(&text[p], &next, 10);
+					if (k < nx * ny)
+						Set(k, T(val)/T(max));
+					p = next > &text[p] ? size_t(next - text.data()) : p + 1;
+					while (p < start[c + 1] && !space(p))
+						p++;
+				}
 			}
-		}		
+		});
 	}
 
 
@@ -74,7 +347,7 @@ public:
 	\param bbox bounding box of the domain
 	\param value default value of the field
 	*/
-	inline ScalarField2D(int nx, int ny, float value) : nx(nx), ny(ny)
+	inline ScalarField2DT(int nx, int ny, T value) : nx(nx), ny(ny)
 	{
 		values.resize(size_t(nx * ny));
 		Fill(value);
@@ -84,16 +357,184 @@ public:
 	\brief copy constructor
 	\param field Scalarfield2D to copy
 	*/
-	inline ScalarField2D(const ScalarField2D& field) : ScalarField2D(field.nx, field.ny)
+	inline ScalarField2DT(const ScalarField2DT& field) : nx(field.nx), ny(field.ny), values(field.values)
 	{
-		for (unsigned int i = 0; i < values.size(); i++)
-			values[i] = field.values[i];
+		++CopyCounter();
 	}
 
+	/*
+	\brief move constructor, field is left empty
+	\param field Scalarfield2D to move
+	*/
+	inline ScalarField2DT(ScalarField2DT&& field) noexcept : nx(field.nx), ny(field.ny), values(std::move(field.values))
+	{
+		field.nx = 0;
+		field.ny = 0;
+	}
+
+	/*
+	\brief Constructor, copy of the values of a view
+	\param view rectangle to copy
+	*/
+	inline explicit ScalarField2DT(const ConstView2D& view) : nx(view.SizeX()), ny(view.SizeY())
+	{
+		values.resize(size_t(nx) * ny);
+		for (int i = 0; i < ny; i++)
+			std::copy(view.Row(i), view.Row(i) + nx, values.begin() + size_t(i) * nx);
+		++CopyCounter();
+	}
+
+	/*
+	\brief copy assignment
+	*/
+	inline ScalarField2DT& operator=(const ScalarField2DT& field)
+	{
+		if (this != &field) {
+			nx = field.nx;
+			ny = field.ny;
+			values = field.values;
+			++CopyCounter();
+		}
+		return *this;
+	}
+
+	/*
+	\brief move assignment, field is left empty
+	*/
+	inline ScalarField2DT& operator=(ScalarField2DT&& field) noexcept
+	{
+		if (this != &field) {
+			nx = field.nx;
+			ny = field.ny;
+			values = std::move(field.values);
+			field.nx = 0;
+			field.ny = 0;
+		}
+		return *this;
+	}
+
+	/*
+	\brief Constructor, evaluation of an expression
+	\param expression field arithmetic, e.g. (a - 0.5f) * 0.03f
+	*/
+	template<typename E>
+	inline ScalarField2DT(const FieldExpression<E>& expression) : nx(0), ny(0)
+	{
+		*this = expression;
+	}
+
+	/*
+	\brief Assignment of an expression, evaluated in a single loop without temporary field.
+	The field may appear in the expression (e.g. a = a * 2.0f + b): values are only combined index-wise.
+	*/
+	template<typename E>
+	inline ScalarField2DT& operator=(const FieldExpression<E>& expression)
+	{
+		const E& e = expression.Derived();
+		if (e.SizeX() < 0 || e.SizeY() < 0) {
+			std::cerr << "[error] field expression with operands of different sizes" << std::endl;
+			nx = 0;
+			ny = 0;
+			values.clear();
+			return *this;
+		}
+		if (e.SizeX() != nx || e.SizeY() != ny) {
+			nx = e.SizeX();
+			ny = e.SizeY();
+			values.resize(size_t(nx) * ny);
+		}
+		Evaluate(e);
+		return *this;
+	}
+
+	template<typename E>
+	inline ScalarField2DT& operator+=(const FieldExpression<E>& expression)
+	{
+		return *this = *this + expression.Derived();
+	}
+
+	template<typename E>
+	inline ScalarField2DT& operator-=(const FieldExpression<E>& expression)
+	{
+		return *this = *this - expression.Derived();
+	}
+
+	template<typename E>
+	inline ScalarField2DT& operator*=(const FieldExpression<E>& expression)
+	{
+		return *this = *this * expression.Derived();
+	}
+
+	inline ScalarField2DT& operator+=(T v)
+	{
+		return *this = *this + v;
+	}
+
+	inline ScalarField2DT& operator-=(T v)
+	{
+		return *this = *this - v;
+	}
+
+	inline ScalarField2DT& operator*=(T v)
+	{
+		return *this = *this * v;
+	}
+
+	/*!
+	\brief Value at a given index, for expression templates.
+	*/
+	inline T Value(size_t index) const
+	{
+		return values[index];
+	}
+
+	/*!
+	\brief Number of deep copies of fields since the start, moves are not counted.
+	*/
+	static inline long long Copies()
+	{
+		return CopyCounter();
+	}
+
+	/*!
+	\brief Returns a view on the whole field.
+	*/
+	inline View2D View()
+	{
+		return View2D(values.data(), nx, ny, nx);
+	}
+
+	/*!
+	\brief Returns a read-only view on the whole field.
+	*/
+	inline ConstView2D View() const
+	{
+		return ConstView2D(values.data(), nx, ny, nx);
+	}
+
+	/*!
+	\brief Returns a view on a sub-rectangle, no copy.
+	*/
+	inline View2D SubView(int row, int column, int sx, int sy)
+	{
+		return View().SubView(row, column, sx, sy);
+	}
+
+	/*!
+	\brief Returns a read-only view on a sub-rectangle, no copy.
+	*/
+	inline ConstView2D SubView(int row, int column, int sx, int sy) const
+	{
+		return View().SubView(row, column, sx, sy);
+	}
+
+	inline operator View2D() { return View(); }
+	inline operator ConstView2D() const { return View(); }
+
 	/*
 	\brief Destructor
 	*/
-	inline ~ScalarField2D()
+	inline ~ScalarField2DT()
 	{
 	}
 
@@ -101,53 +542,40 @@ public:
 	\brief Export in PGM format (ASCII)
 	\param filename name of the file
 	*/
-	inline void SavePGM(std::string filename) {
-		std::ofstream pgmfile(filename);
-		pgmfile << "P2" << std::endl;
-		pgmfile << nx << " "<<ny << std::endl;
-		pgmfile << "65535" << std::endl;
-		float min = Min();
-		float max = Max();
-		
-		for (int i = 0; i < ny; i++) {
-			for (int j = 0; j < nx; j++) {
-				float val = Get(i, j);
-				int ival = int((val - min) / (max - min) * 65535.0f);
-				pgmfile << ival << std::endl;
-			}
-		}
+	inline void SavePGM(std::string filename) const {
+		View().SavePGM(filename);
 	}
 
 	/*
-	\brief Normalize this field
+	\brief Normalize this field, then apply the affine transform v' = a*v+b in the same pass
 	*/
-	inline void NormalizeField()
+	inline void NormalizeField(T a = 1, T b = 0)
 	{
-		float min = Min();
-		float max = Max();
-		for (int i = 0; i < ny * nx; i++)
-			values[i] = (values[i] - min) / (max - min);
+		View().NormalizeField(a, b);
 	}
 
 	/*
 	\brief Affine transform this field with the formula v' = a*v+b
 	*/
-	inline void AffineTransform(float a,float b=0.f)
+	inline void AffineTransform(T a, T b = 0)
 	{
-		for (int i = 0; i < ny * nx; i++)
-			values[i] = a*values[i]+b;
+		View().AffineTransform(a, b);
 	}
 
 	/*
 	\brief Return the normalized version of this field
 	*/
-	inline ScalarField2D Normalized() const
+	inline ScalarField2DT Normalized() const
 	{
-		ScalarField2D ret(*this);
-		float min = Min();
-		float max = Max();
-		for (int i = 0; i < ny * nx; i++)
-			ret.values[i] = (ret.values[i] - min) / (max - min);
+		ScalarField2DT ret(nx, ny);
+		FieldStatisticsT<T> stats = Statistics();
+		ConstView2D view = View();
+		ParallelFor(0, ny, view.RowGrain(), [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				std::copy(view.Row(i), view.Row(i) + nx, &ret.values[size_t(i) * nx]);
+				FieldKernels::Normalize(&ret.values[size_t(i) * nx], nx, stats.min, stats.max, T(1), T(0));
+			}
+		});
 		return ret;
 	}
 
@@ -188,7 +616,7 @@ public:
 	/*!
 	\brief Returns the value of the field at a given coordinate.
 	*/
-	inline float Get(int row, int column) const
+	inline T Get(int row, int column) const
 	{
 		int index = ToIndex1D(row, column);
 		return values[index];
@@ -197,7 +625,7 @@ public:
 	/*!
 	\brief Returns the value of the field at a given coordinate.
 	*/
-	inline float Get(int index) const
+	inline T Get(int index) const
 	{
 		return values[index];
 	}
@@ -205,7 +633,7 @@ public:
 	/*!
 	\brief Returns the value of the field at a given coordinate.
 	*/
-	inline float Get(const Vector2i& v) const
+	inline T Get(const Vector2i& v) const
 	{
 		int index = ToIndex1D(v);
 		return values[index];
@@ -214,7 +642,7 @@ public:
 	/*!
 	\brief Todo
 	*/
-	void Add(int i, int j, float v)
+	void Add(int i, int j, T v)
 	{
 		values[ToIndex1D(i, j)] += v;
 	}
@@ -222,33 +650,41 @@ public:
 	/*!
 	\brief Todo
 	*/
-	void Remove(int i, int j, float v)
+	void Remove(int i, int j, T v)
 	{
 		values[ToIndex1D(i, j)] -= v;
 	}
 
 	/*!
-	\brief Todo
+	\brief Add a field, element-wise.
 	*/
-	void Add(const ScalarField2D& field)
+	void Add(const ScalarField2DT& field)
 	{
-		for (int i = 0; i < values.size(); i++)
-			values[i] += field.values[i];
+		*this += field;
 	}
 
 	/*!
-	\brief Todo
+	\brief Subtract a field, element-wise.
+	*/
+	void Remove(const ScalarField2DT& field)
+	{
+		*this -= field;
+	}
+
+	/*!
+	\brief Exchange the content of two fields, without copy.
 	*/
-	void Remove(const ScalarField2D& field)
+	inline void Swap(ScalarField2DT& field)
 	{
-		for (int i = 0; i < values.size(); i++)
-			values[i] -= field.values[i];
+		std::swap(nx, field.nx);
+		std::swap(ny, field.ny);
+		values.swap(field.values);
 	}
 
 	/*!
 	\brief Fill all the field with a given value.
 	*/
-	inline void Fill(float v)
+	inline void Fill(T v)
 	{
 		std::fill(values.begin(), values.end(), v);
 	}
@@ -257,7 +693,7 @@ public:
 	\brief Return the data in the field.
 	\param c Index.
 	*/
-	inline float& operator[](int c)
+	inline T& operator[](int c)
 	{
 		return values[c];
 	}
@@ -265,7 +701,7 @@ public:
 	/*!
 	\brief Set a given value at a given coordinate.
 	*/
-	inline void Set(int row, int column, float v)
+	inline void Set(int row, int column, T v)
 	{
 		values[ToIndex1D(row, column)] = v;
 	}
@@ -273,7 +709,7 @@ public:
 	/*!
 	\brief Set a given value at a given coordinate.
 	*/
-	inline void Set(const Vector2i& coord, float v)
+	inline void Set(const Vector2i& coord, T v)
 	{
 		values[ToIndex1D(coord)] = v;
 	}
@@ -281,41 +717,33 @@ public:
 	/*!
 	\brief Set a given value at a given coordinate.
 	*/
-	inline void Set(int index, float v)
+	inline void Set(int index, T v)
 	{
 		values[index] = v;
 	}
 
+	/*!
+	\brief Compute the minimum, maximum, mean and variance of the field in a single pass.
+	*/
+	inline FieldStatisticsT<T> Statistics() const
+	{
+		return View().Statistics();
+	}
+
 	/*!
 	\brief Compute the maximum of the field.
 	*/
-	inline float Max() const
+	inline T Max() const
 	{
-		if (values.size() == 0)
-			return 0.0f;
-		float max = values[0];
-		for (int i = 1; i < values.size(); i++)
-		{
-			if (values[i] > max)
-				max = values[i];
-		}
-		return max;
+		return View().Max();
 	}
 
 	/*!
 	\brief Compute the minimum of the field.
 	*/
-	inline float Min() const
+	inline T Min() const
 	{
-		if (values.size() == 0)
-			return 0.0f;
-		float min = values[0];
-		for (int i = 1; i < values.size(); i++)
-		{
-			if (values[i] < min)
-				min = values[i];
-		}
-		return min;
+		return View().Min();
 	}
 
 	/*!
@@ -323,10 +751,7 @@ public:
 	*/
 	inline float Average() const
 	{
-		float sum = 0.0f;
-		for (int i = 0; i < values.size(); i++)
-			sum += values[i];
-		return sum / values.size();
+		return View().Average();
 	}
 
 	/*!
@@ -358,6 +783,29 @@ public:
 	*/
 	inline int Memory() const
 	{
-		return sizeof(ScalarField2D) + sizeof(float) * int(values.size());
+		return sizeof(ScalarField2DT) + sizeof(T) * int(values.size());
+	}
+
+protected:
+	/*!
+	\brief Evaluate an expression of the same size into the field, in parallel blocks of contiguous values.
+	*/
+	template<typename E>
+	inline void Evaluate(const E& e)
+	{
+		T* v = values.data();
+		ParallelFor(0, int(values.size()), 65536, [&](int begin, int end) {
+			for (int i = begin; i < end; i++)
+				v[i] = T(e.Value(size_t(i)));
+		});
+	}
+
+	static inline std::atomic<long long>& CopyCounter()
+	{
+		static std::atomic<long long> copies(0);
+		return copies;
 	}
 };
+
+typedef ScalarField2DT<float> ScalarField2D;
+typedef ScalarField2DT<double> ScalarField2DD;
@@ -0,0 +1,308 @@
+#include "batch.h"
+#include "diffusionterrain.h"
+#include "diffusionbatch.h"
+#include "diffusionatlas.h"
+#include "gradient.h"
+#include "gpu-readback.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point start)
+{
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+/*!
+\brief Read the three maps and apply the preprocessing of the example scene.
+*/
+void Scene::Load()
+{
+  alphaField = ScalarField2D(mask); // locations of fixed constraints (Dirichlet) /!\ 0 = fixed constraint, 1 = laplacian
+  alphaField.NormalizeField();
+  altitudeField = ScalarField2D(altitude); // values of fixed constraints (Dirichlet) where alpha = 0
+  altitudeField.NormalizeField();
+  if (Gradient()) {
+    // divergence of the gradient field, no intermediate Laplacian map: offset and scale do not apply
+    GradientField2D gradient;
+    if (gradient.LoadPFM(laplacian))
+      laplacianField = gradient.Laplacian();
+    return;
+  }
+  laplacianField = ScalarField2D(laplacian);
+  laplacianField = (laplacianField + laplacianOffset) * laplacianScale; // center to 0 and adjust the strength of the Lapacian, one pass
+}
+
+/*!
+\brief True if the Laplacian is given by a gradient field (.pfm file).
+*/
+bool Scene::Gradient() const
+{
+  return laplacian.size() > 4 && laplacian.compare(laplacian.size() - 4, 4, ".pfm") == 0;
+}
+
+/*!
+\brief Read a batch manifest.
+One scene per line: mask altitude laplacian output [laplacian_offset laplacian_scale]
+A laplacian ending in .pfm is a gradient field, its divergence is used as is.
+Empty lines and lines starting with # are ignored.
+\param filename name of the manifest
+*/
+vector<Scene> ReadManifest(const string& filename)
+{
+  vector<Scene> scenes;
+  ifstream manifest(filename);
+  if (!manifest.is_open()) {
+    cerr << "[error] cannot open manifest " << filename << endl;
+    return scenes;
+  }
+  string line;
+  int number = 0;
+  while (getline(manifest, line)) {
+    number++;
+    istringstream ss(line);
+    Scene scene;
+    if (!(ss >> scene.mask) || scene.mask[0] == '#')
+      continue;
+    if (!(ss >> scene.altitude >> scene.laplacian >> scene.output)) {
+      cerr << "[error] " << filename << ":" << number << ": expected mask altitude laplacian output" << endl;
+      continue;
+    }
+    float offset, scale;
+    if (ss >> offset >> scale) {
+      scene.laplacianOffset = offset;
+      scene.laplacianScale = scale;
+    }
+    scene.index = int(scenes.size());
+    scenes.push_back(move(scene));
+  }
+  return scenes;
+}
+
+/*!
+\brief Solver stage of the CPU backend with interleaving: consecutive scenes of the same size are solved together by
+SimpleGeometricMultigridBatch, up to LANES at a time. A group is solved when it is full, when a scene of another size
+arrives or once the loaders are done.
+\return the time spent solving
+*/
+static double SolveInterleaved(BoundedQueue<Scene*>& loaded, BoundedQueue<Scene*>& solved)
+{
+  double solveTime = 0.0;
+  vector<Scene*> group;
+  auto flush = [&]() {
+    if (group.empty())
+      return;
+    Clock::time_point t0 = Clock::now();
+    SimpleGeometricMultigridBatch batch(group[0]->alphaField.SizeX());
+    vector<int> lane(group.size(), -1);
+    int lanes = 0;
+    for (unsigned int k = 0; k < group.size(); k++) {
+      Scene* scene = group[k];
+      if (batch.Add(move(scene->alphaField), move(scene->altitudeField), move(scene->laplacianField)))
+        lane[k] = lanes++;
+      else
+        cerr << "[error] scene " << scene->index << " cannot be interleaved, it is not square" << endl;
+    }
+    if (lanes > 0)
+      batch.SolveBatch();
+    for (unsigned int k = 0; k < group.size(); k++)
+      if (lane[k] >= 0)
+        group[k]->result = batch.GetResult(lane[k]);
+    solveTime += Seconds(t0);
+    // rejected scenes have no result, they are neither saved nor counted
+    for (unsigned int k = 0; k < group.size(); k++)
+      if (lane[k] >= 0)
+        solved.Push(move(group[k]));
+    group.clear();
+  };
+  Scene* scene;
+  while (loaded.Pop(scene)) {
+    if (!group.empty() && (scene->alphaField.SizeX() != group[0]->alphaField.SizeX()
+      || scene->alphaField.SizeY() != group[0]->alphaField.SizeY()))
+      flush();
+    group.push_back(scene);
+    if (int(group.size()) == SimpleGeometricMultigridBatch::LANES)
+      flush();
+  }
+  flush();
+  return solveTime;
+}
+
+/*!
+\brief Solver stage of the GL backend with interleaving: consecutive scenes, of any size, are packed in the atlases of
+SimpleGeometricMultigridAtlas and solved together, up to ATLAS_SCENES scenes or ATLAS_CELLS cells at a time.
+\return the time spent solving
+*/
+static double SolveAtlas(BoundedQueue<Scene*>& loaded, BoundedQueue<Scene*>& solved)
+{
+  const int ATLAS_SCENES = 64;
+  const size_t ATLAS_CELLS = size_t(1) << 22;
+  double solveTime = 0.0;
+  vector<Scene*> group;
+  size_t cells = 0;
+  auto flush = [&]() {
+    if (group.empty())
+      return;
+    Clock::time_point t0 = Clock::now();
+    SimpleGeometricMultigridAtlas atlas;
+    vector<int> index;
+    for (Scene* scene : group)
+      index.push_back(atlas.Add(move(scene->alphaField), move(scene->altitudeField), move(scene->laplacianField)));
+    atlas.InitGL();
+    atlas.SolveBatch();
+    vector<future<ScalarField2D> > results(group.size());
+    for (unsigned int k = 0; k < group.size(); k++)
+      if (index[k] >= 0)
+        results[k] = atlas.GetResultAsync(index[k]);
+    GPUReadbackQueue::Instance().Poll(true);
+    for (unsigned int k = 0; k < group.size(); k++) {
+      if (index[k] >= 0)
+        group[k]->result = GPUReadbackQueue::Result(results[k]);
+      else
+        cerr << "[error] scene " << group[k]->index << " is not square, it cannot be packed in an atlas" << endl;
+    }
+    solveTime += Seconds(t0);
+    // rejected scenes and failed readbacks have no result, they are neither saved nor counted
+    for (unsigned int k = 0; k < group.size(); k++)
+      if (index[k] >= 0 && group[k]->result.SizeX() > 0)
+        solved.Push(move(group[k]));
+    group.clear();
+    cells = 0;
+  };
+  Scene* scene;
+  while (loaded.Pop(scene)) {
+    size_t n = size_t(scene->alphaField.SizeX()) * scene->alphaField.SizeY();
+    if (!group.empty() && cells + n > ATLAS_CELLS)
+      flush();
+    group.push_back(scene);
+    cells += n;
+    if (int(group.size()) == ATLAS_SCENES)
+      flush();
+  }
+  flush();
+  return solveTime;
+}
+
+/*!
+\brief Solve a batch of scenes with a three stage pipeline.
+Loaders read the maps in parallel, the calling thread owns the solver (and the OpenGL context for the GL backend),
+writers save the results in parallel. Bounded queues between the stages keep the solver fed without loading
+the whole batch in memory.
+\return the number of scenes that have been solved and saved
+*/
+int RunBatch(vector<Scene>& scenes, const BatchOptions& options)
+{
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+
+  BoundedQueue<Scene*> loaded(options.queueSize);
+  BoundedQueue<Scene*> solved(options.queueSize);
+  atomic<int> next(0), activeLoaders(options.loaders), saved(0);
+  Clock::time_point start = Clock::now();
+  long long copies = ScalarField2D::Copies();
+
+  // stage 1 : loaders
+  vector<thread> loaders;
+  for (int t = 0; t < options.loaders; t++) {
+    loaders.push_back(thread([&]() {
+      for (int i = next++; i < int(scenes.size()); i = next++) {
+        scenes[i].Load();
+        if (scenes[i].alphaField.SizeX() == 0 || scenes[i].altitudeField.SizeX() == 0 || scenes[i].laplacianField.SizeX() == 0) {
+          cerr << "[error] cannot load scene " << i << " (" << scenes[i].mask << ")" << endl;
+          continue;
+        }
+        // the hierarchy is built for square scenes, the three maps of the same size
+        const ScalarField2D& alpha = scenes[i].alphaField;
+        const ScalarField2D& altitude = scenes[i].altitudeField;
+        const ScalarField2D& laplacian = scenes[i].laplacianField;
+        if (alpha.SizeX() != alpha.SizeY() || altitude.SizeX() != alpha.SizeX() || altitude.SizeY() != alpha.SizeY()
+          || laplacian.SizeX() != alpha.SizeX() || laplacian.SizeY() != alpha.SizeY()) {
+          cerr << "[error] scene " << i << " (" << scenes[i].mask << "): maps of " << alpha.SizeX() << "x" << alpha.SizeY() << ", "
+            << altitude.SizeX() << "x" << altitude.SizeY() << " and " << laplacian.SizeX() << "x" << laplacian.SizeY()
+            << ", expected three square maps of the same size" << endl;
+          scenes[i].alphaField = ScalarField2D();
+          scenes[i].altitudeField = ScalarField2D();
+          scenes[i].laplacianField = ScalarField2D();
+          continue;
+        }
+        loaded.Push(&scenes[i]);
+      }
+      if (--activeLoaders == 0)
+        loaded.Close();
+    }));
+  }
+
+  // stage 3 : writers
+  vector<thread> writers;
+  for (int t = 0; t < options.writers; t++) {
+    writers.push_back(thread([&]() {
+      Scene* scene;
+      while (solved.Pop(scene)) {
+        scene->result.SavePGM(scene->output);
+        scene->result = ScalarField2D();
+        saved++;
+      }
+    }));
+  }
+
+  // stage 2 : solver, owned by this thread
+  struct InFlight {
+    Scene* scene;
+    future<ScalarField2D> result;
+  };
+  deque<InFlight> inflight;
+  auto retire = [&]() {
+    Scene* scene = inflight.front().scene;
+    scene->result = GPUReadbackQueue::Result(inflight.front().result);
+    inflight.pop_front();
+    if (scene->result.SizeX() > 0) // a failed readback is neither saved nor counted
+      solved.Push(move(scene));
+  };
+  double solveTime = 0.0;
+  Scene* scene;
+  if (options.interleave) // drains the queue, the loop below has nothing left to do
+    solveTime = options.gpu ? SolveAtlas(loaded, solved) : SolveInterleaved(loaded, solved);
+  while (loaded.Pop(scene)) {
+    Clock::time_point t0 = Clock::now();
+    {
+      SimpleGeometricMultigridFloat solver(move(scene->alphaField), move(scene->altitudeField), move(scene->laplacianField), options.layout);
+      solver.quantizeConstraints = options.quantizeConstraints;
+      solver.hybridSize = options.hybridSize;
+      bool gl = options.gpu && (!options.autoBackend
+        || SimpleGeometricMultigridFloat::SelectBackend(solver.nx, options.hybridSize) == SimpleGeometricMultigridFloat::GL);
+      if (gl)
+        solver.InitGL(options.storage);
+      else
+        solver.InitCPU();
+      solver.Solve();
+      inflight.push_back(InFlight{ scene, solver.GetResultAsync() });
+    }
+    // the readback of this scene overlaps the preparation of the next one, only wait for the previous ones
+    if (options.gpu)
+      GPUReadbackQueue::Instance().Poll(true, 1);
+    while (inflight.size() > 1 || (!inflight.empty() && !options.gpu))
+      retire();
+    solveTime += Seconds(t0);
+  }
+  if (options.gpu)
+    GPUReadbackQueue::Instance().Poll(true);
+  while (!inflight.empty())
+    retire();
+  solved.Close();
+
+  for (unsigned int t = 0; t < loaders.size(); t++)
+    loaders[t].join();
+  for (unsigned int t = 0; t < writers.size(); t++)
+    writers[t].join();
+
+  double total = Seconds(start);
+  cout << "Batch: " << saved << "/" << scenes.size() << " scenes in " << total << " s, "
+    << double(saved) / total << " scenes/s (solver busy " << int(100.0 * solveTime / total) << "%, "
+    << ScalarField2D::Copies() - copies << " field copies)" << endl;
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  return saved;
+}
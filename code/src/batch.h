@@ -0,0 +1,85 @@
+#pragma once
+#include "basics.h"
+#include "layout.h"
+#include "diffusionterrain.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// BoundedQueue. Blocking FIFO of limited capacity between two stages of the batch pipeline.
+// Push blocks while the queue is full, Pop blocks while it is empty and returns false once it is closed and drained.
+template<typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+  void Push(T&& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+  }
+
+  bool Pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+protected:
+  size_t capacity;
+  bool closed;
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable notEmpty, notFull;
+};
+
+// Scene. One terrain to solve: the three input maps, the preprocessing parameters and the output file.
+struct Scene {
+  std::string mask;               //!< Alpha map: 0 = fixed constraint (Dirichlet), 1 = laplacian
+  std::string altitude;           //!< Values of the fixed constraints
+  std::string laplacian;          //!< Laplacian map (PGM), or gradient field (PFM) the Laplacian is computed from
+  std::string output;             //!< Result file (PGM)
+  float laplacianOffset = -0.5f;  //!< The laplacian map is centered with this offset...
+  float laplacianScale = 0.03f;   //!< ... then scaled with this factor
+
+  int index = 0;                  //!< Position in the manifest
+  ScalarField2D alphaField, altitudeField, laplacianField;
+  ScalarField2D result;
+
+  void Load();
+  bool Gradient() const;
+};
+
+// BatchOptions. Settings of the batch pipeline.
+struct BatchOptions {
+  bool gpu = true;                //!< Solve with the GL backend, the CPU backend otherwise
+  bool autoBackend = false;       //!< With gpu, pick the backend of each scene with the cost model (SimpleGeometricMultigridFloat::SelectBackend)
+  int loaders = 2;                //!< Number of loading threads
+  int writers = 2;                //!< Number of saving threads
+  int queueSize = 4;              //!< Capacity of the queues between the stages
+  Layout::Order layout = Layout::ROW_MAJOR; //!< Memory layout of the solver
+  SimpleGeometricMultigridFloat::Storage storage = SimpleGeometricMultigridFloat::BUFFERS; //!< Solution storage of the GL backend
+  bool quantizeConstraints = false; //!< Constraints quantized on 16 bits
+  int hybridSize = 0;             //!< GL backend: levels smaller than this size are solved on the CPU
+  bool interleave = false;        //!< Scenes solved together, row-major float constraints only: same-sized ones on the CPU (SimpleGeometricMultigridBatch), any size on the GL backend (SimpleGeometricMultigridAtlas)
+};
+
+std::vector<Scene> ReadManifest(const std::string& filename);
+int RunBatch(std::vector<Scene>& scenes, const BatchOptions& options);
@@ -0,0 +1,608 @@
+#include "benchmark.h"
+#include "diffusionterrain.h"
+#include "refinement.h"
+#include "diffusionbatch.h"
+#include "diffusionatlas.h"
+#include "gpu-readback.h"
+#include "tilestream.h"
+#include "domaindecomposition.h"
+#include "parallel.h"
+#include <thread>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+/*!
+\brief Synthetic scene of the given size: a few Dirichlet disks and lines over a smooth Laplacian.
+*/
+static void SyntheticScene(int size, ScalarField2D& alpha, ScalarField2D& altitude, ScalarField2D& laplacian)
+{
+  alpha = ScalarField2D(size, size, 1.0f);
+  altitude = ScalarField2D(size, size, 0.0f);
+  laplacian = ScalarField2D(size, size, 0.0f);
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      float x = float(i) / size, y = float(j) / size;
+      laplacian.Set(i, j, 0.01f * sinf(12.0f * x) * cosf(9.0f * y));
+      float dx = x - 0.3f, dy = y - 0.6f;
+      bool disk = dx * dx + dy * dy < 0.01f;
+      bool ridge = fabsf(x + 0.5f * y - 0.8f) < 2.0f / size;
+      if (disk || ridge) {
+        alpha.Set(i, j, 0.0f);
+        altitude.Set(i, j, disk ? 1.0f : 0.5f + 0.5f * y);
+      }
+    }
+  }
+}
+
+/*!
+\brief Size of the synthetic scenes: rounded up to 2^n+1, the sizes the hierarchy is built for.
+*/
+static int BenchmarkSize(int size)
+{
+  int s = 3;
+  while (s < size)
+    s = 2 * s - 1;
+  return s;
+}
+
+/*!
+\brief Solve time with the generic or the specialized stencil, a given layout and GL storage, result returned for comparison.
+\param quantize constraints quantized on 16 bits
+\param memory if not null, memory of the CPU solver (hierarchy and solution) or of the GL constraints, in bytes
+*/
+static double TimeSolve(const ScalarField2D& alpha, const ScalarField2D& altitude, const ScalarField2D& laplacian,
+  bool gpu, bool specialized, Layout::Order layout, SimpleGeometricMultigridFloat::Storage storage, ScalarField2D& result,
+  bool quantize = false, size_t* memory = nullptr)
+{
+  SimpleGeometricMultigridFloat solver(alpha.View(), altitude.View(), laplacian.View(), layout);
+  solver.specializedStencil = specialized;
+  solver.quantizeConstraints = quantize;
+  if (gpu)
+    solver.InitGL(storage);
+  else
+    solver.InitCPU();
+  if (memory != nullptr)
+    *memory = solver.HostMemory();
+  Clock::time_point start = Clock::now();
+  solver.Solve();
+  result = solver.GetResult(); // waits for the GPU
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+/*!
+\brief Compare the generic and the specialized (interior + border) Jacobi kernels on each backend.
+Each configuration is solved three times and the best time is kept, the results must be identical.
+\param size size of the synthetic scene, rounded up to 2^n+1 (the sizes the hierarchy is built for)
+\param gpu also run the GL backend, requires a current OpenGL context
+*/
+int RunStencilBenchmark(int size, bool gpu)
+{
+  size = BenchmarkSize(size);
+  ScalarField2D alpha, altitude, laplacian;
+  SyntheticScene(size, alpha, altitude, laplacian);
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  int status = 0;
+  for (int backend = 0; backend < (gpu ? 2 : 1); backend++) {
+    double best[2] = { 1e30, 1e30 };
+    ScalarField2D result[2];
+    for (int run = 0; run < 3; run++)
+      for (int specialized = 0; specialized < 2; specialized++)
+        best[specialized] = min(best[specialized], TimeSolve(alpha, altitude, laplacian, backend == 1, specialized == 1,
+          Layout::ROW_MAJOR, SimpleGeometricMultigridFloat::BUFFERS, result[specialized]));
+
+    bool identical = true;
+    for (int i = 0; i < size * size; i++)
+      identical = identical && result[0].Value(i) == result[1].Value(i);
+    if (!identical)
+      status = 1;
+    cout << (backend == 1 ? "GL " : "CPU") << " " << size << "x" << size << ": generic " << best[0] << " s, specialized " << best[1]
+      << " s, speedup " << best[0] / best[1] << (identical ? "" : " (results differ)") << endl;
+  }
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  return status;
+}
+
+/*!
+\brief Fastest memory layout for a backend: each layout solves the synthetic scene twice, the best time is kept.
+\param size size of the synthetic scene, rounded up to 2^n+1
+\param gpu GL backend if true, requires a current OpenGL context, CPU backend otherwise
+\param print print the time of every layout
+*/
+Layout::Order BestLayout(int size, bool gpu, bool print)
+{
+  size = BenchmarkSize(size);
+  ScalarField2D alpha, altitude, laplacian;
+  SyntheticScene(size, alpha, altitude, laplacian);
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  Layout::Order best = Layout::ROW_MAJOR;
+  double bestTime = 1e30;
+  ScalarField2D reference;
+  for (int o = Layout::ROW_MAJOR; o <= Layout::MORTON; o++) {
+    double time = 1e30;
+    ScalarField2D result;
+    for (int run = 0; run < 2; run++)
+      time = min(time, TimeSolve(alpha, altitude, laplacian, gpu, true, Layout::Order(o), SimpleGeometricMultigridFloat::BUFFERS, result));
+    bool identical = true;
+    if (o == Layout::ROW_MAJOR)
+      reference = std::move(result);
+    else
+      for (int i = 0; i < size * size; i++)
+        identical = identical && result.Value(i) == reference.Value(i);
+    if (print)
+      cout << (gpu ? "GL " : "CPU") << " " << size << "x" << size << ": " << Layout::Name(Layout::Order(o)) << " " << time << " s"
+        << (identical ? "" : " (results differ)") << endl;
+    if (time < bestTime) {
+      bestTime = time;
+      best = Layout::Order(o);
+    }
+  }
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  return best;
+}
+
+/*!
+\brief Compare the memory layouts on each backend.
+\param size size of the synthetic scene
+\param gpu also run the GL backend, requires a current OpenGL context
+*/
+int RunLayoutBenchmark(int size, bool gpu)
+{
+  for (int backend = 0; backend < (gpu ? 2 : 1); backend++) {
+    Layout::Order best = BestLayout(size, backend == 1, true);
+    cout << "Best layout " << (backend == 1 ? "GL" : "CPU") << ": " << Layout::Name(best) << endl;
+  }
+  return 0;
+}
+
+/*!
+\brief Fastest storage of the solution levels on the GL backend, with the row-major layout: each storage solves the
+synthetic scene twice, the best time is kept. Requires a current OpenGL context.
+\param size size of the synthetic scene, rounded up to 2^n+1
+\param print print the time of every storage and the largest difference of the results
+*/
+SimpleGeometricMultigridFloat::Storage BestStorage(int size, bool print)
+{
+  size = BenchmarkSize(size);
+  ScalarField2D alpha, altitude, laplacian;
+  SyntheticScene(size, alpha, altitude, laplacian);
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  double time[2] = { 1e30, 1e30 };
+  ScalarField2D result[2];
+  for (int storage = 0; storage < 2; storage++)
+    for (int run = 0; run < 2; run++)
+      time[storage] = min(time[storage], TimeSolve(alpha, altitude, laplacian, true, true, Layout::ROW_MAJOR,
+        SimpleGeometricMultigridFloat::Storage(storage), result[storage]));
+  SimpleGeometricMultigridFloat::verbose = verbose;
+
+  if (print) {
+    // the bilinear filter of the texture units does not round like the prolongation shader, results are close, not identical
+    float diff = 0.0f;
+    for (int i = 0; i < size * size; i++)
+      diff = max(diff, fabsf(result[0].Value(i) - result[1].Value(i)));
+    cout << "GL  " << size << "x" << size << ": buffers " << time[0] << " s, images " << time[1] << " s, max difference " << diff << endl;
+  }
+  return time[1] < time[0] ? SimpleGeometricMultigridFloat::IMAGES : SimpleGeometricMultigridFloat::BUFFERS;
+}
+
+/*!
+\brief Compare the storage buffers and the textures for the solution levels of the GL backend.
+\param size size of the synthetic scene
+*/
+int RunStorageBenchmark(int size)
+{
+  SimpleGeometricMultigridFloat::Storage best = BestStorage(size, true);
+  cout << "Best storage GL: " << (best == SimpleGeometricMultigridFloat::IMAGES ? "images" : "buffers") << endl;
+  return 0;
+}
+
+/*!
+\brief Error of the 16-bit constraints against the float ones, on each backend: largest and RMS difference of the
+results, in altitude units and in 8-bit output levels, with the solve times and the memory of the CPU solver.
+\param size size of the synthetic scene, rounded up to 2^n+1
+\param gpu also run the GL backend, requires a current OpenGL context
+\return 1 if the largest difference exceeds one output level
+*/
+int RunPrecisionBenchmark(int size, bool gpu)
+{
+  size = BenchmarkSize(size);
+  ScalarField2D alpha, altitude, laplacian;
+  SyntheticScene(size, alpha, altitude, laplacian);
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  int status = 0;
+  for (int backend = 0; backend < (gpu ? 2 : 1); backend++) {
+    double time[2];
+    size_t memory[2];
+    ScalarField2D result[2];
+    for (int q = 0; q < 2; q++)
+      time[q] = TimeSolve(alpha, altitude, laplacian, backend == 1, true, Layout::ROW_MAJOR, SimpleGeometricMultigridFloat::BUFFERS,
+        result[q], q == 1, &memory[q]);
+
+    double maxError = 0.0, sumSquares = 0.0;
+    for (int i = 0; i < size * size; i++) {
+      double e = fabs(double(result[1].Value(i)) - double(result[0].Value(i)));
+      maxError = max(maxError, e);
+      sumSquares += e * e;
+    }
+    double rms = sqrt(sumSquares / (double(size) * size));
+    if (maxError * 255.0 > 1.0)
+      status = 1;
+    cout << (backend == 1 ? "GL " : "CPU") << " " << size << "x" << size << ": float " << time[0] << " s, 16-bit " << time[1]
+      << " s, max error " << maxError << " (" << maxError * 255.0 << " levels), rms " << rms << endl;
+    if (backend == 0)
+      cout << "CPU memory: float " << memory[0] << " bytes, 16-bit " << memory[1] << " bytes" << endl;
+  }
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  return status;
+}
+
+/*!
+\brief Accuracy of the float solver against the double precision CPU solver, and of the mixed-precision iterative
+refinement (refinement.h): solve time, largest residual of the level 0 equations and largest difference with the
+double solve, in altitude units.
+\param size size of the synthetic scene, rounded up to 2^n+1
+\param gpu float solves on the GL backend, requires a current OpenGL context
+\return 1 if the refinement does not lower the residual of the float solver
+*/
+int RunRefinementBenchmark(int size, bool gpu)
+{
+  size = BenchmarkSize(size);
+  ScalarField2D alpha, altitude, laplacian;
+  SyntheticScene(size, alpha, altitude, laplacian);
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  const char* backend = gpu ? "GL " : "CPU";
+
+  ScalarField2D single;
+  double time = TimeSolve(alpha, altitude, laplacian, gpu, true, Layout::ROW_MAJOR, SimpleGeometricMultigridFloat::BUFFERS, single);
+
+  Clock::time_point start = Clock::now();
+  SimpleGeometricMultigridFloat reference(alpha.View(), altitude.View(), laplacian.View());
+  reference.InitCPU(SimpleGeometricMultigridFloat::DOUBLE);
+  reference.Solve();
+  ScalarField2DD solution = reference.GetResultDouble();
+  double timeDouble = chrono::duration<double>(Clock::now() - start).count();
+
+  RefinementOptions options;
+  options.gpu = gpu;
+  std::vector<double> residuals;
+  start = Clock::now();
+  ScalarField2DD refined = SolveRefined(alpha.View(), altitude.View(), laplacian.View(), options, &residuals);
+  double timeRefined = chrono::duration<double>(Clock::now() - start).count();
+
+  ScalarField2DD x = single;
+  double residual = MaxNorm(Residual(alpha.View(), altitude.View(), laplacian.View(), x));
+  double residualDouble = MaxNorm(Residual(alpha.View(), altitude.View(), laplacian.View(), solution));
+  cout << backend << " " << size << "x" << size << ": float " << time << " s, residual " << residual
+    << ", difference with double " << MaxNorm(x - solution) << endl;
+  cout << "CPU " << size << "x" << size << ": double " << timeDouble << " s, residual " << residualDouble << endl;
+  cout << backend << " " << size << "x" << size << ": refined " << timeRefined << " s, " << residuals.size() - 1
+    << " corrections, residual " << residuals.back() << ", difference with double " << MaxNorm(refined - solution) << endl;
+  cout << "Residual after each correction:";
+  for (unsigned int i = 0; i < residuals.size(); i++)
+    cout << " " << residuals[i];
+  cout << endl;
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  return residuals.back() < residuals.front() ? 0 : 1;
+}
+
+/*!
+\brief Batch of small scenes on the CPU: one SimpleGeometricMultigridFloat per scene against the interleaved solver
+(SimpleGeometricMultigridBatch), setup included. The scenes are variants of the synthetic scene, transposed or with
+a scaled Laplacian.
+\param size size of the scenes, rounded up to 2^n+1
+\return 1 if the results differ
+*/
+int RunInterleaveBenchmark(int size)
+{
+  size = BenchmarkSize(size);
+  const int n = SimpleGeometricMultigridBatch::LANES;
+  vector<ScalarField2D> alpha(n), altitude(n), laplacian(n);
+  for (int k = 0; k < n; k++) {
+    SyntheticScene(size, alpha[k], altitude[k], laplacian[k]);
+    laplacian[k] *= 1.0f + 0.25f * k;
+    if (k % 2 == 1) {
+      for (ScalarField2D* field : { &alpha[k], &altitude[k], &laplacian[k] }) {
+        ScalarField2D transposed(size, size);
+        for (int i = 0; i < size; i++)
+          for (int j = 0; j < size; j++)
+            transposed.Set(j, i, field->Get(i, j));
+        field->Swap(transposed);
+      }
+    }
+  }
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  double best[2] = { 1e30, 1e30 };
+  vector<ScalarField2D> single(n), interleaved(n);
+  for (int run = 0; run < 3; run++) {
+    Clock::time_point start = Clock::now();
+    for (int k = 0; k < n; k++) {
+      SimpleGeometricMultigridFloat solver(alpha[k].View(), altitude[k].View(), laplacian[k].View());
+      solver.InitCPU();
+      solver.Solve();
+      single[k] = solver.GetResult();
+    }
+    best[0] = min(best[0], chrono::duration<double>(Clock::now() - start).count());
+
+    start = Clock::now();
+    SimpleGeometricMultigridBatch batch(size);
+    for (int k = 0; k < n; k++)
+      batch.Add(alpha[k].View(), altitude[k].View(), laplacian[k].View());
+    batch.SolveBatch();
+    for (int k = 0; k < n; k++)
+      interleaved[k] = batch.GetResult(k);
+    best[1] = min(best[1], chrono::duration<double>(Clock::now() - start).count());
+  }
+  SimpleGeometricMultigridFloat::verbose = verbose;
+
+  double maxError = 0.0;
+  for (int k = 0; k < n; k++)
+    for (int i = 0; i < size * size; i++)
+      maxError = max(maxError, fabs(double(single[k].Value(i)) - double(interleaved[k].Value(i))));
+  cout << "CPU " << n << " scenes " << size << "x" << size << ": one solver per scene " << best[0] << " s, interleaved "
+    << best[1] << " s, speedup " << best[0] / best[1] << ", max difference " << maxError << endl;
+  return maxError == 0.0 ? 0 : 1;
+}
+
+/*!
+\brief Batch of small scenes of mixed sizes on the GL backend: one SimpleGeometricMultigridFloat per scene against the
+atlas solver (SimpleGeometricMultigridAtlas), one dispatch per sweep for all the scenes, upload and readback included.
+Requires a current OpenGL context.
+\param count number of scenes
+\param size size of the largest scenes, rounded up to 2^n+1, the others are half and quarter sized
+\return 1 if the results differ
+*/
+int RunAtlasBenchmark(int count, int size)
+{
+  size = BenchmarkSize(size);
+  vector<ScalarField2D> alpha(count), altitude(count), laplacian(count);
+  for (int k = 0; k < count; k++) {
+    int s = k % 3 == 0 ? size : k % 3 == 1 ? size / 2 + 1 : size / 4 + 1;
+    SyntheticScene(max(s, 3), alpha[k], altitude[k], laplacian[k]);
+    laplacian[k] *= 1.0f + 0.25f * (k % 8);
+  }
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  double best[2] = { 1e30, 1e30 };
+  vector<ScalarField2D> single(count), atlas(count);
+  for (int run = 0; run < 3; run++) {
+    Clock::time_point start = Clock::now();
+    for (int k = 0; k < count; k++) {
+      SimpleGeometricMultigridFloat solver(alpha[k].View(), altitude[k].View(), laplacian[k].View());
+      solver.InitGL();
+      solver.Solve();
+      single[k] = solver.GetResult();
+    }
+    best[0] = min(best[0], chrono::duration<double>(Clock::now() - start).count());
+
+    start = Clock::now();
+    SimpleGeometricMultigridAtlas solver;
+    for (int k = 0; k < count; k++)
+      solver.Add(alpha[k].View(), altitude[k].View(), laplacian[k].View());
+    solver.InitGL();
+    solver.SolveBatch();
+    vector<future<ScalarField2D> > results;
+    for (int k = 0; k < count; k++)
+      results.push_back(solver.GetResultAsync(k));
+    GPUReadbackQueue::Instance().Poll(true);
+    for (int k = 0; k < count; k++)
+      atlas[k] = GPUReadbackQueue::Result(results[k]);
+    best[1] = min(best[1], chrono::duration<double>(Clock::now() - start).count());
+  }
+  SimpleGeometricMultigridFloat::verbose = verbose;
+
+  double maxError = 0.0;
+  for (int k = 0; k < count; k++)
+    for (int i = 0; i < single[k].SizeX() * single[k].SizeY(); i++)
+      maxError = max(maxError, fabs(double(single[k].Value(i)) - double(atlas[k].Value(i))));
+  cout << "GL " << count << " scenes up to " << size << "x" << size << ": one solver per scene " << best[0] << " s, atlas "
+    << best[1] << " s, speedup " << best[0] / best[1] << ", max difference " << maxError << endl;
+  return maxError == 0.0 ? 0 : 1;
+}
+
+/*!
+\brief Compare the solve of the whole scene with the solve of a region of an eighth of its size (SolveRegion), on the
+CPU: time and largest difference in the region. The region covering the whole scene must give the result of Solve.
+\param size size of the synthetic scene, rounded up to 2^n+1
+*/
+int RunRegionBenchmark(int size)
+{
+  size = BenchmarkSize(size);
+  ScalarField2D alpha, altitude, laplacian;
+  SyntheticScene(size, alpha, altitude, laplacian);
+  int rows = max(1, size / 8), i0 = size / 2, j0 = size / 3;
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  SimpleGeometricMultigridFloat solver(std::move(alpha), std::move(altitude), std::move(laplacian));
+  solver.InitCPU();
+  double best[2] = { 1e30, 1e30 };
+  ScalarField2D full, region;
+  for (int run = 0; run < 3; run++) {
+    Clock::time_point start = Clock::now();
+    solver.Solve();
+    full = solver.GetResult();
+    best[0] = min(best[0], chrono::duration<double>(Clock::now() - start).count());
+    start = Clock::now();
+    region = solver.SolveRegion(i0, j0, rows, rows);
+    best[1] = min(best[1], chrono::duration<double>(Clock::now() - start).count());
+  }
+  double maxError = 0.0;
+  for (int i = 0; i < rows; i++)
+    for (int j = 0; j < rows; j++)
+      maxError = max(maxError, fabs(double(full.Get(i0 + i, j0 + j)) - double(region.Get(i, j))));
+  ScalarField2D whole = solver.SolveRegion(0, 0, size, size);
+  double wholeError = 0.0;
+  for (int i = 0; i < size * size; i++)
+    wholeError = max(wholeError, fabs(double(full.Value(i)) - double(whole.Value(i))));
+  SimpleGeometricMultigridFloat::verbose = verbose;
+
+  cout << "CPU " << size << "x" << size << ": whole scene " << best[0] << " s, region " << rows << "x" << rows << " "
+    << best[1] << " s, speedup " << best[0] / best[1] << ", max difference in the region " << maxError << endl;
+  cout << "Region of the whole scene: max difference " << wholeError << endl;
+  return wholeError == 0.0 ? 0 : 1;
+}
+
+/*!
+\brief Constraints of an unbounded synthetic world at the cell (i, j): Dirichlet disks on a lattice, with varying
+altitudes, over a smooth Laplacian.
+*/
+static void SyntheticWorld(int i, int j, float& alpha, float& altitude, float& laplacian)
+{
+  const int spacing = 97;
+  int ci = (i >= 0 ? i : i - spacing + 1) / spacing, cj = (j >= 0 ? j : j - spacing + 1) / spacing;
+  int di = i - ci * spacing - spacing / 2, dj = j - cj * spacing - spacing / 2;
+  unsigned int hash = (unsigned int)(ci * 73856093) ^ (unsigned int)(cj * 19349663);
+  int radius = 4 + int(hash % 8u);
+  bool disk = di * di + dj * dj < radius * radius;
+  alpha = disk ? 0.0f : 1.0f;
+  altitude = disk ? float(hash % 1000u) / 1000.0f : 0.0f;
+  laplacian = disk ? 0.0f : 0.0005f * sinf(0.02f * i) * cosf(0.015f * j);
+}
+
+/*!
+\brief Stream the tiles of a synthetic world around a moving camera (TileStream): time per tile, largest difference
+on the shared rows and columns of the solved tiles, and largest second difference across the seams compared with
+the one inside the tiles, a crease along the seams would show in the first.
+\param size size of the tiles, rounded up to 2^n+1
+*/
+int RunStreamBenchmark(int size)
+{
+  size = BenchmarkSize(size);
+  auto source = [size](int ti, int tj, ScalarField2D& alpha, ScalarField2D& altitude, ScalarField2D& laplacian) {
+    alpha = ScalarField2D(size, size);
+    altitude = ScalarField2D(size, size);
+    laplacian = ScalarField2D(size, size);
+    for (int i = 0; i < size; i++) {
+      for (int j = 0; j < size; j++) {
+        float a, h, l;
+        SyntheticWorld(ti * (size - 1) + i, tj * (size - 1) + j, a, h, l);
+        alpha.Set(i, j, a);
+        altitude.Set(i, j, h);
+        laplacian.Set(i, j, l);
+      }
+    }
+  };
+
+  // camera along a diagonal, the tiles within two tiles of it, all kept in the cache
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  TileStream stream(size, source, 256);
+  double radius = 2.0 * (size - 1), time = 0.0;
+  for (int step = 0; step < 8; step++) {
+    double position = 0.5 * step * (size - 1);
+    Clock::time_point start = Clock::now();
+    stream.Update(position, 0.7 * position, radius, Clock::time_point::max());
+    time += chrono::duration<double>(Clock::now() - start).count();
+  }
+  SimpleGeometricMultigridFloat::verbose = verbose;
+
+  // seams between a tile and the next one down, then right: values of the shared row, second difference across it
+  double seam = 0.0, crease = 0.0, inside = 0.0;
+  for (int ti = -3; ti <= 6; ti++) {
+    for (int tj = -3; tj <= 6; tj++) {
+      if (!stream.Solved(ti, tj))
+        continue;
+      ScalarField2D tile = stream.Tile(ti, tj);
+      for (int i = 1; i < size - 1; i++)
+        for (int j = 0; j < size; j++)
+          inside = max(inside, fabs(double(tile.Get(i - 1, j)) - 2.0 * tile.Get(i, j) + tile.Get(i + 1, j)));
+      for (int d = 0; d < 2; d++) {
+        if (!stream.Solved(ti + 1 - d, tj + d))
+          continue;
+        const ScalarField2D& next = stream.Tile(ti + 1 - d, tj + d);
+        for (int k = 0; k < size; k++) {
+          double last = d == 0 ? tile.Get(size - 1, k) : tile.Get(k, size - 1);
+          double before = d == 0 ? tile.Get(size - 2, k) : tile.Get(k, size - 2);
+          double first = d == 0 ? next.Get(0, k) : next.Get(k, 0);
+          double after = d == 0 ? next.Get(1, k) : next.Get(k, 1);
+          seam = max(seam, fabs(last - first));
+          crease = max(crease, fabs(before - 2.0 * last + after));
+        }
+      }
+    }
+  }
+  cout << "CPU tiles " << size << "x" << size << ": " << stream.Generated() << " tiles in " << time << " s, "
+    << time / stream.Generated() << " s per tile" << endl;
+  cout << "Seams: max difference " << seam << ", max second difference across " << crease << ", inside the tiles " << inside << endl;
+  return seam == 0.0 ? 0 : 1;
+}
+
+/*!
+\brief Compare the single process solve on the CPU (SimpleGeometricMultigridFloat::Solve) with the domain
+decomposition on 2 and 4 processes and on one process per hardware thread: best time of three, the build of the
+hierarchy or of the strips included, parallel efficiency (single process time / (processes * time)), peak memory of
+each rank against the single process, largest difference, the results must be identical.
+\param size size of the synthetic scene, rounded up to 2^n+1
+*/
+int RunDomainBenchmark(int size)
+{
+  size = BenchmarkSize(size);
+  ScalarField2D alpha, altitude, laplacian;
+  SyntheticScene(size, alpha, altitude, laplacian);
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  double single = 1e30;
+  size_t singleMemory = 0;
+  ScalarField2D reference;
+  for (int run = 0; run < 3; run++) {
+    Clock::time_point start = Clock::now();
+    SimpleGeometricMultigridFloat solver(alpha.View(), altitude.View(), laplacian.View());
+    solver.InitCPU();
+    solver.Solve();
+    reference = solver.GetResult();
+    single = min(single, chrono::duration<double>(Clock::now() - start).count());
+    singleMemory = solver.HostMemory() + reference.Memory();
+  }
+  cout << "CPU " << size << "x" << size << ": single process " << single << " s, " << ThreadCount() << " threads, "
+    << double(singleMemory) / (1024 * 1024) << " MB" << endl;
+
+  vector<int> counts = { 2, 4 };
+  int hardware = max(1, int(thread::hardware_concurrency()));
+  if (hardware > 4)
+    counts.push_back(hardware);
+  int status = 0;
+  for (int processes : counts) {
+    DomainDecomposition domain(alpha.View(), altitude.View(), laplacian.View(), processes);
+    double best = 1e30;
+    bool solved = true;
+    for (int run = 0; run < 3 && solved; run++) {
+      Clock::time_point start = Clock::now();
+      solved = domain.Solve();
+      best = min(best, chrono::duration<double>(Clock::now() - start).count());
+    }
+    if (!solved) {
+      status = 1;
+      continue;
+    }
+    ScalarField2D result = domain.GetResult();
+    double maxError = 0.0;
+    for (int i = 0; i < size * size; i++)
+      maxError = max(maxError, fabs(double(result.Value(i)) - double(reference.Value(i))));
+    cout << "CPU " << size << "x" << size << ": " << processes << " processes " << best << " s, speedup " << single / best
+      << ", efficiency " << single / (processes * best) << ", peak memory per rank";
+    for (int rank = 0; rank < processes; rank++)
+      cout << (rank == 0 ? " " : " / ") << double(domain.Memory(rank)) / (1024 * 1024);
+    cout << " MB, max difference " << maxError << endl;
+    if (maxError != 0.0)
+      status = 1;
+  }
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  return status;
+}
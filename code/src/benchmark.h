@@ -0,0 +1,20 @@
+#pragma once
+
+#include "layout.h"
+#include "diffusionterrain.h"
+
+// Micro benchmarks of the solver kernels on synthetic scenes, run from the command line (main --bench-stencil,
+// main --bench-layout, main --bench-storage, main --bench-quantize, main --bench-refine,
+// main --bench-interleave, main --bench-atlas, main --bench-region, main --bench-stream, main --bench-domain).
+int RunStencilBenchmark(int size, bool gpu);
+int RunLayoutBenchmark(int size, bool gpu);
+Layout::Order BestLayout(int size, bool gpu, bool print = false);
+int RunStorageBenchmark(int size);
+SimpleGeometricMultigridFloat::Storage BestStorage(int size, bool print = false);
+int RunPrecisionBenchmark(int size, bool gpu);
+int RunRefinementBenchmark(int size, bool gpu);
+int RunInterleaveBenchmark(int size);
+int RunAtlasBenchmark(int count, int size);
+int RunRegionBenchmark(int size);
+int RunStreamBenchmark(int size);
+int RunDomainBenchmark(int size);
@@ -0,0 +1,128 @@
+#include "calibration.h"
+#include "system-info.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+// Leading and trailing blanks removed
+static string Trim(const string& text)
+{
+  size_t first = text.find_first_not_of(" \t\r");
+  if (first == string::npos)
+    return "";
+  size_t last = text.find_last_not_of(" \t\r");
+  return text.substr(first, last - first + 1);
+}
+
+Calibration& Calibration::Instance()
+{
+  static Calibration calibration;
+  return calibration;
+}
+
+Calibration::Calibration()
+{
+  const char* path = getenv("GRADIENT_CALIBRATION");
+  filename = path != nullptr && path[0] != '\0' ? path : "calibration.txt";
+  string processor = ProcessorName();
+  machine = (processor.empty() ? string("unknown processor") : processor) + ", "
+    + to_string(max(1u, thread::hardware_concurrency())) + " threads";
+  Load();
+}
+
+/*!
+\brief Read the file, a missing one is the same as an empty one. Malformed lines are ignored.
+*/
+void Calibration::Load()
+{
+  ifstream file(filename);
+  string line, section;
+  while (getline(file, line)) {
+    line = Trim(line);
+    if (line.empty() || line[0] == '#')
+      continue;
+    if (line[0] == '[' && line.back() == ']') {
+      section = line.substr(1, line.size() - 2);
+      continue;
+    }
+    size_t equal = line.rfind('=');
+    if (equal == string::npos)
+      continue;
+    char* end = nullptr;
+    string number = Trim(line.substr(equal + 1));
+    double value = strtod(number.c_str(), &end);
+    if (end != number.c_str() && *end == '\0')
+      sections[section][Trim(line.substr(0, equal))] = value;
+  }
+}
+
+/*!
+\brief Write all the sections of the file.
+\return false if the file cannot be written, the values are then only kept until the end of the run
+*/
+bool Calibration::Save() const
+{
+  ofstream file(filename);
+  if (!file.is_open())
+    return false;
+  file.precision(9);
+  file << "# measurements of the solver, remove a line (or the file) to measure it again" << endl;
+  for (const auto& section : sections) {
+    file << "[" << section.first << "]" << endl;
+    for (const auto& value : section.second)
+      file << value.first << " = " << value.second << endl;
+  }
+  return bool(file);
+}
+
+/*!
+\brief Value measured on this machine.
+\return false if it has not been measured yet
+*/
+bool Calibration::Get(const string& name, double& value) const
+{
+  auto section = sections.find(machine);
+  if (section == sections.end())
+    return false;
+  auto it = section->second.find(name);
+  if (it == section->second.end())
+    return false;
+  value = it->second;
+  return true;
+}
+
+/*!
+\brief Store a value measured on this machine, the file is written immediately.
+*/
+void Calibration::Set(const string& name, double value)
+{
+  sections[machine][name] = value;
+  if (!Save())
+    cerr << "[warning] cannot write the calibration file " << filename << endl;
+}
+
+/*!
+\brief Forget a value of this machine, so that it is measured again.
+*/
+void Calibration::Clear(const string& name)
+{
+  auto section = sections.find(machine);
+  if (section != sections.end() && section->second.erase(name) > 0)
+    Save();
+}
+
+/*!
+\brief Name of the section of this machine.
+*/
+const string& Calibration::Machine() const
+{
+  return machine;
+}
+
+const string& Calibration::Filename() const
+{
+  return filename;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <map>
+#include <string>
+
+// Calibration. Measurements of the machine reused between runs, so that each one is only taken once: values are
+// kept in a text file, one section per machine (processor name and number of hardware threads),
+//   [Intel(R) Core(TM) i7-9700K CPU @ 3.60GHz, 8 threads]
+//   hybrid size, NVIDIA GeForce RTX 2080/PCIe/SSE2 = 129
+// Values that depend on the OpenGL implementation have its renderer in their name.
+// The file is calibration.txt in the working directory, or the one given by the GRADIENT_CALIBRATION environment
+// variable. A file shared between machines keeps one section for each of them.
+class Calibration {
+public:
+  static Calibration& Instance();
+
+  bool Get(const std::string& name, double& value) const;
+  void Set(const std::string& name, double value);
+  void Clear(const std::string& name);
+  const std::string& Machine() const;
+  const std::string& Filename() const;
+protected:
+  Calibration();
+  void Load();
+  bool Save() const;
+
+  std::string filename;
+  std::string machine;                                             //!< Section of this machine
+  std::map<std::string, std::map<std::string, double> > sections;  //!< Values of every machine of the file
+};
@@ -0,0 +1,266 @@
+#include "gpu-shader.h"
+#include "diffusionatlas.h"
+#include "diffusionterrain.h"
+#include "gpu-bufferpool.h"
+#include "gpu-readback.h"
+#include "stencil.h"
+
+using namespace std;
+
+static const int G = SimpleGeometricMultigridAtlas::WORK_GROUP_SIZE;
+
+/*!
+\brief Empty atlas, the scenes are added by Add, then uploaded by InitGL.
+*/
+SimpleGeometricMultigridAtlas::SimpleGeometricMultigridAtlas() : atlases(0), gpuBytes(0), shaderStep(0), shaderProlong(0)
+{
+}
+
+SimpleGeometricMultigridAtlas::~SimpleGeometricMultigridAtlas()
+{
+  GPUBufferPool& pool = GPUBufferPool::Instance();
+  for (const vector<GLuint>* buffers : { &glbufferCoefficients, &glbufferA, &glbufferB, &glbufferScenes, &glbufferGroups })
+    pool.Release(int(buffers->size()), buffers->data());
+}
+
+// Size of a level of a scene
+static int LevelSize(int nx, int level)
+{
+  int s = nx;
+  for (int i = 0; i < level; i++)
+    s = s / 2 + 1;
+  return s;
+}
+
+// Coefficients of the step of a level from its constraints (row-major), a and c of each cell
+template<typename C>
+static vector<float> LevelCoefficients(const C& constraints, int s)
+{
+  vector<float> ac(size_t(s) * s * 2);
+  for (int i = 0; i < s; i++) {
+    for (int j = 0; j < s; j++) {
+      int idx = i * s + j;
+      float al = constraints.Alpha(i, j, idx);
+      ac[2 * size_t(idx)] = al;
+      ac[2 * size_t(idx) + 1] = (1.0f - al) * constraints.Altitude(i, j, idx) - al * constraints.Laplacian(i, j, idx);
+    }
+  }
+  return ac;
+}
+
+/*!
+\brief Add a scene: its hierarchy is restricted by SimpleGeometricMultigridFloat, then kept as the coefficients of
+the step until InitGL.
+\return the index of the scene, -1 if the scene is not square or if the atlas is already uploaded
+*/
+int SimpleGeometricMultigridAtlas::Add(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+  const ConstScalarField2DView& laplacian)
+{
+  if (alpha.SizeX() != alpha.SizeY() || atlases > 0)
+    return -1;
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  SimpleGeometricMultigridFloat hierarchy(alpha, altitude, laplacian);
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  return Add(hierarchy);
+}
+
+/*!
+\brief Same as above, the fields are moved into the hierarchy instead of being copied.
+*/
+int SimpleGeometricMultigridAtlas::Add(ScalarField2D&& alpha, ScalarField2D&& altitude, ScalarField2D&& laplacian)
+{
+  if (alpha.SizeX() != alpha.SizeY() || atlases > 0)
+    return -1;
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  SimpleGeometricMultigridFloat hierarchy(std::move(alpha), std::move(altitude), std::move(laplacian));
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  return Add(hierarchy);
+}
+
+/*!
+\brief Store the coefficients of every level of a hierarchy as a new scene.
+*/
+int SimpleGeometricMultigridAtlas::Add(const SimpleGeometricMultigridFloat& hierarchy)
+{
+  SceneLevels scene;
+  scene.nx = hierarchy.nx;
+  scene.mgsize = hierarchy.mgsize;
+  scene.offset = 0;
+  scene.coefficients.resize(scene.mgsize);
+  for (int r = 0; r < scene.mgsize; r++) {
+    int s = LevelSize(scene.nx, r);
+    if (hierarchy.Packed(r))
+      scene.coefficients[r] = LevelCoefficients(Stencil::Packed(hierarchy.constraints[r]), s);
+    else {
+      Stencil::Fields fields = { hierarchy.alpha[0].View().Data(), hierarchy.altitude[0].View().Data(), hierarchy.laplacian[0].View().Data() };
+      scene.coefficients[r] = LevelCoefficients(fields, s);
+    }
+  }
+  scenes.push_back(std::move(scene));
+  return int(scenes.size()) - 1;
+}
+
+/*!
+\brief Pack the levels of all the scenes in the atlases and upload them, requires a current OpenGL context.
+The initial guess is 0, except on the coarsest level of the scenes that have a single level: alpha, as in
+SimpleGeometricMultigridFloat::InitialGuess.
+*/
+void SimpleGeometricMultigridAtlas::InitGL()
+{
+  // compiled once, shared by all the atlases of the context
+  static const std::string definitions = "#define WORK_GROUP_SIZE " + std::to_string(G) + "\n";
+  static const GLuint step = read_program("../shader/mgatlasfloat.glsl", definitions.c_str());
+  static const GLuint prolong = read_program("../shader/mgatlasfloat.glsl", (definitions + "#define ATLAS_PROLONG\n").c_str());
+  shaderStep = step;
+  shaderProlong = prolong;
+
+  atlases = 0;
+  for (const SceneLevels& scene : scenes)
+    atlases = max(atlases, scene.mgsize);
+  GPUBufferPool& pool = GPUBufferPool::Instance();
+  vector<int> previous(scenes.size(), -1); // offset of each scene in the previous atlas
+  for (int k = 0; k < atlases; k++) {
+    // regions of the scenes of the atlas, then the tables
+    vector<int> table, groupScene;
+    vector<int> offsets(scenes.size(), -1);
+    size_t total = 0;
+    for (unsigned int n = 0; n < scenes.size(); n++) {
+      const SceneLevels& scene = scenes[n];
+      if (scene.mgsize <= k)
+        continue;
+      int s = LevelSize(scene.nx, scene.mgsize - 1 - k);
+      int g = (s * s + G - 1) / G;
+      offsets[n] = int(total);
+      int entry = int(table.size()) / 4;
+      table.insert(table.end(), { int(total), s, previous[n], int(groupScene.size()) });
+      groupScene.insert(groupScene.end(), g, entry);
+      total += size_t(g) * G;
+    }
+    vector<float> coefficients(2 * total, 0.0f), initial(total, 0.0f);
+    for (unsigned int n = 0; n < scenes.size(); n++) {
+      if (offsets[n] < 0)
+        continue;
+      int level = scenes[n].mgsize - 1 - k;
+      vector<float>& ac = scenes[n].coefficients[level];
+      copy(ac.begin(), ac.end(), coefficients.begin() + 2 * size_t(offsets[n]));
+      if (level == 0 && k == 0)
+        for (size_t c = 0; c < ac.size() / 2; c++)
+          initial[offsets[n] + c] = ac[2 * c];
+      if (level == 0)
+        scenes[n].offset = offsets[n];
+      vector<float>().swap(ac); // uploaded, not needed anymore
+    }
+    GLsizeiptr bytes = GLsizeiptr(total * sizeof(float));
+    glbufferCoefficients.push_back(pool.Acquire(2 * bytes, coefficients.data()));
+    glbufferA.push_back(pool.Acquire(bytes, initial.data()));
+    glbufferB.push_back(pool.Acquire(bytes));
+    glbufferScenes.push_back(pool.Acquire(GLsizeiptr(table.size() * sizeof(int)), table.data()));
+    glbufferGroups.push_back(pool.Acquire(GLsizeiptr(groupScene.size() * sizeof(int)), groupScene.data()));
+    groups.push_back(int(groupScene.size()));
+    gpuBytes += 4 * size_t(bytes) + (table.size() + groupScene.size()) * sizeof(int);
+    previous = offsets;
+  }
+  if (SimpleGeometricMultigridFloat::verbose)
+    cout << "Atlas: " << scenes.size() << " scenes in " << atlases << " atlases, GPU buffers size en bytes " << GPUMemory() << endl;
+}
+
+/*!
+\brief Run a program on the work groups of an atlas, in several dispatches if they are more than the limit of the
+implementation (65535 on some): the work groups write disjoint cells, no barrier between the dispatches.
+*/
+void SimpleGeometricMultigridAtlas::Dispatch(GLuint program, int count)
+{
+  int limit = max_work_group_count();
+  for (int first = 0; first < count;) {
+    int n = min(limit, count - first);
+    glProgramUniform1ui(program, glGetUniformLocation(program, "GroupFirst"), GLuint(first));
+    glDispatchCompute(GLuint(n), 1, 1);
+    first += n;
+  }
+}
+
+/*!
+\brief Solve all the scenes, same schedule as SimpleGeometricMultigridFloat::VCycle: one dispatch per prolongation
+and per sweep for all the scenes.
+*/
+void SimpleGeometricMultigridAtlas::SolveBatch()
+{
+  if (atlases == 0)
+    InitGL();
+  GPUReadbackQueue::Instance().Poll(); // complete the readbacks of the previous solves, if they are ready
+  for (int k = 0; k < atlases; k++) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, glbufferScenes[k]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, glbufferGroups[k]);
+    if (k > 0) {
+      // every scene of atlas k has its next coarser level in atlas k - 1
+      glUseProgram(shaderProlong);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, glbufferA[k]);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, glbufferA[k - 1]);
+      Dispatch(shaderProlong, groups[k]);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    int nit = 50 + 10 * (k + 1);
+    glUseProgram(shaderStep);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, glbufferCoefficients[k]);
+    for (int step = 0; step < nit; step++) {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, glbufferA[k]);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, glbufferB[k]);
+      Dispatch(shaderStep, groups[k]);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+      std::swap(glbufferA[k], glbufferB[k]);
+    }
+  }
+  for (int b = 2; b <= 7; b++)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+  glUseProgram(0);
+}
+
+/*!
+\brief Start the download of the result of a scene: its region is copied to a row-major buffer, then read back
+asynchronously. The future is fulfilled by GPUReadbackQueue::Poll.
+*/
+std::future<ScalarField2D> SimpleGeometricMultigridAtlas::GetResultAsync(int scene)
+{
+  const SceneLevels& levels = scenes[scene];
+  GLsizeiptr bytes = GLsizeiptr(levels.nx) * levels.nx * sizeof(float);
+  GPUBufferPool& pool = GPUBufferPool::Instance();
+  GLuint region = pool.Acquire(bytes);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glCopyNamedBufferSubData(glbufferA[levels.mgsize - 1], region, GLintptr(levels.offset) * sizeof(float), 0, bytes);
+  std::future<ScalarField2D> result = GPUReadbackQueue::Instance().Enqueue(region, levels.nx, levels.nx);
+  pool.Release(region);
+  return result;
+}
+
+ScalarField2D SimpleGeometricMultigridAtlas::GetResult(int scene)
+{
+  std::future<ScalarField2D> result = GetResultAsync(scene);
+  GPUReadbackQueue::Instance().Poll(true);
+  return GPUReadbackQueue::Result(result);
+}
+
+/*!
+\brief Number of scenes in the atlases.
+*/
+int SimpleGeometricMultigridAtlas::Scenes() const
+{
+  return int(scenes.size());
+}
+
+/*!
+\brief Number of atlases, 0 before InitGL.
+*/
+int SimpleGeometricMultigridAtlas::Atlases() const
+{
+  return atlases;
+}
+
+/*!
+\brief Size of the buffers of the atlases, in bytes.
+*/
+size_t SimpleGeometricMultigridAtlas::GPUMemory() const
+{
+  return gpuBytes;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <GL/glew.h>
+#include "basics.h"
+#include <future>
+#include <vector>
+
+class SimpleGeometricMultigridFloat;
+
+// SimpleGeometricMultigridAtlas. GL solver of many small scenes at once, of any size: the cost of a single solve of a
+// small scene is the dispatches and barriers of its sweeps, not their work. The levels of all the scenes are packed in
+// atlases, one set of shader storage buffers per atlas, and every sweep is a single dispatch over all the scenes.
+// The atlases are aligned on the coarsest level: atlas k holds level mgsize - 1 - k of every scene that has more than
+// k levels, so that the number of iterations of atlas k, 50 + 10 * (k + 1), is the one of the single scene solver for
+// all of them. Each scene has a row-major region of the atlas, starting on a work group boundary, found by the shader
+// in a table of the scenes of the atlas.
+// The constraints of each scene are restricted by SimpleGeometricMultigridFloat, then stored per cell as the two
+// coefficients of the step b = a * avg + c (same as SimpleGeometricMultigridBatch): all the cells are smoothed, the
+// fixed ones (a = 0) keep their value. With a binary alpha the results are bit-identical to the single scene solver.
+class SimpleGeometricMultigridAtlas {
+public:
+    static const int WORK_GROUP_SIZE = 64;  //!< Cells per work group, the regions are padded to a multiple of it
+    SimpleGeometricMultigridAtlas();
+    ~SimpleGeometricMultigridAtlas();
+    int Add(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude, const ConstScalarField2DView& laplacian);
+    int Add(ScalarField2D&& alpha, ScalarField2D&& altitude, ScalarField2D&& laplacian);
+    void InitGL();
+    void SolveBatch();
+    ScalarField2D GetResult(int scene);
+    std::future<ScalarField2D> GetResultAsync(int scene);
+    int Scenes() const;
+    int Atlases() const;
+    size_t GPUMemory() const;
+protected:
+    struct SceneLevels {
+        int nx;                                 //!< Size of the scene
+        int mgsize;                             //!< Number of levels
+        int offset;                             //!< Offset of level 0 in its atlas, set by InitGL
+        std::vector<std::vector<float> > coefficients; //!< a and c of each cell of each level, released by InitGL
+    };
+    int Add(const SimpleGeometricMultigridFloat& hierarchy);
+    void Dispatch(GLuint program, int count);
+    std::vector<SceneLevels> scenes;
+    int atlases;                            //!< Number of atlases, the largest number of levels of the scenes
+    std::vector<int> groups;                //!< Number of work groups of each atlas
+    size_t gpuBytes;                        //!< Size of the buffers of the atlases
+    GLuint shaderStep;
+    GLuint shaderProlong;
+    std::vector<GLuint> glbufferCoefficients;
+    std::vector<GLuint> glbufferA;          //!< Solution of each atlas
+    std::vector<GLuint> glbufferB;
+    std::vector<GLuint> glbufferScenes;     //!< Table of the scenes of each atlas
+    std::vector<GLuint> glbufferGroups;     //!< Scene of each work group of each atlas
+};
@@ -0,0 +1,239 @@
+#include "diffusionbatch.h"
+#include "diffusionterrain.h"
+#include "parallel.h"
+#include "stencil.h"
+
+using namespace std;
+
+static const int L = SimpleGeometricMultigridBatch::LANES;
+
+/*!
+\brief Empty batch of scenes of size x size, same hierarchy as SimpleGeometricMultigridFloat. The unused lanes have
+no constraint and stay at 0.
+*/
+SimpleGeometricMultigridBatch::SimpleGeometricMultigridBatch(int size) : nx(size), mgsize(1), scenes(0)
+{
+  int s = nx;
+  while (s > 9) {
+    mgsize++;
+    s = s / 2 + 1;
+  }
+  coefficient.resize(mgsize);
+  constant.resize(mgsize);
+  bufferA.resize(mgsize);
+  bufferB.resize(mgsize);
+  for (int r = 0; r < mgsize; r++) {
+    s = LevelSize(r);
+    coefficient[r] = ScalarField2D(s * L, s, 0.0f);
+    constant[r] = ScalarField2D(s * L, s, 0.0f);
+    bufferA[r] = ScalarField2D(s * L, s, 0.0f);
+    bufferB[r] = ScalarField2D(s * L, s, 0.0f);
+  }
+}
+
+/*!
+\brief Size of the (square) grid at a given level.
+*/
+int SimpleGeometricMultigridBatch::LevelSize(int level) const
+{
+  int s = nx;
+  for (int i = 0; i < level; i++)
+    s = s / 2 + 1;
+  return s;
+}
+
+// Coefficients of the step of one lane from the constraints of a level (row-major)
+template<typename C>
+static void InterleaveLevel(const C& constraints, int s, int lane, float* a, float* c)
+{
+  for (int i = 0; i < s; i++) {
+    for (int j = 0; j < s; j++) {
+      int idx = i * s + j;
+      float al = constraints.Alpha(i, j, idx);
+      a[size_t(idx) * L + lane] = al;
+      c[size_t(idx) * L + lane] = (1.0f - al) * constraints.Altitude(i, j, idx) - al * constraints.Laplacian(i, j, idx);
+    }
+  }
+}
+
+/*!
+\brief Add a scene in the next lane: its hierarchy is restricted by SimpleGeometricMultigridFloat, then interleaved.
+\return false if the batch is full or if the scene does not have the size of the batch
+*/
+bool SimpleGeometricMultigridBatch::Add(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+  const ConstScalarField2DView& laplacian)
+{
+  if (scenes == L || alpha.SizeX() != nx || alpha.SizeY() != nx)
+    return false;
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  SimpleGeometricMultigridFloat hierarchy(alpha, altitude, laplacian);
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  Interleave(hierarchy);
+  return true;
+}
+
+/*!
+\brief Same as above, the fields are moved into the hierarchy instead of being copied.
+*/
+bool SimpleGeometricMultigridBatch::Add(ScalarField2D&& alpha, ScalarField2D&& altitude, ScalarField2D&& laplacian)
+{
+  if (scenes == L || alpha.SizeX() != nx || alpha.SizeY() != nx)
+    return false;
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  SimpleGeometricMultigridFloat hierarchy(std::move(alpha), std::move(altitude), std::move(laplacian));
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  Interleave(hierarchy);
+  return true;
+}
+
+/*!
+\brief Store the constraints of every level of a hierarchy in the next lane.
+*/
+void SimpleGeometricMultigridBatch::Interleave(const SimpleGeometricMultigridFloat& hierarchy)
+{
+  int lane = scenes++;
+  ParallelFor(0, mgsize, 1, [&](int begin, int end) {
+    for (int r = begin; r < end; r++) {
+      int s = LevelSize(r);
+      float* a = &coefficient[r][0];
+      float* c = &constant[r][0];
+      if (hierarchy.Packed(r))
+        InterleaveLevel(Stencil::Packed(hierarchy.constraints[r]), s, lane, a, c);
+      else {
+        Stencil::Fields fields = { hierarchy.alpha[0].View().Data(), hierarchy.altitude[0].View().Data(), hierarchy.laplacian[0].View().Data() };
+        InterleaveLevel(fields, s, lane, a, c);
+      }
+      // initial guess of level 0: alpha, as in SimpleGeometricMultigridFloat::InitialGuess
+      if (r == 0)
+        for (int k = 0; k < s * s; k++)
+          bufferA[0][k * L + lane] = a[size_t(k) * L + lane];
+    }
+  });
+}
+
+/*!
+\brief Number of scenes in the batch.
+*/
+int SimpleGeometricMultigridBatch::Scenes() const
+{
+  return scenes;
+}
+
+/*!
+\brief Solve all the scenes of the batch, same schedule as SimpleGeometricMultigridFloat::VCycleCPU.
+*/
+void SimpleGeometricMultigridBatch::SolveBatch()
+{
+  for (int level = mgsize - 1; level >= 0; level--) {
+    if (level < mgsize - 1)
+      Prolongate(level);
+    Smooth(level, 50 + (10 * (mgsize - level)));
+  }
+}
+
+/*!
+\brief Jacobi iterations of a level, all the lanes of a cell at once: interior cells without bounds check, border
+cells averaged over their existing neighbours (same order of the operations as Stencil::Interior and Stencil::Generic).
+*/
+void SimpleGeometricMultigridBatch::Smooth(int level, int nit)
+{
+  int s = LevelSize(level);
+  size_t w = size_t(s) * L; // one row
+  const float* ca = coefficient[level].View().Data();
+  const float* cc = constant[level].View().Data();
+  for (int step = 0; step < nit; step++) {
+    const float* a = bufferA[level].View().Data();
+    float* b = &bufferB[level][0];
+    auto border = [&](int i, int j) {
+      size_t idx = (size_t(i) * s + j) * L;
+      for (int k = 0; k < L; k++) {
+        float l = .0;
+        int cpt = 0;
+        if (i > 0) { l += a[idx - w + k]; cpt++; }
+        if (i < s - 1) { l += a[idx + w + k]; cpt++; }
+        if (j < s - 1) { l += a[idx + L + k]; cpt++; }
+        if (j > 0) { l += a[idx - L + k]; cpt++; }
+        b[idx + k] = ca[idx + k] * (l / float(cpt)) + cc[idx + k];
+      }
+    };
+    ParallelFor(0, s, max(1, 16384 / int(w)), [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        if (i == 0 || i == s - 1) {
+          for (int j = 0; j < s; j++)
+            border(i, j);
+          continue;
+        }
+        border(i, 0);
+        for (size_t idx = (size_t(i) * s + 1) * L; idx < (size_t(i) * s + s - 1) * L; idx += L) {
+          for (int k = 0; k < L; k++) {
+            float l = a[idx - w + k] + a[idx + w + k] + a[idx + L + k] + a[idx - L + k];
+            b[idx + k] = ca[idx + k] * (l / 4.0f) + cc[idx + k];
+          }
+        }
+        border(i, s - 1);
+      }
+    });
+    bufferA[level].Swap(bufferB[level]);
+  }
+}
+
+/*!
+\brief Bilinear prolongation of the solution of level+1 as the initial guess of level, all the lanes of a cell at once.
+*/
+void SimpleGeometricMultigridBatch::Prolongate(int level)
+{
+  int s = LevelSize(level);
+  int cs = s / 2 + 1;
+  const float* coarse = bufferA[level + 1].View().Data();
+  float* fine = &bufferA[level][0];
+  ParallelFor(0, s, max(1, 16384 / (s * L)), [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      for (int j = 0; j < s; j++) {
+        const float* c = coarse + (size_t(i / 2) * cs + j / 2) * L; // the neighbours are read only if they exist
+        size_t right = L, down = size_t(cs) * L;
+        float* f = fine + (size_t(i) * s + j) * L;
+        if (i % 2 == 0 && j % 2 == 0) {
+          for (int k = 0; k < L; k++)
+            f[k] = c[k];
+        }
+        else if (i % 2 == 0) {
+          for (int k = 0; k < L; k++)
+            f[k] = 0.5f * c[k] + 0.5f * c[right + k];
+        }
+        else if (j % 2 == 0) {
+          for (int k = 0; k < L; k++)
+            f[k] = 0.5f * c[k] + 0.5f * c[down + k];
+        }
+        else {
+          for (int k = 0; k < L; k++)
+            f[k] = 0.25f * c[k] + 0.25f * c[right + k] + 0.25f * c[down + k] + 0.25f * c[down + right + k];
+        }
+      }
+    }
+  });
+}
+
+/*!
+\brief Solution of the scene of a lane, row-major.
+*/
+ScalarField2D SimpleGeometricMultigridBatch::GetResult(int lane) const
+{
+  ScalarField2D result(nx, nx);
+  const float* v = bufferA[0].View().Data();
+  for (int k = 0; k < nx * nx; k++)
+    result[k] = v[size_t(k) * L + lane];
+  return result;
+}
+
+/*!
+\brief Memory used by the interleaved levels, in bytes.
+*/
+size_t SimpleGeometricMultigridBatch::HostMemory() const
+{
+  size_t bytes = 0;
+  for (int r = 0; r < mgsize; r++)
+    bytes += coefficient[r].Memory() + constant[r].Memory() + bufferA[r].Memory() + bufferB[r].Memory();
+  return bytes;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "basics.h"
+#include <vector>
+
+class SimpleGeometricMultigridFloat;
+
+// SimpleGeometricMultigridBatch. CPU solver of up to LANES scenes of the same size at once, for batches of small
+// scenes. The levels of all the scenes are interleaved (structure of arrays): each cell stores LANES consecutive
+// values, one per scene, and every step of the schedule of SimpleGeometricMultigridFloat (same levels, same number of
+// iterations, same prolongation) runs once for all the scenes, with the lane loop innermost so that it is vectorized.
+// The constraints of each scene are restricted by SimpleGeometricMultigridFloat, then stored per cell and lane as the
+// two coefficients of the step b = a * avg + c: a = alpha, c = (1 - alpha) * altitude - alpha * laplacian. All the
+// cells are smoothed, the fixed ones (a = 0) simply keep their value. With a binary alpha this is exactly the step of
+// the single scene solver, the results are bit-identical.
+class SimpleGeometricMultigridBatch {
+public:
+    static const int LANES = 8;   //!< Number of interleaved scenes, two SSE vectors
+    explicit SimpleGeometricMultigridBatch(int size);
+    bool Add(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude, const ConstScalarField2DView& laplacian);
+    bool Add(ScalarField2D&& alpha, ScalarField2D&& altitude, ScalarField2D&& laplacian);
+    void SolveBatch();
+    ScalarField2D GetResult(int lane) const;
+    int Scenes() const;
+    size_t HostMemory() const;
+protected:
+    void Interleave(const SimpleGeometricMultigridFloat& hierarchy);
+    void Smooth(int level, int nit);
+    void Prolongate(int level);
+    int LevelSize(int level) const;
+    int nx;                                 //!< Size of the scenes
+    int mgsize;                             //!< Number of levels
+    int scenes;                             //!< Number of lanes in use
+    std::vector<ScalarField2D> coefficient; //!< a, LANES values per cell, one row of s * LANES values per row of the level
+    std::vector<ScalarField2D> constant;    //!< c
+    std::vector<ScalarField2D> bufferA;     //!< Solution, initial guess then result of each level
+    std::vector<ScalarField2D> bufferB;     //!< Second buffer of the Jacobi iterations
+};
@@ -1,15 +1,64 @@
 #include "gpu-shader.h"
 #include "diffusionterrain.h"
+#include "gpu-bufferpool.h"
+#include "gpu-readback.h"
 #include <cstring>
 #include <cstdio>
+#include <map>
+#include "parallel.h"
+#include "stencil.h"
+#include "layout.h"
+#include "calibration.h"
+#include <chrono>
 
 using namespace std;
 
 /////////////////////////////// SimpleGeometricMultigrid - float version
 
+bool SimpleGeometricMultigridFloat::verbose = true;
 
-SimpleGeometricMultigridFloat::SimpleGeometricMultigridFloat(const ScalarField2D& alph, const ScalarField2D& alt, const ScalarField2D& lap)
-  : ScalarField2D(alt) {
+// Compiled programs are shared by all the solvers of the context, a batch only compiles them once
+static GLuint LoadProgram(const std::string& filename, const std::string& definitions)
+{
+  static std::map<std::string, GLuint> programs;
+  std::string key = filename + "\n" + definitions;
+  std::map<std::string, GLuint>::const_iterator it = programs.find(key);
+  if (it != programs.end())
+    return it->second;
+  GLuint program = read_program(filename.c_str(), definitions.c_str());
+  programs[key] = program;
+  return program;
+}
+
+/*!
+\brief Constructor, level 0 is a copy of the inputs.
+*/
+SimpleGeometricMultigridFloat::SimpleGeometricMultigridFloat(const ConstScalarField2DView& alph, const ConstScalarField2DView& alt, const ConstScalarField2DView& lap,
+  Layout::Order order)
+  : nx(alt.SizeX()), ny(alt.SizeY()), layout(order) {
+  alpha.push_back(ScalarField2D(alph));
+  altitude.push_back(ScalarField2D(alt));
+  laplacian.push_back(ScalarField2D(lap));
+  BuildHierarchy();
+}
+
+/*!
+\brief Constructor, level 0 takes the storage of the inputs, they are left empty.
+*/
+SimpleGeometricMultigridFloat::SimpleGeometricMultigridFloat(ScalarField2D&& alph, ScalarField2D&& alt, ScalarField2D&& lap,
+  Layout::Order order)
+  : nx(alt.SizeX()), ny(alt.SizeY()), layout(order) {
+  alpha.push_back(std::move(alph));
+  altitude.push_back(std::move(alt));
+  laplacian.push_back(std::move(lap));
+  BuildHierarchy();
+}
+
+/*!
+\brief Build the coarse levels of the constraints from level 0.
+The solution buffers are only created by InitGL (on the GPU) or InitCPU (on the CPU).
+*/
+void SimpleGeometricMultigridFloat::BuildHierarchy() {
   bufferElems = nx * ny;
   int s = nx;
 
@@ -17,335 +66,1167 @@ SimpleGeometricMultigridFloat::SimpleGeometricMultigridFloat(const ScalarField2D
   minsize = 9;
   nrec = 0;
   trec = .0;
+  backend = CPU;
+  storage = BUFFERS;
+  precision = SINGLE;
+  specializedStencil = true;
+  quantizeConstraints = false;
+  hybridSize = 0;
+  gpuLevels = 0;
+  nextLevel = -1;
+  for (int p = 0; p < 3; p++)
+    shaderStepAtoB[p] = shaderStepInterior[p] = shaderStepFixed[p] = 0;
+  shaderProlong = shaderRowMajor = 0;
+  glbufferAlpha = glbufferAltitude = glbufferA = glbufferB = glbufferLaplacian = nullptr;
+  glbufferConstraint = glbufferCells = nullptr;
   while (s > minsize) {
     mgsize++;
     s = s / 2 + 1;
   }
-  cout << "# of resolutions " << mgsize << endl;
-  altitude = new ScalarField2D[mgsize];
-  alpha = new ScalarField2D[mgsize];
-
-  bufferA = new ScalarField2D[mgsize];
-  bufferB = new ScalarField2D[mgsize];
-  laplacian = new ScalarField2D[mgsize];
-  s = nx / 2 + 1;
-  altitude[0] = ScalarField2D(alph);
-  alpha[0] = ScalarField2D(alph);
-
-  bufferA[0] = ScalarField2D(alph);
-  bufferB[0] = ScalarField2D(alph);
-  laplacian[0] = ScalarField2D(alph);
-
-  for (int i = 0; i < nx; i++) {
-    for (int j = 0; j < ny; j++) {
-      altitude[0][i * ny + j] = alt.Get(i, j);
-      alpha[0][i * ny + j] = alph.Get(i, j);
-      laplacian[0][i * ny + j] = lap.Get(i, j);
-    }
+  if (verbose)
+    cout << "# of resolutions " << mgsize << endl;
+  constraints.resize(mgsize);
+  PackLevel0();
+  if (!Packed(0) && layout != Layout::ROW_MAJOR) {
+    // the inputs are row-major, this is the only conversion of the constraints
+    alpha[0] = Layout::ToLayout(layout, alpha[0]);
+    altitude[0] = Layout::ToLayout(layout, altitude[0]);
+    laplacian[0] = Layout::ToLayout(layout, laplacian[0]);
   }
+  s = nx / 2 + 1;
 
-  int olds = nx;
   // geometric multigrid -> find the coarse system depending on the geometric fine system
+  // alpha is binary on the coarse levels, the restriction directly produces packed constraints
   for (int r = 1; r < mgsize; r++) {
-    altitude[r] = ScalarField2D(s,s);
-    alpha[r] = ScalarField2D(s,s); // laplacian coef
-
-    bufferA[r] = ScalarField2D(s,s);
-    bufferB[r] = ScalarField2D(s,s);
-    laplacian[r] = ScalarField2D(s,s);
-    for (int i = 0; i < s; i++)
-    {
-      for (int j = 0; j < s; j++)
-      {
-        int ii, jj;
-        int iimin = -1;
-        int jjmin = -1;
-        int iimax = 1;
-        int jjmax = 1;
-        if (i == 0)
-          iimin = 0;
-        else if (i == s - 1)
-          iimax = 0;
-        if (j == 0)
-          jjmin = 0;
-        else if (j == s - 1)
-          jjmax = 0;
-        bool fixed = false;
-        float maltitude = .0;
-        float nfixed = .0;
-        float sumlap = .0;
-        float nlap = .0;
-        float newalpha = 0.;
-        float sumcoef = .0;
-        for (ii = iimin; ii <= iimax; ii++)
-        {
-          for (jj = jjmin; jj <= jjmax; jj++)
-          {
-            int iii = 2 * i + ii;
-            int jjj = 2 * j + jj;
-            float coef = 1.0f / float((1 << abs(ii)) * (1 << abs(jj)));
-            newalpha += coef * alpha[r - 1][iii * olds + jjj];
-            sumcoef += coef;
-            if (alpha[r - 1][iii * olds + jjj] < 1.0f) // there is a fixed altitude constraint
-            {
-              fixed = true;
-
-              maltitude += coef * (1.0f - alpha[r - 1][iii * olds + jjj]) * altitude[r - 1][iii * olds + jjj];
-              nfixed += coef * (1.0f - alpha[r - 1][iii * olds + jjj]);
-            }
-
-            if (alpha[r - 1][iii * olds + jjj] > .0) // there is a laplacian constraint here
-            {
-              sumlap += coef * alpha[r - 1][iii * olds + jjj] * laplacian[r - 1][iii * olds + jjj]; // not an average, a geometric-weighted sum
-              nlap += coef * alpha[r - 1][iii * olds + jjj];
-            }
-          }
-        }
-
-        if (fixed) {
-          alpha[r][i * s + j] = 0.;
+    constraints[r] = PackedConstraints(s, Layout::Padded(layout, s));
+    Restrict(r);
+    s = s / 2 + 1;
+  }
 
-          altitude[r][i * s + j] = maltitude / nfixed; // geometric-weighted average if several cells were concerned
-        }
-        else { // only laplacian
+  // free and fixed cells of every level, for the smoother
+  cellLists.resize(mgsize);
+  s = nx;
+  for (int r = 0; r < mgsize; r++) {
+    Layout::Dispatch(layout, s, [&](auto l) {
+      if (Packed(r))
+        cellLists[r].Build(Stencil::Packed(constraints[r]), l, s);
+      else {
+        Stencil::Fields fields = { &alpha[0][0], &altitude[0][0], &laplacian[0][0] };
+        cellLists[r].Build(fields, l, s);
+      }
+    });
+    s = s / 2 + 1;
+  }
+}
 
-          alpha[r][i * s + j] = 1.0;
-          laplacian[r][i * s + j] = sumlap;// / nlap * 4.0;
+/*!
+\brief Pack the constraints of level 0 if alpha only contains 0 and 1, the three fields are released.
+*/
+void SimpleGeometricMultigridFloat::PackLevel0() {
+  const float* a = &alpha[0][0];
+  for (int k = 0; k < nx * ny; k++) {
+    if (a[k] != 0.0f && a[k] != 1.0f)
+      return;
+  }
+  PackedConstraints& c = constraints[0];
+  c = PackedConstraints(nx, Layout::Padded(layout, nx));
+  const float* alt = &altitude[0][0];
+  const float* lap = &laplacian[0][0];
+  float* v = &c.value[0];
+  // the inputs are row-major, the values are stored in the layout of the solver
+  Layout::Dispatch(layout, nx, [&](auto l) {
+    ParallelFor(0, nx, std::max(1, 16384 / nx), [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        for (int j = 0; j < nx; j++) {
+          int idx = i * nx + j;
+          if (a[idx] == 0.0f) {
+            c.SetFixed(i, j);
+            v[l.Index(i, j)] = alt[idx];
+          }
+          else
+            v[l.Index(i, j)] = lap[idx];
         }
       }
+    });
+  });
+  std::vector<ScalarField2D>().swap(alpha);
+  std::vector<ScalarField2D>().swap(altitude);
+  std::vector<ScalarField2D>().swap(laplacian);
+}
+
+/*!
+\brief Return true if the constraints of a level are packed.
+*/
+bool SimpleGeometricMultigridFloat::Packed(int level) const {
+  return constraints[level].words > 0;
+}
+
+/*!
+\brief Set the storage of the constraints of every level, compressing the packed levels if quantizeConstraints is set.
+*/
+void SimpleGeometricMultigridFloat::CompressConstraints() {
+  storedConstraints.assign(mgsize, FIELDS);
+  ranges16.assign(2 * mgsize, Range16());
+  int s = nx;
+  for (int r = 0; r < mgsize; r++) {
+    if (Packed(r)) {
+      if (quantizeConstraints && !constraints[r].Compressed())
+        Layout::Dispatch(layout, s, [&](auto l) { constraints[r].Compress(l, s); });
+      storedConstraints[r] = constraints[r].Compressed() ? PACKED16 : PACKED;
+      ranges16[2 * r] = constraints[r].altitude16;
+      ranges16[2 * r + 1] = constraints[r].laplacian16;
     }
     s = s / 2 + 1;
-    olds = olds / 2 + 1;
   }
 }
 
+/*!
+\brief Build level r from level r-1 : alpha, altitude and laplacian restriction with geometric weights.
+The fine level is read from the three fields or from its packed constraints, the coarse level is always packed.
+*/
+void SimpleGeometricMultigridFloat::Restrict(int r) {
+  int olds = LevelSize(r - 1);
+  int s = LevelSize(r);
+  Layout::Dispatch(layout, olds, [&](auto fl) {
+    decltype(fl) cl(s);
+    if (Packed(r - 1))
+      Stencil::Restrict(Stencil::Packed(constraints[r - 1]), fl, constraints[r], cl, s, 0, s);
+    else {
+      Stencil::Fields fine = { &alpha[0][0], &altitude[0][0], &laplacian[0][0] };
+      Stencil::Restrict(fine, fl, constraints[r], cl, s, 0, s);
+    }
+  });
+}
+
 SimpleGeometricMultigridFloat::~SimpleGeometricMultigridFloat()
 {
-  glDeleteBuffers(mgsize, glbufferAlpha);
-  glDeleteBuffers(mgsize, glbufferAltitude);
-  glDeleteBuffers(mgsize, glbufferA);
-  glDeleteBuffers(mgsize, glbufferB);
-  glDeleteBuffers(mgsize, glbufferLaplacian);
+  if (glbufferA == nullptr) // InitGL has not been called
+    return;
+  // buffers go back to the pool, so that the next solver of the same size reuses them
+  GPUBufferPool& pool = GPUBufferPool::Instance();
+  pool.Release(mgsize, glbufferAlpha);
+  pool.Release(mgsize, glbufferAltitude);
+  if (storage == IMAGES) { // textures are not pooled
+    glDeleteTextures(mgsize, glbufferA);
+    glDeleteTextures(mgsize, glbufferB);
+  }
+  else {
+    pool.Release(mgsize, glbufferA);
+    pool.Release(mgsize, glbufferB);
+  }
+  pool.Release(mgsize, glbufferLaplacian);
+  pool.Release(mgsize, glbufferConstraint);
+  pool.Release(mgsize, glbufferCells);
+  delete[] glbufferAlpha;
+  delete[] glbufferAltitude;
+  delete[] glbufferA;
+  delete[] glbufferB;
+  delete[] glbufferLaplacian;
+  delete[] glbufferConstraint;
+  delete[] glbufferCells;
 }
 
-void SimpleGeometricMultigridFloat::InitGL()
+// Barrier between the writes of a solution level and its next reads
+static GLbitfield SolutionBarrier(SimpleGeometricMultigridFloat::Storage storage)
 {
+  if (storage == SimpleGeometricMultigridFloat::IMAGES)
+    return GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+  return GL_SHADER_STORAGE_BARRIER_BIT;
+}
+
+// Solution level of size s in a GL_R32F texture
+static GLuint SolutionTexture(int s)
+{
+  GLuint texture;
+  glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+  glTextureStorage2D(texture, 1, GL_R32F, s, s);
+  // the prolongation samples the coarse level with the bilinear filter, the smoother uses texelFetch
+  glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+/*!
+\brief Select the GL backend and upload the hierarchy, requires a current OpenGL context.
+The levels smaller than hybridSize get CPU solution buffers instead and keep their CPU hierarchy, if there is no
+larger level this is InitCPU.
+\param storage storage of the solution levels, the textures (IMAGES) are only available with the row-major layout,
+the buffers are used otherwise
+*/
+void SimpleGeometricMultigridFloat::InitGL(Storage storage)
+{
+  gpuLevels = 0;
+  while (gpuLevels < mgsize && LevelSize(gpuLevels) >= hybridSize)
+    gpuLevels++;
+  if (gpuLevels == 0) {
+    if (verbose)
+      cout << "All the levels are smaller than " << hybridSize << ", solved on the CPU" << endl;
+    InitCPU();
+    return;
+  }
+  this->storage = layout == Layout::ROW_MAJOR ? storage : BUFFERS;
+
   // load shader
-  std::string definitions = "";
+  std::string definitions = Layout::Definitions(layout);
+  if (this->storage == IMAGES)
+    definitions += "#define IMAGE_STORAGE\n";
   definitions += "#define WORK_GROUP_SIZE_X " + std::to_string(WORK_GROUP_SIZE_X) + "\n";
   definitions += "#define WORK_GROUP_SIZE_Y " + std::to_string(WORK_GROUP_SIZE_Y) + "\n";
-  char * chaine = const_cast<char*>(definitions.c_str());
-  shaderStepAtoB = read_program("../shader/mgstepfloat.glsl", chaine);
-  std::cerr << "Compute shader loaded!" << std::endl;
-
-  // create buffers
+  CompressConstraints();
+  for (int p = FIELDS; p <= PACKED16; p++) {
+    std::string variant = Layout::Definitions(layout) + "#define WORK_GROUP_SIZE " + std::to_string(WORK_GROUP_SIZE_CELLS) + "\n";
+    if (this->storage == IMAGES)
+      variant += "#define IMAGE_STORAGE\n";
+    if (p != FIELDS)
+      variant += "#define PACKED_CONSTRAINTS\n";
+    if (p == PACKED16)
+      variant += "#define PACKED16\n";
+    shaderStepAtoB[p] = LoadProgram("../shader/mgstepfloat.glsl", variant);
+    shaderStepInterior[p] = LoadProgram("../shader/mgstepfloat.glsl", variant + "#define STENCIL_INTERIOR\n");
+    shaderStepFixed[p] = LoadProgram("../shader/mgstepfloat.glsl", variant + "#define STENCIL_FIXED\n");
+  }
+  shaderProlong = LoadProgram("../shader/mgprolongfloat.glsl", definitions);
+  shaderRowMajor = layout == Layout::ROW_MAJOR ? 0 : LoadProgram("../shader/mgrowmajorfloat.glsl", definitions);
+  if (verbose)
+    std::cerr << "Compute shader loaded!" << std::endl;
+  backend = GL;
+
+  // get buffers from the pool, they are only allocated by the driver the first time a given size is requested
+  // a level has either the three constraint buffers or the two packed ones, the others are 0
+  GPUBufferPool& pool = GPUBufferPool::Instance();
+  int allocations = pool.Allocations();
   int GPUsize = 0;
   glbufferAlpha = new GLuint[mgsize];
-  glGenBuffers(mgsize, glbufferAlpha);
+  glbufferAltitude = new GLuint[mgsize];
+  glbufferA = new GLuint[mgsize];
+  glbufferB = new GLuint[mgsize];
+  glbufferLaplacian = new GLuint[mgsize];
+  glbufferConstraint = new GLuint[mgsize];
+  glbufferCells = new GLuint[mgsize];
   int s = nx;
   for (int r = 0; r < mgsize; r++) {
-    int nelems = s * s;
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, glbufferAlpha[r]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, nelems * sizeof(float), (const void*)(&(alpha[r][0])), GL_STATIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    GPUsize += nelems * sizeof(float);
+    int padded = Layout::Padded(layout, s);
+    GLsizeiptr bytes = GLsizeiptr(padded) * padded * sizeof(float);
+    glbufferAlpha[r] = glbufferAltitude[r] = glbufferLaplacian[r] = glbufferConstraint[r] = 0;
+    glbufferA[r] = glbufferB[r] = glbufferCells[r] = 0;
+    if (r > gpuLevels) {
+      s = s / 2 + 1;
+      continue;
+    }
+    if (r == gpuLevels) {
+      // finest CPU level, only its solution, uploaded before the prolongation
+      if (this->storage == IMAGES)
+        glbufferA[r] = SolutionTexture(s);
+      else
+        glbufferA[r] = pool.Acquire(bytes);
+      GPUsize += int(bytes);
+      s = s / 2 + 1;
+      continue;
+    }
+    if (storedConstraints[r] == PACKED16) {
+      GLsizeiptr bytes16 = GLsizeiptr(constraints[r].value16.size() * sizeof(unsigned short));
+      glbufferConstraint[r] = pool.Acquire(bytes16, constraints[r].value16.data());
+      GPUsize += int(bytes16);
+    }
+    else if (storedConstraints[r] == PACKED) {
+      // the fixed bits are not needed, the cell list tells which cells are free
+      glbufferConstraint[r] = pool.Acquire(bytes, constraints[r].value.View().Data());
+      GPUsize += int(bytes);
+    }
+    else {
+      glbufferAlpha[r] = pool.Acquire(bytes, &(alpha[r][0]));
+      glbufferAltitude[r] = pool.Acquire(bytes, &(altitude[r][0]));
+      glbufferLaplacian[r] = pool.Acquire(bytes, &(laplacian[r][0]));
+      GPUsize += 3 * int(bytes);
+    }
+    // initial guess: alpha on level 0, zero on the other levels (only the coarsest one is read before being written)
+    if (this->storage == IMAGES) {
+      glbufferA[r] = SolutionTexture(s);
+      glbufferB[r] = SolutionTexture(s);
+      if (r == 0)
+        glTextureSubImage2D(glbufferA[r], 0, 0, 0, s, s, GL_RED, GL_FLOAT, &(InitialGuess()[0]));
+      else
+        glClearTexImage(glbufferA[r], 0, GL_RED, GL_FLOAT, nullptr);
+    }
+    else {
+      if (r == 0)
+        glbufferA[r] = pool.Acquire(bytes, &(InitialGuess()[0]));
+      else {
+        glbufferA[r] = pool.Acquire(bytes);
+        glClearNamedBufferData(glbufferA[r], GL_R32F, GL_RED, GL_FLOAT, nullptr);
+      }
+      glbufferB[r] = pool.Acquire(bytes); // free cells are written by the first smoothing step, fixed cells below
+    }
+    glbufferCells[r] = pool.Acquire(GLsizeiptr(cellLists[r].Memory()), cellLists[r].cells.data());
+    GPUsize += 2 * int(bytes) + int(cellLists[r].Memory());
+    WriteFixedGL(r, glbufferB[r]);
     s = s / 2 + 1;
   }
-
-  glbufferAltitude = new GLuint[mgsize];
-  glGenBuffers(mgsize, glbufferAltitude);
-  s = nx;
-  for (int r = 0; r < mgsize; r++) {
-    int nelems = s * s;
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, glbufferAltitude[r]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, nelems * sizeof(float), (const void*)(&(altitude[r][0])), GL_STATIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    GPUsize += nelems * sizeof(float);
-    s = s / 2 + 1;
+  if (verbose)
+    cout << "GPU buffers size en bytes " << GPUsize << " (" << pool.Allocations() - allocations << " new allocations"
+      << (this->storage == IMAGES ? ", solution in textures" : "") << ")" << endl;
+
+  // the GPU has its own copy, the CPU pyramids are only kept for the levels solved on the CPU
+  std::vector<ScalarField2D>().swap(alpha);
+  std::vector<ScalarField2D>().swap(altitude);
+  std::vector<ScalarField2D>().swap(laplacian);
+  for (int r = 0; r < gpuLevels; r++) {
+    constraints[r] = PackedConstraints();
+    std::vector<unsigned int>().swap(cellLists[r].cells); // the counts are kept
   }
+  if (gpuLevels < mgsize) {
+    bufferA.resize(mgsize);
+    bufferB.resize(mgsize);
+    for (int r = gpuLevels; r < mgsize; r++) {
+      int padded = Layout::Padded(layout, LevelSize(r));
+      bufferA[r] = ScalarField2D(padded, padded);
+      bufferB[r] = ScalarField2D(padded, padded);
+      WriteFixedCPU(r, bufferB[r], cellLists[r]);
+    }
+    if (verbose)
+      cout << "Levels " << gpuLevels << " to " << mgsize - 1 << " solved on the CPU (smaller than " << hybridSize << ")" << endl;
+  }
+}
 
+/*!
+\brief Initial guess of level 0: alpha, rebuilt from the fixed bits if level 0 is packed.
+*/
+ScalarField2D SimpleGeometricMultigridFloat::InitialGuess() const
+{
+  if (!Packed(0))
+    return alpha[0];
+  int padded = Layout::Padded(layout, nx);
+  ScalarField2D guess(padded, padded);
+  Layout::Dispatch(layout, nx, [&](auto l) {
+    for (int i = 0; i < nx; i++)
+      for (int j = 0; j < ny; j++)
+        guess[l.Index(i, j)] = constraints[0].Fixed(i, j) ? 0.0f : 1.0f;
+  });
+  return guess;
+}
 
-
-  glbufferA = new GLuint[mgsize];
-  glGenBuffers(mgsize, glbufferA);
-  s = nx;
-  for (int r = 0; r < mgsize; r++) {
-    int nelems = s * s;
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, glbufferA[r]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, nelems * sizeof(float), (const void*)(&(bufferA[r][0])), GL_STATIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    GPUsize += nelems * sizeof(float);
-    s = s / 2 + 1;
+/*!
+\brief Select the CPU backend: the hierarchy built by the constructor is used in place, only the solution buffers
+are created. Cannot be called after InitGL, which releases the CPU hierarchy.
+\param precision type of the solution buffers, the constraints stay in float
+*/
+void SimpleGeometricMultigridFloat::InitCPU(Precision precision)
+{
+  backend = CPU;
+  this->precision = precision;
+  CompressConstraints();
+  if (precision == DOUBLE) {
+    bufferA64.resize(mgsize);
+    bufferB64.resize(mgsize);
   }
-
-  glbufferB = new GLuint[mgsize];
-  glGenBuffers(mgsize, glbufferB);
-  s = nx;
-  for (int r = 0; r < mgsize; r++) {
-    int nelems = s * s;
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, glbufferB[r]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, nelems * sizeof(float), (const void*)(&(bufferB[r][0])), GL_STATIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    GPUsize += nelems * sizeof(float);
-    s = s / 2 + 1;
+  else {
+    bufferA.resize(mgsize);
+    bufferB.resize(mgsize);
   }
-
-  glbufferLaplacian = new GLuint[mgsize];
-  glGenBuffers(mgsize, glbufferLaplacian);
-  s = nx;
+  int s = nx;
   for (int r = 0; r < mgsize; r++) {
-    int nelems = s * s;
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, glbufferLaplacian[r]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, nelems * sizeof(float), (const void*)(&(laplacian[r][0])), GL_STATIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    GPUsize += nelems * sizeof(float);
+    // initial guess: alpha on level 0, zero on the other levels
+    int padded = Layout::Padded(layout, s);
+    if (precision == DOUBLE) {
+      bufferA64[r] = r == 0 ? ScalarField2DD(InitialGuess()) : ScalarField2DD(padded, padded);
+      bufferB64[r] = ScalarField2DD(padded, padded);
+      WriteFixedCPU(r, bufferB64[r], cellLists[r]); // never written by the smoother
+    }
+    else {
+      bufferA[r] = r == 0 ? InitialGuess() : ScalarField2D(padded, padded);
+      bufferB[r] = ScalarField2D(padded, padded);
+      WriteFixedCPU(r, bufferB[r], cellLists[r]);
+    }
     s = s / 2 + 1;
   }
-  cout << "GPU buffers size en bytes " << GPUsize << endl;
+  if (verbose)
+    cout << "CPU buffers size en bytes " << HostMemory() << endl;
+}
 
+/*!
+\brief Memory used by the CPU copies of the hierarchy and of the solution, in bytes.
+*/
+size_t SimpleGeometricMultigridFloat::HostMemory() const
+{
+  size_t bytes = 0;
+  for (unsigned int r = 0; r < alpha.size(); r++)
+    bytes += alpha[r].Memory() + altitude[r].Memory() + laplacian[r].Memory();
+  for (unsigned int r = 0; r < constraints.size(); r++)
+    bytes += constraints[r].Memory();
+  for (unsigned int r = 0; r < cellLists.size(); r++)
+    bytes += cellLists[r].Memory();
+  for (unsigned int r = 0; r < bufferA.size(); r++)
+    bytes += bufferA[r].Memory() + bufferB[r].Memory();
+  for (unsigned int r = 0; r < bufferA64.size(); r++)
+    bytes += bufferA64[r].Memory() + bufferB64[r].Memory();
+  return bytes;
 }
 
 void SimpleGeometricMultigridFloat::Solve() {
+  nextLevel = -1; // a complete solve, a progressive one in progress is abandoned
+  if (backend == CPU) {
+    if (bufferA.empty() && bufferA64.empty())
+      InitCPU();
+    VCycleCPU(0);
+    nrec++;
+    return;
+  }
+  GPUReadbackQueue::Instance().Poll(); // complete the readbacks of the previous solves, if they are ready
   VCycle(0);
   nrec++;
 }
 
+/*!
+\brief Anytime solve: the levels are solved coarse to fine, as in Solve, until the deadline. Before each level its
+time is predicted from the times of the levels already solved by this call (a sweep costs overhead + perCell * cells,
+fitted on the last two levels), the solve stops when the level would end after the deadline. At least one level is
+solved by each call. The solve resumes at the next level with the next call, the coarse levels are not solved again;
+a call after a complete solve starts a new one.
+\param deadline time at which the solve should stop
+\param previewSize size of the previews, 0 for the size of the level
+\param preview called after each level with the level and its solution (see Preview), not called if empty
+\return true when level 0 is solved
+*/
+bool SimpleGeometricMultigridFloat::SolveProgressive(std::chrono::steady_clock::time_point deadline, int previewSize,
+  const std::function<void(int level, const ScalarField2D& preview)>& preview) {
+  typedef std::chrono::steady_clock Clock;
+  if (backend == CPU && bufferA.empty() && bufferA64.empty())
+    InitCPU();
+  if (backend == GL)
+    GPUReadbackQueue::Instance().Poll();
+  if (nextLevel < 0)
+    nextLevel = mgsize - 1;
+
+  std::vector<double> cells, sweep; // seconds per sweep of the levels solved by this call
+  while (nextLevel >= 0) {
+    int level = nextLevel;
+    double s = LevelSize(level);
+    int nit = 50 + (10 * (mgsize - level));
+    if (!sweep.empty()) {
+      double perCell = sweep.back() / cells.back(), overhead = 0.0;
+      if (sweep.size() > 1) {
+        double c0 = cells[cells.size() - 2], t0 = sweep[sweep.size() - 2];
+        perCell = std::max(0.0, (sweep.back() - t0) / (cells.back() - c0));
+        overhead = std::max(0.0, sweep.back() - perCell * cells.back());
+      }
+      double predicted = nit * (overhead + perCell * s * s);
+      if (Clock::now() + std::chrono::duration<double>(predicted) > deadline)
+        break;
+    }
+    Clock::time_point start = Clock::now();
+    SolveLevel(level);
+    if (backend == GL)
+      glFinish(); // the time of the level, not of its submission
+    cells.push_back(s * s);
+    sweep.push_back(std::chrono::duration<double>(Clock::now() - start).count() / nit);
+    nextLevel--;
+    if (preview)
+      preview(level, Preview(level, previewSize));
+  }
+  if (nextLevel >= 0)
+    return false;
+  nrec++;
+  return true;
+}
 
-void SimpleGeometricMultigridFloat::VCycle(int level) {
+/*!
+\brief Finest level solved by the progressive solve in progress, or by the last solve.
+\return mgsize if no level is solved
+*/
+int SimpleGeometricMultigridFloat::SolvedLevel() const {
+  return nextLevel < 0 ? (nrec > 0 ? 0 : mgsize) : nextLevel + 1;
+}
+
+/*!
+\brief Solve of the rectangle [i0, i0 + rows) x [j0, j0 + columns) of level 0 only, CPU backend: the time depends on
+the size of the rectangle rather than on the size of the scene. Each level has a window, the rectangle plus the margin
+on level 0, then the cells of the prolongation of the finer window plus the margin on the next ones. The levels whose
+window covers more than half of the level are solved entirely, with the coarser ones, the finer levels only on their
+window (see SolveWindowCPU).
+The buffers of level 0 are only valid in the window afterwards, GetResult needs a new Solve.
+\param margin cells around the window of each level, where the error of the Dirichlet boundary decays: a sweep moves
+information by one cell, on a 2049x2049 scene the difference with Solve is 3e-5 with 32 cells and 0 with 64
+\return the solution in the rectangle, rows x columns, empty on the GL backend or if the rectangle is outside the scene
+*/
+ScalarField2D SimpleGeometricMultigridFloat::SolveRegion(int i0, int j0, int rows, int columns, int margin) {
+  if (backend != CPU) {
+    cerr << "[error] SolveRegion requires the CPU backend" << endl;
+    return ScalarField2D();
+  }
+  int i1 = std::min(nx, i0 + rows), j1 = std::min(nx, j0 + columns);
+  i0 = std::max(0, i0);
+  j0 = std::max(0, j0);
+  if (i1 <= i0 || j1 <= j0)
+    return ScalarField2D();
+  if (bufferA.empty() && bufferA64.empty())
+    InitCPU();
+  nextLevel = -1; // a progressive solve in progress is abandoned
+
+  // windows of the levels, [i0, i1) x [j0, j1): the fine cell i is prolongated from the coarse cells i / 2 and i / 2 + 1
+  std::vector<int> windows = { std::max(0, i0 - margin), std::max(0, j0 - margin), std::min(nx, i1 + margin), std::min(nx, j1 + margin) };
+  int coarse = 0; // finest level solved entirely
+  for (; coarse < mgsize - 1; coarse++) {
+    const int* w = &windows[4 * coarse];
+    double s = LevelSize(coarse);
+    if (2.0 * double(w[2] - w[0]) * double(w[3] - w[1]) > s * s)
+      break;
+    int cs = LevelSize(coarse + 1);
+    windows.insert(windows.end(), { std::max(0, w[0] / 2 - margin), std::max(0, w[1] / 2 - margin),
+      std::min(cs, (w[2] - 1) / 2 + 2 + margin), std::min(cs, (w[3] - 1) / 2 + 2 + margin) });
+  }
+  for (int level = mgsize - 1; level >= coarse; level--)
+    SolveLevel(level);
+  for (int level = coarse - 1; level >= 0; level--) {
+    const int* w = &windows[4 * level];
+    if (precision == DOUBLE)
+      SolveWindowCPU(level, bufferA64, bufferB64, w[0], w[1], w[2], w[3]);
+    else
+      SolveWindowCPU(level, bufferA, bufferB, w[0], w[1], w[2], w[3]);
+  }
+
+  ScalarField2D region(j1 - j0, i1 - i0);
+  Layout::Dispatch(layout, nx, [&](auto l) {
+    for (int i = i0; i < i1; i++) {
+      for (int j = j0; j < j1; j++) {
+        if (precision == DOUBLE)
+          region.Set(i - i0, j - j0, float(bufferA64[0].Get(l.Index(i, j))));
+        else
+          region.Set(i - i0, j - j0, bufferA[0].Get(l.Index(i, j)));
+      }
+    }
+  });
+  return region;
+}
+
+// Bilinear resampling of a square field to size x size, the corners are kept
+static ScalarField2D ResampleSquare(const ScalarField2D& field, int size)
+{
+  int s = field.SizeX();
+  if (size == s)
+    return field;
+  ScalarField2D resampled(size, size);
+  double scale = size > 1 ? double(s - 1) / (size - 1) : 0.0;
+  ParallelFor(0, size, std::max(1, 65536 / size), [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      double y = i * scale;
+      int i0 = std::min(int(y), std::max(0, s - 2)), i1 = std::min(i0 + 1, s - 1);
+      float v = float(y - i0);
+      for (int j = 0; j < size; j++) {
+        double x = j * scale;
+        int j0 = std::min(int(x), std::max(0, s - 2)), j1 = std::min(j0 + 1, s - 1);
+        float u = float(x - j0);
+        float top = (1.0f - u) * field.Get(i0, j0) + u * field.Get(i0, j1);
+        float bottom = (1.0f - u) * field.Get(i1, j0) + u * field.Get(i1, j1);
+        resampled.Set(i, j, (1.0f - v) * top + v * bottom);
+      }
+    }
+  });
+  return resampled;
+}
+
+/*!
+\brief Solution of a level, row-major, resampled (bilinear) to size x size. Synchronous: the GPU is stalled until the
+level is read back. The level must be solved (see SolvedLevel), the level of a complete solve is 0.
+\param size size of the preview, 0 for the size of the level
+*/
+ScalarField2D SimpleGeometricMultigridFloat::Preview(int level, int size) {
+  int s = LevelSize(level);
+  ScalarField2D solution;
+  if (backend == CPU || level >= gpuLevels) {
+    // the hybrid levels are on the CPU, the GPU buffer of the finest of them is only written by the next level
+    if (precision == DOUBLE)
+      solution = ScalarField2D(Layout::FromLayout(layout, bufferA64[level], s));
+    else
+      solution = layout == Layout::ROW_MAJOR ? bufferA[level] : Layout::FromLayout(layout, bufferA[level], s);
+  }
+  else if (storage == IMAGES) {
+    solution = ScalarField2D(s, s);
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glGetTextureImage(glbufferA[level], 0, GL_RED, GL_FLOAT, GLsizei(GLsizeiptr(s) * s * sizeof(float)), &solution[0]);
+  }
+  else {
+    int padded = Layout::Padded(layout, s);
+    ScalarField2D stored(padded, padded);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glGetNamedBufferSubData(glbufferA[level], 0, GLsizeiptr(padded) * padded * sizeof(float), &stored[0]);
+    solution = layout == Layout::ROW_MAJOR ? std::move(stored) : Layout::FromLayout(layout, stored, s);
+  }
+  return ResampleSquare(solution, size > 0 ? size : s);
+}
+
+/*!
+\brief Size of the (square) grid at a given level.
+*/
+int SimpleGeometricMultigridFloat::LevelSize(int level) const {
   int s = nx;
   for (int i = 0; i < level; i++) {
     s = s / 2 + 1;
   }
-  int nelem = s * s;
+  return s;
+}
+
+
+void SimpleGeometricMultigridFloat::VCycle(int level) {
+  // solve the next level - reccursive call, then this one starting from the prolongation of its result
+  if (level < mgsize - 1)
+    VCycle(level + 1);
+  SolveLevel(level);
+}
+
+/*!
+\brief One level of the coarse-to-fine schedule: prolongation of the solution of level+1, which must be solved, as
+the initial guess (except on the coarsest level), then Jacobi iterations. On the CPU for the CPU backend and for the
+levels of the hybrid schedule.
+*/
+void SimpleGeometricMultigridFloat::SolveLevel(int level) {
+  if (backend == CPU || level >= gpuLevels) {
+    if (precision == DOUBLE)
+      SolveLevelCPU(level, bufferA64, bufferB64);
+    else
+      SolveLevelCPU(level, bufferA, bufferB);
+    return;
+  }
+  int s = LevelSize(level);
 
   int nit = 50 + (10 * (mgsize - level));
-  cout << "level " << level << " " << nit << " iterations" << endl;
+  if (verbose)
+    cout << "level " << level << " " << nit << " iterations" << endl;
 
   if (level == mgsize - 1) {
+    // smooth (Jacobi iterations should not need too much of these)
+    SmoothGL(level, nit);
+    // the iteration result is in bufferA (swap has just been performed before stopping the loop)
+    return;
+  }
+
+
+  // we do not need to compute the residual here, because it's not yet a complete multi-grid method, i.e. we do not perform the next
+  // iteration on the residual/error but on the restriction (bilinear) of the result
+
+  // restriction operator -> bilinear interpolation using geometric weights
 
-    // First : smooth (Jacobi iterations should not need too much of these)
-    for (int step = 0; step < nit; step++) {
+  // the next level has been solved, on the CPU with the hybrid schedule
+  if (level + 1 == gpuLevels)
+    UploadSolution(level + 1);
 
-      glUseProgram(shaderStepAtoB);
+  // prolongation operator : computes the fine (level) interpolation wrt the coarse level result (level+1)
+  // performed on the GPU, the coarse result never goes back to the CPU
+  glUseProgram(shaderProlong);
+  glProgramUniform1i(shaderProlong, glGetUniformLocation(shaderProlong, "GridSizeX"), s);
+  glProgramUniform1i(shaderProlong, glGetUniformLocation(shaderProlong, "GridSizeY"), s);
+  if (storage == IMAGES)
+    BindSolution(glbufferA[level + 1], glbufferA[level]); // the coarse level is sampled with the bilinear filter
+  else {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, glbufferA[level]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, glbufferA[level + 1]);
+  }
+  glDispatchCompute((s / WORK_GROUP_SIZE_X) + 1, (s / WORK_GROUP_SIZE_Y) + 1, 1);
+  glMemoryBarrier(SolutionBarrier(storage));
+  if (storage == IMAGES)
+    BindSolution(0, 0);
+  else {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+  }
+  glUseProgram(0);
 
-      glProgramUniform1i(shaderStepAtoB, glGetUniformLocation(shaderStepAtoB, "GridSizeX"), s); // attention X,Y
-      glProgramUniform1i(shaderStepAtoB, glGetUniformLocation(shaderStepAtoB, "GridSizeY"), s);
+  // last step : iterate to refine the result on the current level
+  SmoothGL(level, nit);
+  // the iteration result is in bufferA (swap has just been performed before stopping the loop)
+}
 
+/*!
+\brief Jacobi iterations on the GPU, from bufferA to bufferB then swap.
+Only the free cells are smoothed. On large levels the interior cells use the program without bounds checks and the
+border cells the generic one, small levels run the generic program on all the free cells: there the cost of a
+dispatch is higher than the bounds checks.
+The first sweep reads the prolongation, fixed cells included, then the fixed values are written back in the
+prolongation buffer: afterwards both buffers hold them and the sweeps never write them again.
+*/
+void SimpleGeometricMultigridFloat::SmoothGL(int level, int nit) {
+  const Stencil::CellList& list = cellLists[level];
+  int split = specializedStencil && LevelSize(level) >= STENCIL_SPLIT_SIZE ? list.interior : 0;
+  int p = storedConstraints[level];
+  for (int step = 0; step < nit; step++) {
+    if (p != FIELDS)
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, glbufferConstraint[level]);
+    else {
       glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, glbufferAlpha[level]);
       glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, glbufferAltitude[level]);
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, glbufferA[level]);
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, glbufferB[level]);
       glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, glbufferLaplacian[level]);
+    }
+    BindSolution(glbufferA[level], glbufferB[level]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, glbufferCells[level]);
 
+    // both dispatches write disjoint cells of bufferB, no barrier between them
+    DispatchCells(shaderStepInterior[p], level, 0, split);
+    DispatchCells(shaderStepAtoB[p], level, split, list.free - split);
+    glMemoryBarrier(SolutionBarrier(storage));
 
-      glDispatchCompute((s / WORK_GROUP_SIZE_X) + 1, (s / WORK_GROUP_SIZE_Y) + 1, 1); // attention X,Y
-      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    BindSolution(0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
 
-      glUseProgram(0);
-      std::swap(glbufferA[level], glbufferB[level]);
-    }
-    // get the iteration result in bufferA (swap has just been performed before stopping the loop)
+    glUseProgram(0);
+    std::swap(glbufferA[level], glbufferB[level]);
+    if (step == 0)
+      WriteFixedGL(level, glbufferB[level]);
+  }
+}
 
-    glGetNamedBufferSubData(glbufferA[level], 0, sizeof(float) * nelem, &(bufferA[level][0]));
+/*!
+\brief Upload the solution of a level solved on the CPU (bufferA) to its GPU buffer, or texture with the IMAGES storage.
+*/
+void SimpleGeometricMultigridFloat::UploadSolution(int level) {
+  int s = LevelSize(level);
+  if (storage == IMAGES)
+    glTextureSubImage2D(glbufferA[level], 0, 0, 0, s, s, GL_RED, GL_FLOAT, bufferA[level].View().Data());
+  else
+    glNamedBufferSubData(glbufferA[level], 0, GLsizeiptr(bufferA[level].SizeX()) * bufferA[level].SizeY() * sizeof(float),
+      bufferA[level].View().Data());
+}
 
+/*!
+\brief Bind the solution level read by the step program (bufferA) and the one it writes (bufferB), 0 to unbind.
+Buffers go to the bindings 3 and 4, textures to the texture unit 0 and the image unit 1.
+*/
+void SimpleGeometricMultigridFloat::BindSolution(GLuint read, GLuint write) {
+  if (storage == IMAGES) {
+    glBindTextureUnit(0, read);
+    glBindImageTexture(1, write, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  }
+  else {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, read);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, write);
+  }
+}
 
+/*!
+\brief Run a step program on the range [first, first + count) of the cell list of a level, buffers already bound.
+*/
+void SimpleGeometricMultigridFloat::DispatchCells(GLuint program, int level, int first, int count) {
+  if (count <= 0)
     return;
+  int s = LevelSize(level);
+  glUseProgram(program);
+  glProgramUniform1i(program, glGetUniformLocation(program, "GridSizeX"), s); // attention X,Y
+  glProgramUniform1i(program, glGetUniformLocation(program, "GridSizeY"), s);
+  if (storedConstraints[level] == PACKED16) {
+    glProgramUniform2f(program, glGetUniformLocation(program, "AltitudeRange"), ranges16[2 * level].offset, ranges16[2 * level].step);
+    glProgramUniform2f(program, glGetUniformLocation(program, "LaplacianRange"), ranges16[2 * level + 1].offset, ranges16[2 * level + 1].step);
   }
+  // the number of work groups of a dispatch is limited (65535 on some implementations, 16.7M cells): large ranges
+  // in several dispatches, they write disjoint cells and need no barrier between them
+  long long chunk = (long long)(max_work_group_count()) * WORK_GROUP_SIZE_CELLS;
+  for (int done = 0; done < count;) {
+    int n = int(std::min<long long>(chunk, count - done));
+    glProgramUniform1i(program, glGetUniformLocation(program, "CellFirst"), first + done);
+    glProgramUniform1i(program, glGetUniformLocation(program, "CellCount"), n);
+    glDispatchCompute((n + WORK_GROUP_SIZE_CELLS - 1) / WORK_GROUP_SIZE_CELLS, 1, 1);
+    done += n;
+  }
+}
 
+/*!
+\brief Write the values of the fixed cells of a level in a solution buffer, or texture with the IMAGES storage.
+*/
+void SimpleGeometricMultigridFloat::WriteFixedGL(int level, GLuint target) {
+  const Stencil::CellList& list = cellLists[level];
+  int p = storedConstraints[level];
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, glbufferAlpha[level]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, p != FIELDS ? glbufferConstraint[level] : glbufferAltitude[level]);
+  BindSolution(0, target);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, glbufferLaplacian[level]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, glbufferCells[level]);
+  DispatchCells(shaderStepFixed[p], level, list.free, list.total - list.free);
+  glMemoryBarrier(SolutionBarrier(storage));
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+  BindSolution(0, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
+  glUseProgram(0);
+}
 
-  // we do not need to compute the residual here, because it's not yet a complete multi-grid method, i.e. we do not perform the next
-  // iteration on the residual/error but on the restriction (bilinear) of the result
+/*!
+\brief CPU version of VCycle, same schedule and same operations as the compute shaders, in the precision selected by InitCPU.
+*/
+void SimpleGeometricMultigridFloat::VCycleCPU(int level) {
+  if (level < mgsize - 1)
+    VCycleCPU(level + 1);
+  if (precision == DOUBLE)
+    SolveLevelCPU(level, bufferA64, bufferB64);
+  else
+    SolveLevelCPU(level, bufferA, bufferB);
+}
 
-  // restriction operator -> bilinear interpolation using geometric weights
+template<typename T>
+void SimpleGeometricMultigridFloat::SolveLevelCPU(int level, std::vector<ScalarField2DT<T> >& a, std::vector<ScalarField2DT<T> >& b) {
+  int nit = 50 + (10 * (mgsize - level));
+  if (verbose)
+    cout << "level " << level << " " << nit << " iterations" << endl;
 
-  // solve the next level - reccursive call //////////////////////////////////////////////////////////
-  VCycle(level + 1);
+  // the next level has been solved, its prolongation is the initial guess
+  if (level < mgsize - 1)
+    ProlongateCPU(level, a, 0, 0, LevelSize(level), LevelSize(level));
 
-  // prolongation operator : computes the fine (level) interpolation wrt the coarse level result (level+1)
-  for (int i = 0; i < s; i++) {
-    for (int j = 0; j < s; j++) {
-      float val = .0;
-      if (i % 2 == 0 && j % 2 == 0) { // both even row and column
-        val = bufferA[level + 1][(i / 2) * (s / 2 + 1) + j / 2];
-      }
-      else if (i % 2 == 0 && j % 2 == 1) { // even column and odd row
-        val = 0.5f * bufferA[level + 1][(i / 2) * (s / 2 + 1) + j / 2] + 0.5f * bufferA[level + 1][(i / 2) * (s / 2 + 1) + j / 2 + 1];
-      }
-      else if (i % 2 == 1 && j % 2 == 0) { // even row and odd column
-        val = 0.5f * bufferA[level + 1][(i / 2) * (s / 2 + 1) + j / 2] + 0.5f * bufferA[level + 1][(i / 2 + 1) * (s / 2 + 1) + j / 2];
-      }
-      else { // odd column and row
-        val = 0.25f * bufferA[level + 1][(i / 2) * (s / 2 + 1) + j / 2] + 0.25f * bufferA[level + 1][(i / 2) * (s / 2 + 1) + j / 2 + 1]
-          + 0.25f * bufferA[level + 1][(i / 2 + 1) * (s / 2 + 1) + j / 2] + 0.25f * bufferA[level + 1][(i / 2 + 1) * (s / 2 + 1) + j / 2 + 1];
-      }
-      bufferA[level][i * s + j] = val;
-    }
+  // smooth (Jacobi iterations), the first sweep reads the prolongated values of the fixed cells, then they are
+  // restored in the prolongation buffer (see SmoothGL)
+  for (int step = 0; step < nit; step++) {
+    StepCPU(level, a[level].View().Data(), &b[level][0], cellLists[level]);
+    a[level].Swap(b[level]);
+    if (step == 0)
+      WriteFixedCPU(level, b[level], cellLists[level]);
   }
+}
 
-  // last step : iterate to refine the result on the current level
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, glbufferA[level]);
-  glBufferData(GL_SHADER_STORAGE_BUFFER, nelem * sizeof(float), (const void*)(&(bufferA[level][0])), GL_DYNAMIC_DRAW);
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-  // First : smooth (Jacobi iterations should not need too much of these)
-  for (int step = 0; step < nit; step++) {
+/*!
+\brief Cell list of the window [i0, i1) x [j0, j1) of a level, see Stencil::CellList::BuildWindow.
+*/
+Stencil::CellList SimpleGeometricMultigridFloat::WindowCells(int level, int i0, int j0, int i1, int j1) const {
+  int s = LevelSize(level);
+  Stencil::CellList list;
+  Layout::Dispatch(layout, s, [&](auto l) {
+    if (storedConstraints[level] == PACKED16)
+      list.BuildWindow(Stencil::Packed16(constraints[level]), l, s, i0, j0, i1, j1);
+    else if (Packed(level))
+      list.BuildWindow(Stencil::Packed(constraints[level]), l, s, i0, j0, i1, j1);
+    else {
+      Stencil::Fields fields = { alpha[level].View().Data(), altitude[level].View().Data(), laplacian[level].View().Data() };
+      list.BuildWindow(fields, l, s, i0, j0, i1, j1);
+    }
+  });
+  return list;
+}
 
+/*!
+\brief Same as SolveLevelCPU on the window [i0, i1) x [j0, j1) of the level only, the window of level+1 must cover its
+prolongation. The free cells of the border of the window inside the level keep the prolongation of the coarser
+level, a Dirichlet boundary: the cells outside the window are never read.
+*/
+template<typename T>
+void SimpleGeometricMultigridFloat::SolveWindowCPU(int level, std::vector<ScalarField2DT<T> >& a, std::vector<ScalarField2DT<T> >& b,
+  int i0, int j0, int i1, int j1) {
+  int s = LevelSize(level);
+  int nit = 50 + (10 * (mgsize - level));
+  if (verbose)
+    cout << "level " << level << " " << nit << " iterations, window " << i1 - i0 << "x" << j1 - j0 << endl;
+
+  Stencil::CellList list = WindowCells(level, i0, j0, i1, j1);
+  Layout::Dispatch(layout, s, [&](auto l) {
+    // prolongation, copied to the other buffer for the boundary, whose fixed cells are then restored as in
+    // InitCPU: the sweeps go on exactly as on the whole level
+    ProlongateCPU(level, a, i0, j0, i1, j1);
+    const T* from = a[level].View().Data();
+    T* to = &b[level][0];
+    for (int i = i0; i < i1; i++)
+      for (int j = j0; j < j1; j++)
+        to[l.Index(i, j)] = from[l.Index(i, j)];
+  });
+  WriteFixedCPU(level, b[level], list);
 
-    glUseProgram(shaderStepAtoB);
+  for (int step = 0; step < nit; step++) {
+    StepCPU(level, a[level].View().Data(), &b[level][0], list);
+    a[level].Swap(b[level]);
+    if (step == 0)
+      WriteFixedCPU(level, b[level], list);
+  }
+}
 
-    glProgramUniform1i(shaderStepAtoB, glGetUniformLocation(shaderStepAtoB, "GridSizeX"), s); // attention X,Y
-    glProgramUniform1i(shaderStepAtoB, glGetUniformLocation(shaderStepAtoB, "GridSizeY"), s);
+/*!
+\brief One Jacobi step from bufferA to bufferB on the free cells of a list of the level, the list of the level or the
+one of a window, port of mgstepfloat.glsl (see stencil.h).
+The interior cells use the kernel without bounds checks unless specializedStencil is false.
+*/
+template<typename T>
+void SimpleGeometricMultigridFloat::StepCPU(int level, const T* a, T* b, const Stencil::CellList& list) {
+  int s = LevelSize(level);
+  int split = specializedStencil ? list.interior : 0;
+  Layout::Dispatch(layout, s, [&](auto l) {
+    if (storedConstraints[level] == PACKED16)
+      Stencil::Step(Stencil::Packed16(constraints[level]), l, a, b, s, list, split);
+    else if (Packed(level))
+      Stencil::Step(Stencil::Packed(constraints[level]), l, a, b, s, list, split);
+    else {
+      Stencil::Fields fields = { &alpha[level][0], &altitude[level][0], &laplacian[level][0] };
+      Stencil::Step(fields, l, a, b, s, list, split);
+    }
+  });
+}
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, glbufferAlpha[level]);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, glbufferAltitude[level]);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, glbufferA[level]);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, glbufferB[level]);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, glbufferLaplacian[level]);
+/*!
+\brief Write the values of the fixed cells of a list of the level in a solution buffer.
+*/
+template<typename T>
+void SimpleGeometricMultigridFloat::WriteFixedCPU(int level, ScalarField2DT<T>& buffer, const Stencil::CellList& list) {
+  if (storedConstraints[level] == PACKED16)
+    Stencil::WriteFixed(Stencil::Packed16(constraints[level]), &buffer[0], list);
+  else if (Packed(level))
+    Stencil::WriteFixed(Stencil::Packed(constraints[level]), &buffer[0], list);
+  else {
+    Stencil::Fields fields = { &alpha[level][0], &altitude[level][0], &laplacian[level][0] };
+    Stencil::WriteFixed(fields, &buffer[0], list);
+  }
+}
 
+/*!
+\brief Prolongation operator : computes the fine (level) interpolation wrt the coarse level result (level+1), on the
+window [i0, i1) x [j0, j1) of the level.
+*/
+template<typename T>
+void SimpleGeometricMultigridFloat::ProlongateCPU(int level, std::vector<ScalarField2DT<T> >& buffer, int i0, int j0, int i1, int j1) {
+  int s = LevelSize(level);
+  int cs = s / 2 + 1;
+  const T* coarse = buffer[level + 1].View().Data();
+  T* fine = &buffer[level][0];
+  Layout::Dispatch(layout, s, [&](auto fl) {
+    Stencil::Prolongate(coarse, decltype(fl)(cs), fine, fl, i0, j0, i1, j1);
+  });
+}
 
+/*!
+\brief Start the download of the result, the CPU is not stalled.
+The future is fulfilled by GPUReadbackQueue::Poll, called by the next Solve or GetResult on this thread.
+*/
+std::future<ScalarField2D> SimpleGeometricMultigridFloat::GetResultAsync() {
+  if (backend == CPU) {
+    std::promise<ScalarField2D> ready;
+    ready.set_value(GetResult());
+    return ready.get_future();
+  }
+  // note we have the most recent buffer here due to swap!
+  if (layout == Layout::ROW_MAJOR && storage == BUFFERS)
+    return GPUReadbackQueue::Instance().Enqueue(glbufferA[0], nx, ny);
+
+  // back to a row-major buffer on the GPU, in a temporary buffer: the copy to the staging buffer is ordered before its reuse
+  GPUBufferPool& pool = GPUBufferPool::Instance();
+  GLuint rowMajor = pool.Acquire(GLsizeiptr(nx) * ny * sizeof(float));
+  if (storage == IMAGES) {
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rowMajor);
+    glGetTextureImage(glbufferA[0], 0, GL_RED, GL_FLOAT, GLsizei(GLsizeiptr(nx) * ny * sizeof(float)), nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    std::future<ScalarField2D> result = GPUReadbackQueue::Instance().Enqueue(rowMajor, nx, ny);
+    pool.Release(rowMajor);
+    return result;
+  }
+  glUseProgram(shaderRowMajor);
+  glProgramUniform1i(shaderRowMajor, glGetUniformLocation(shaderRowMajor, "GridSizeX"), nx);
+  glProgramUniform1i(shaderRowMajor, glGetUniformLocation(shaderRowMajor, "GridSizeY"), ny);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, glbufferA[0]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, rowMajor);
+  glDispatchCompute((nx / WORK_GROUP_SIZE_X) + 1, (ny / WORK_GROUP_SIZE_Y) + 1, 1);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+  glUseProgram(0);
+  std::future<ScalarField2D> result = GPUReadbackQueue::Instance().Enqueue(rowMajor, nx, ny);
+  pool.Release(rowMajor);
+  return result;
+}
 
-    glDispatchCompute((s / WORK_GROUP_SIZE_X) + 1, (s / WORK_GROUP_SIZE_Y) + 1, 1); // attention X,Y
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+ScalarField2D SimpleGeometricMultigridFloat::GetResult() {
+  if (backend == CPU && precision == DOUBLE)
+    return ScalarField2D(GetResultDouble());
+  if (backend == CPU) // the solver keeps its buffers, this is the only copy
+    return layout == Layout::ROW_MAJOR ? bufferA[0] : Layout::FromLayout(layout, bufferA[0], nx);
+  std::future<ScalarField2D> result = GetResultAsync();
+  GPUReadbackQueue::Instance().Poll(true);
+  return GPUReadbackQueue::Result(result);
+}
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+/*!
+\brief Result in double precision, converted from float unless the solver runs on the CPU in double precision.
+*/
+ScalarField2DD SimpleGeometricMultigridFloat::GetResultDouble() {
+  if (backend == CPU && precision == DOUBLE)
+    return layout == Layout::ROW_MAJOR ? bufferA64[0] : Layout::FromLayout(layout, bufferA64[0], nx);
+  return ScalarField2DD(GetResult());
+}
 
+// Names of the calibration values (calibration.h): the CPU costs depend on the number of threads, the GL ones on the renderer
+static std::string CPUKey()
+{
+  return "cpu sweep, " + std::to_string(ThreadCount()) + " threads";
+}
 
-    glUseProgram(0);
+static std::string GLKey(const std::string& what)
+{
+  const char* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+  return what + ", " + (renderer != nullptr ? renderer : "unknown renderer");
+}
 
-    std::swap(glbufferA[level], glbufferB[level]);
+// Least squares fit of seconds = overhead + perCell * cells, on the relative errors so that the small levels count as
+// much as the large ones, both terms non-negative
+static SimpleGeometricMultigridFloat::SweepCost FitSweepCost(const std::vector<double>& cells, const std::vector<double>& seconds)
+{
+  double sw = 0.0, swx = 0.0, swxx = 0.0, swt = 0.0, swxt = 0.0;
+  for (unsigned int k = 0; k < cells.size(); k++) {
+    double w = 1.0 / (seconds[k] * seconds[k]);
+    sw += w;
+    swx += w * cells[k];
+    swxx += w * cells[k] * cells[k];
+    swt += w * seconds[k];
+    swxt += w * cells[k] * seconds[k];
   }
-  // get the iteration result in bufferA (swap has just been performed before stopping the loop)
-  glGetNamedBufferSubData(glbufferA[level], 0, sizeof(float)* nelem, &(bufferA[level][0]));
+  SimpleGeometricMultigridFloat::SweepCost cost;
+  double det = sw * swxx - swx * swx;
+  cost.overhead = (swxx * swt - swx * swxt) / det;
+  cost.perCell = (sw * swxt - swx * swt) / det;
+  if (cost.overhead < 0.0) {
+    cost.overhead = 0.0;
+    cost.perCell = swxt / swxx;
+  }
+  else if (cost.perCell < 0.0) {
+    cost.perCell = 0.0;
+    cost.overhead = swt / sw;
+  }
+  return cost;
 }
 
+/*!
+\brief Measure the backends and store the results in the calibration file (calibration.h): the sweeps of every level
+of a 513x513 scene are timed on both backends, best of three. The cost models of a sweep (SweepCost) are fitted on
+these times, the hybrid size is the size of the largest level the CPU is faster on plus one (0 if the GPU is faster
+on every level), and the transfer cost is the readback time of the solution. Requires a current OpenGL context.
+*/
+void SimpleGeometricMultigridFloat::Calibrate()
+{
+  // a fixed border and a fixed disk, the rest free
+  const int size = 513, sweeps = 20;
+  ScalarField2D alpha(size, size, 1.0f), altitude(size, size, 0.0f), laplacian(size, size, 0.001f);
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      int di = i - size / 3, dj = j - size / 2;
+      if (i == 0 || j == 0 || i == size - 1 || j == size - 1 || di * di + dj * dj < size * size / 64) {
+        alpha.Set(i, j, 0.0f);
+        altitude.Set(i, j, 1.0f);
+      }
+    }
+  }
+  bool log = verbose;
+  verbose = false;
+  SimpleGeometricMultigridFloat cpu(alpha.View(), altitude.View(), laplacian.View());
+  SimpleGeometricMultigridFloat gpu(std::move(alpha), std::move(altitude), std::move(laplacian));
+  cpu.InitCPU();
+  gpu.InitGL();
+  verbose = log;
+
+  typedef std::chrono::steady_clock Clock;
+  int hybrid = 0;
+  std::vector<double> cells, times[2]; // CPU then GPU, per sweep
+  for (int level = 0; level < gpu.mgsize; level++) {
+    double best[2] = { 1e30, 1e30 };
+    for (int run = 0; run < 3; run++) {
+      Clock::time_point start = Clock::now();
+      for (int step = 0; step < sweeps; step++)
+        cpu.StepCPU<float>(level, cpu.bufferA[level].View().Data(), &cpu.bufferB[level][0], cpu.cellLists[level]);
+      best[0] = std::min(best[0], std::chrono::duration<double>(Clock::now() - start).count());
+      glFinish();
+      start = Clock::now();
+      gpu.SmoothGL(level, sweeps);
+      glFinish();
+      best[1] = std::min(best[1], std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    int s = gpu.LevelSize(level);
+    cells.push_back(double(s) * s);
+    times[0].push_back(best[0] / sweeps);
+    times[1].push_back(best[1] / sweeps);
+    if (verbose)
+      cout << "level " << s << "x" << s << ": CPU " << 1e6 * times[0].back() << " us per sweep, GPU "
+        << 1e6 * times[1].back() << " us per sweep" << endl;
+    if (best[0] < best[1] && hybrid == 0)
+      hybrid = s + 1;
+  }
+  double transfer = 1e30;
+  for (int run = 0; run < 3; run++) {
+    Clock::time_point start = Clock::now();
+    gpu.GetResult();
+    transfer = std::min(transfer, std::chrono::duration<double>(Clock::now() - start).count());
+  }
 
+  SweepCost costs[2] = { FitSweepCost(cells, times[0]), FitSweepCost(cells, times[1]) };
+  Calibration& calibration = Calibration::Instance();
+  calibration.Set(CPUKey() + " overhead", costs[0].overhead);
+  calibration.Set(CPUKey() + " per cell", costs[0].perCell);
+  calibration.Set(GLKey("gl sweep") + " overhead", costs[1].overhead);
+  calibration.Set(GLKey("gl sweep") + " per cell", costs[1].perCell);
+  calibration.Set(GLKey("gl transfer per cell"), transfer / (double(size) * size));
+  calibration.Set(GLKey("hybrid size"), hybrid);
+  if (verbose)
+    cout << "Sweep cost: CPU " << 1e6 * costs[0].overhead << " us + " << 1e9 * costs[0].perCell << " ns per cell, GPU "
+      << 1e6 * costs[1].overhead << " us + " << 1e9 * costs[1].perCell << " ns per cell, stored in " << calibration.Filename() << endl;
+}
 
-ScalarField2D SimpleGeometricMultigridFloat::GetResult() {
+/*!
+\brief Smallest level size worth a GPU sweep on this machine, for hybridSize, measured by Calibrate the first time.
+Requires a current OpenGL context.
+\param measure measure again even if the calibration file has a value
+\return 0 if the GPU is faster on every level
+*/
+int SimpleGeometricMultigridFloat::CalibrateHybridSize(bool measure)
+{
+  double value = 0.0;
+  if (measure || !Calibration::Instance().Get(GLKey("hybrid size"), value)) {
+    Calibrate();
+    Calibration::Instance().Get(GLKey("hybrid size"), value);
+  }
+  return int(value);
+}
 
-  glUseProgram(shaderStepAtoB);
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, glbufferA[0]); // note we have the most recent buffer here due to swap!
-  void* ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bufferElems * sizeof(float), GL_MAP_READ_BIT);
-  memcpy(&(bufferA[0][0]), ptr, bufferElems * sizeof(float));
-  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-  glUseProgram(0);
+/*!
+\brief Cost model of a sweep on a backend, measured by Calibrate the first time, which requires a current OpenGL context.
+\param measure measure again even if the calibration file has the values
+*/
+SimpleGeometricMultigridFloat::SweepCost SimpleGeometricMultigridFloat::Cost(Backend backend, bool measure)
+{
+  Calibration& calibration = Calibration::Instance();
+  std::string key = backend == CPU ? CPUKey() : GLKey("gl sweep");
+  SweepCost cost;
+  if (measure || !calibration.Get(key + " overhead", cost.overhead) || !calibration.Get(key + " per cell", cost.perCell)) {
+    Calibrate();
+    calibration.Get(key + " overhead", cost.overhead);
+    calibration.Get(key + " per cell", cost.perCell);
+  }
+  return cost;
+}
 
-  ScalarField2D result(nx, ny);
-  ScalarField2D farray(bufferA[0]);
-  for (int i = 0; i < nx; i++) {
-    for (int j = 0; j < ny; j++) {
-      result.Set(i, j,farray[i * ny + j]);
-    }
+/*!
+\brief Predicted time of the solve of a size x size scene on a backend, from the cost models of the sweeps: the
+iterations of every level, on the CPU for the levels smaller than hybridSize on the GL backend, plus the upload of the
+constraints and the readback of the solution on the GL backend. Requires a current OpenGL context the first time
+(see Cost).
+*/
+double SimpleGeometricMultigridFloat::PredictSolve(int size, Backend backend, int hybridSize)
+{
+  SweepCost cpu = Cost(CPU), gl = backend == GL ? Cost(GL) : SweepCost();
+  int levels = 1;
+  for (int s = size; s > 9; s = s / 2 + 1)
+    levels++;
+  double seconds = 0.0;
+  bool uploaded = false;
+  int s = size;
+  for (int level = 0; level < levels; level++) {
+    int nit = 50 + 10 * (levels - level);
+    bool onGPU = backend == GL && s >= hybridSize;
+    seconds += nit * (onGPU ? gl : cpu).Seconds(double(s) * s);
+    uploaded |= onGPU;
+    s = s / 2 + 1;
   }
-  return result;
+  double transfer = 0.0;
+  if (uploaded && Calibration::Instance().Get(GLKey("gl transfer per cell"), transfer))
+    seconds += 2.0 * transfer * double(size) * size;
+  return seconds;
+}
+
+/*!
+\brief Fastest backend for a size x size scene according to the cost models (see PredictSolve), the GL backend
+must be available, with a current OpenGL context.
+*/
+SimpleGeometricMultigridFloat::Backend SimpleGeometricMultigridFloat::SelectBackend(int size, int hybridSize)
+{
+  return PredictSolve(size, GL, hybridSize) < PredictSolve(size, CPU) ? GL : CPU;
 }
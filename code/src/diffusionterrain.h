@@ -1,33 +1,153 @@
 #pragma once
 #include <GL/glew.h>
 #include "basics.h"
+#include "stencil.h"
+#include "layout.h"
+#include <chrono>
+#include <functional>
+#include <future>
 
-class SimpleGeometricMultigridFloat : public ScalarField2D {
+// SimpleGeometricMultigridFloat. Multigrid diffusion solver: pyramids of the constraints, built by the constructor,
+// and solution buffers, created by InitGL or InitCPU. Each pyramid is only kept where it is used: on the GL backend
+// the CPU pyramids are released once uploaded.
+// Alpha is exactly 0 or 1 below level 0, these levels store their constraints packed (one value and one bit per cell).
+// Level 0 is packed as well when the input alpha is binary, otherwise it keeps the three fields.
+// With quantizeConstraints, InitGL and InitCPU quantize the packed values on 16 bits (see PackedConstraints::Compress),
+// the solution and the arithmetic stay in float.
+// The smoother only visits the free cells of each level, listed once by the constructor; the values of the fixed cells
+// are written once in both solution buffers.
+// All the levels use the same memory layout (layout.h), the inputs are converted by the constructor and the result
+// by GetResult.
+// On the GL backend the solution of each level is stored in shader storage buffers, or, with the row-major layout, in
+// GL_R32F textures: the smoother reads them through the texture cache and the prolongation uses the bilinear filter.
+// With hybridSize, the GL backend solves the levels smaller than this size on the CPU, where a sweep costs less than
+// the dispatch and the barrier of a GPU sweep: the hierarchy of these levels stays on the CPU, and the solution of the
+// finest of them is uploaded once per solve, for the prolongation to the coarsest GPU level. CalibrateHybridSize
+// measures the size on the machine once and stores it (calibration.h).
+// The same measurement gives a cost model of the sweeps of each backend, SelectBackend uses it to pick the fastest
+// backend for a size of scene.
+// SolveProgressive is an anytime version of Solve: it solves the levels coarse to fine until a deadline, gives a
+// preview of each level, and resumes at the next level with the next call.
+// SolveRegion solves a rectangle of level 0 only: the coarse levels are solved on the whole domain, the fine ones on a
+// window around the rectangle, whose border is a Dirichlet boundary given by the prolongation of the coarser level.
+// The CPU backend can also solve in double precision (InitCPU(DOUBLE)), with the same schedule and the same float
+// constraints: it only measures the rounding of the float solvers, its truncation error is the same. The solution of
+// the discrete system, the accuracy reference, is given by SolveRefined (refinement.h).
+class SimpleGeometricMultigridFloat {
 public:
-    SimpleGeometricMultigridFloat(const ScalarField2D& alpha,
-        const ScalarField2D& altitude, const ScalarField2D& laplacian);
+    enum Backend {
+        GL,                       //!< Compute shaders, requires a current OpenGL context
+        CPU                       //!< Same smoothing and prolongation on the CPU, no OpenGL call
+    };
+    enum Storage {
+        BUFFERS,                  //!< Solution levels in shader storage buffers
+        IMAGES                    //!< Solution levels in GL_R32F textures, row-major layout only
+    };
+    enum Precision {
+        SINGLE,                   //!< Solution in float
+        DOUBLE                    //!< Solution in double, CPU backend only
+    };
+    SimpleGeometricMultigridFloat(const ConstScalarField2DView& alpha,
+        const ConstScalarField2DView& altitude, const ConstScalarField2DView& laplacian, Layout::Order layout = Layout::ROW_MAJOR);
+    SimpleGeometricMultigridFloat(ScalarField2D&& alpha, ScalarField2D&& altitude, ScalarField2D&& laplacian,
+        Layout::Order layout = Layout::ROW_MAJOR);
     ~SimpleGeometricMultigridFloat();
-    void InitGL();
+    void InitGL(Storage storage = BUFFERS);
+    void InitCPU(Precision precision = SINGLE);
     void Solve();
+    bool SolveProgressive(std::chrono::steady_clock::time_point deadline, int previewSize = 0,
+        const std::function<void(int level, const ScalarField2D& preview)>& preview = nullptr);
+    int SolvedLevel() const;
+    ScalarField2D Preview(int level, int size = 0);
+    ScalarField2D SolveRegion(int i0, int j0, int rows, int columns, int margin = 32);
     void VCycle(int);
+    void VCycleCPU(int);
     ScalarField2D GetResult();
-    ScalarField2D* alpha;         //!< alpha coefficient
-    ScalarField2D* altitude;      //!< altitude constraint 
-    ScalarField2D* bufferA;       //!< First buffer
-    ScalarField2D* bufferB;       //!< Second buffer
-    ScalarField2D* laplacian;     //!< Laplacian field
+    ScalarField2DD GetResultDouble();
+    std::future<ScalarField2D> GetResultAsync();
+    size_t HostMemory() const;
+    std::vector<ScalarField2D> alpha;         //!< alpha coefficient (level 0 only, empty if it is packed)
+    std::vector<ScalarField2D> altitude;      //!< altitude constraint (level 0 only, empty if it is packed)
+    std::vector<ScalarField2D> bufferA;       //!< First buffer (CPU backend only)
+    std::vector<ScalarField2D> bufferB;       //!< Second buffer (CPU backend only)
+    std::vector<ScalarField2DD> bufferA64;    //!< First buffer (CPU backend in double precision only)
+    std::vector<ScalarField2DD> bufferB64;    //!< Second buffer (CPU backend in double precision only)
+    std::vector<ScalarField2D> laplacian;     //!< Laplacian field (level 0 only, empty if it is packed)
+    std::vector<PackedConstraints> constraints; //!< Packed constraints, empty on level 0 if alpha is not binary
+    std::vector<Stencil::CellList> cellLists;   //!< Free then fixed cells of each level
+    int nx, ny;
+    Layout::Order layout;         //!< Memory layout of all the levels, the inputs and the result are row-major
     int mgsize;
     int minsize;
     int nrec;
     double trec;
+    Backend backend;
+    Storage storage;              //!< Storage of the solution levels on the GL backend
+    Precision precision;          //!< Type of the solution, always SINGLE on the GL backend
+    bool specializedStencil;      //!< Interior and border kernels instead of the generic step, true by default
+    bool quantizeConstraints;     //!< Packed constraints on 16 bits, set before InitGL or InitCPU, false by default
+    int hybridSize;               //!< GL backend: levels smaller than this size are solved on the CPU, set before InitGL, 0 by default (all on the GPU)
+    static bool verbose;          //!< Log the levels and buffers, true by default
+    static int CalibrateHybridSize(bool measure = false);
+
+    // SweepCost. Cost model of a Jacobi sweep of a level on one backend, fitted by Calibrate: overhead + perCell * cells.
+    struct SweepCost {
+        double overhead = 0.0;    //!< Seconds per sweep: dispatch and barrier on the GPU, thread startup on the CPU
+        double perCell = 0.0;     //!< Seconds per cell
+        double Seconds(double cells) const { return overhead + perCell * cells; }
+    };
+    static SweepCost Cost(Backend backend, bool measure = false);
+    static double PredictSolve(int size, Backend backend, int hybridSize = 0);
+    static Backend SelectBackend(int size, int hybridSize = 0);
 protected:
+    friend class SimpleGeometricMultigridBatch; // read the constraints of each level
+    friend class SimpleGeometricMultigridAtlas;
+
+    void BuildHierarchy();
+    void PackLevel0();
+    void Restrict(int r);
+    int LevelSize(int level) const;
+    bool Packed(int level) const;
+    void CompressConstraints();
+    ScalarField2D InitialGuess() const;
+    void SmoothGL(int level, int nit);
+    void DispatchCells(GLuint program, int level, int first, int count);
+    void BindSolution(GLuint read, GLuint write);
+    void WriteFixedGL(int level, GLuint target);
+    void UploadSolution(int level);
+    static void Calibrate();
+    void SolveLevel(int level);
+    template<typename T> void SolveLevelCPU(int level, std::vector<ScalarField2DT<T> >& a, std::vector<ScalarField2DT<T> >& b);
+    Stencil::CellList WindowCells(int level, int i0, int j0, int i1, int j1) const;
+    template<typename T> void SolveWindowCPU(int level, std::vector<ScalarField2DT<T> >& a, std::vector<ScalarField2DT<T> >& b,
+        int i0, int j0, int i1, int j1);
+    template<typename T> void StepCPU(int level, const T* a, T* b, const Stencil::CellList& list);
+    template<typename T> void WriteFixedCPU(int level, ScalarField2DT<T>& buffer, const Stencil::CellList& list);
+    template<typename T> void ProlongateCPU(int level, std::vector<ScalarField2DT<T> >& buffer, int i0, int j0, int i1, int j1);
     static const unsigned int WORK_GROUP_SIZE_X = 32;
     static const unsigned int WORK_GROUP_SIZE_Y = 32;
+    static const unsigned int WORK_GROUP_SIZE_CELLS = 256;
+    static const int STENCIL_SPLIT_SIZE = 65;   //!< Smallest level smoothed with the interior program
     unsigned int  bufferElems;
-    GLuint shaderStepAtoB;
+    int gpuLevels;                //!< Number of levels solved on the GPU by the GL backend, the coarser ones are solved on the CPU
+    int nextLevel;                //!< Next level of the progressive solve in progress, -1 if there is none
+    enum Constraints {
+        FIELDS,                   //!< Alpha, altitude and Laplacian fields
+        PACKED,                   //!< One float per cell
+        PACKED16                  //!< One 16-bit value per cell
+    };
+    std::vector<Constraints> storedConstraints; //!< Storage of the constraints of each level, set by Init*
+    std::vector<Range16> ranges16;  //!< Quantization of the altitudes and of the Laplacian of each level, kept for the shaders
+    GLuint shaderStepAtoB[3];       //!< Generic step, per storage of the constraints
+    GLuint shaderStepInterior[3];
+    GLuint shaderStepFixed[3];
+    GLuint shaderProlong;
+    GLuint shaderRowMajor;          //!< Conversion of the result to row-major, 0 for the row-major layout
     GLuint* glbufferAlpha;
     GLuint* glbufferAltitude;
-    GLuint* glbufferA;
+    GLuint* glbufferA;              //!< Solution buffers, or textures with the IMAGES storage
     GLuint* glbufferB;
     GLuint* glbufferLaplacian;
+    GLuint* glbufferConstraint;     //!< Values of the packed levels
+    GLuint* glbufferCells;          //!< Cell lists
 };
@@ -0,0 +1,603 @@
+#include "domaindecomposition.h"
+#include "parallel.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/*!
+\brief Inputs of the solve. Nothing is built here: each process builds its own strips during Solve.
+\param processes number of processes of the solve, this one included
+*/
+DomainDecomposition::DomainDecomposition(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+  const ConstScalarField2DView& laplacian, int processes)
+  : halo(4), coarseSize(129), alpha(alpha), altitude(altitude), laplacian(laplacian), nx(altitude.SizeX()),
+  processes(max(1, processes)), mgsize(1), coarse(0), barrier(nullptr), sharedBytes(0), parent(0), peak(0),
+  memory(this->processes, 0)
+{
+  // same levels as SimpleGeometricMultigridFloat
+  for (int s = nx; s > 9; s = s / 2 + 1)
+    mgsize++;
+}
+
+/*!
+\brief Size of a level, without padding.
+*/
+int DomainDecomposition::LevelSize(int level) const
+{
+  int s = nx;
+  for (int r = 0; r < level; r++)
+    s = s / 2 + 1;
+  return s;
+}
+
+const DomainDecomposition::Rows& DomainDecomposition::RowsOf(int level, int rank) const
+{
+  return rows[size_t(level) * processes + rank];
+}
+
+/*!
+\brief First coarse level and rows of each rank. The window of a strip covers its rows, their halo, and the rows read
+by the prolongation of the finer window; the strip also covers the rows read by the restriction of the coarser strip.
+*/
+void DomainDecomposition::Plan()
+{
+  coarse = 0;
+  while (coarse < mgsize - 1 && LevelSize(coarse) >= coarseSize && LevelSize(coarse) >= processes * halo)
+    coarse++;
+  rows.assign(size_t(coarse + 1) * processes, Rows());
+  for (int level = 0; level <= coarse; level++) {
+    int s = LevelSize(level);
+    for (int rank = 0; rank < processes; rank++) {
+      Rows& r = rows[size_t(level) * processes + rank];
+      r.r0 = int((long long)(s) * rank / processes);
+      r.r1 = int((long long)(s) * (rank + 1) / processes);
+      r.lo = r.r0;
+      r.hi = r.r1;
+      if (level == coarse)
+        continue;
+      r.lo = max(0, r.r0 - halo);
+      r.hi = min(s, r.r1 + halo);
+      if (level > 0) {
+        const Rows& fine = RowsOf(level - 1, rank);
+        r.lo = min(r.lo, fine.lo / 2);
+        r.hi = max(r.hi, min(s, (fine.hi - 1) / 2 + 2));
+      }
+    }
+  }
+  for (int level = coarse; level >= 0; level--) {
+    int s = LevelSize(level);
+    for (int rank = 0; rank < processes; rank++) {
+      Rows& r = rows[size_t(level) * processes + rank];
+      r.first = r.lo;
+      r.last = r.hi;
+      if (level < coarse) {
+        const Rows& next = RowsOf(level + 1, rank);
+        r.first = min(r.first, max(0, 2 * next.first - 1));
+        r.last = max(r.last, min(s, 2 * next.last));
+      }
+    }
+  }
+  exchanged.assign(coarse, 0);
+  for (int level = 0; level < coarse; level++)
+    for (int rank = 0; rank < processes; rank++) {
+      const Rows& r = RowsOf(level, rank);
+      exchanged[level] = max(exchanged[level], max(r.r0 - r.lo, r.hi - r.r1));
+    }
+}
+
+/*!
+\brief Call f with the constraints of a strip, Stencil::Packed or Stencil::Fields.
+*/
+template<typename F>
+void DomainDecomposition::Constraints(int level, F f) const
+{
+  const Strip& strip = strips[level];
+  if (strip.constraints.words > 0)
+    f(Stencil::Packed(strip.constraints));
+  else {
+    Stencil::Fields fields = { strip.alpha.View().Data(), strip.altitude.View().Data(), strip.laplacian.View().Data() };
+    f(fields);
+  }
+}
+
+template<typename T>
+T* DomainDecomposition::Shared(int part) const
+{
+  return reinterpret_cast<T*>(reinterpret_cast<char*>(barrier) + offsets[part]);
+}
+
+/*!
+\brief Rows sent by a rank at an exchange of a level, side 0 at the top of its strip, side 1 at the bottom.
+A slot holds exchanged[level] rows, the rows of the bottom slot end with the strip.
+*/
+float* DomainDecomposition::Slot(int level, int rank, int side, int copy) const
+{
+  return Shared<float>(SLOTS + level) + size_t((rank * 2 + side) * 2 + copy) * exchanged[level] * LevelSize(level);
+}
+
+size_t DomainDecomposition::Strip::Memory() const
+{
+  return constraints.Memory() + alpha.Memory() + altitude.Memory() + laplacian.Memory() + cells.Memory() + a.Memory() + b.Memory();
+}
+
+/*!
+\brief Memory of the strips of this process.
+*/
+size_t DomainDecomposition::StripMemory() const
+{
+  size_t bytes = coarseRows.Memory();
+  for (const Strip& strip : strips)
+    bytes += strip.Memory();
+  return bytes;
+}
+
+/*!
+\brief Wait for all the processes, they spin on the generation of the barrier. While it spins, rank 0 checks that
+the other processes are alive: they only end after their last barrier, so a process that has ended before the
+barrier is released has failed. The others check the abort flag and that rank 0 is alive.
+\return false if the solve has been aborted
+*/
+bool DomainDecomposition::Wait()
+{
+#ifdef _WIN32
+  return false;
+#else
+  int generation = barrier->generation.load();
+  if (barrier->arrived.fetch_add(1) == processes - 1) {
+    barrier->arrived.store(0);
+    barrier->generation.fetch_add(1);
+    return barrier->aborted.load() == 0;
+  }
+  for (int spin = 1; barrier->generation.load() == generation; spin++) {
+    if (barrier->aborted.load() != 0)
+      return false;
+    if (spin % 1024 == 0) {
+      if (parent != 0 && getppid() != parent)
+        return false;
+      for (unsigned int k = 0; k < workers.size(); k++) {
+        if (workers[k] != 0 && waitpid(workers[k], nullptr, WNOHANG) == workers[k]) {
+          cerr << "[error] the process of rank " << k + 1 << " has ended during the solve" << endl;
+          workers[k] = 0; // reaped
+          return false;
+        }
+      }
+    }
+    std::this_thread::yield();
+  }
+  return barrier->aborted.load() == 0;
+#endif
+}
+
+/*!
+\brief Stop the other processes and wait for them, rank 0 only.
+*/
+void DomainDecomposition::Abort()
+{
+#ifndef _WIN32
+  barrier->aborted.store(1);
+  for (int worker : workers) {
+    if (worker == 0)
+      continue;
+    kill(worker, SIGKILL);
+    waitpid(worker, nullptr, 0);
+  }
+  workers.clear();
+#endif
+}
+
+/*!
+\brief Strips of a rank, from its rows of the inputs: level 0, then each coarser strip restricted from the finer one,
+down to the rows of the rank on the first coarse level. Level 0 is packed as by SimpleGeometricMultigridFloat if alpha
+is binary on the rows of all the ranks.
+\return false if the solve has been aborted
+*/
+bool DomainDecomposition::BuildStrips(int rank)
+{
+  strips.assign(coarse, Strip());
+  const Rows& r0 = RowsOf(0, rank);
+  int n = r0.last - r0.first;
+  bool binary = true;
+  for (int i = r0.first; i < r0.last && binary; i++)
+    for (int j = 0; j < nx && binary; j++)
+      binary = alpha.Get(i, j) == 0.0f || alpha.Get(i, j) == 1.0f;
+  if (!binary)
+    barrier->general.store(1);
+  if (!Wait())
+    return false;
+  Strip& strip = strips[0];
+  if (barrier->general.load() == 0) {
+    strip.constraints = PackedConstraints(nx, r0.first, n);
+    PackedConstraints& c = strip.constraints;
+    float* v = &c.value[0];
+    ParallelFor(r0.first, r0.last, max(1, 16384 / nx), [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        for (int j = 0; j < nx; j++) {
+          int idx = (i - r0.first) * nx + j;
+          if (alpha.Get(i, j) == 0.0f) {
+            c.SetFixed(i, j);
+            v[idx] = altitude.Get(i, j);
+          }
+          else
+            v[idx] = laplacian.Get(i, j);
+        }
+      }
+    });
+  }
+  else {
+    strip.alpha = ScalarField2D(alpha.SubView(r0.first, 0, nx, n));
+    strip.altitude = ScalarField2D(altitude.SubView(r0.first, 0, nx, n));
+    strip.laplacian = ScalarField2D(laplacian.SubView(r0.first, 0, nx, n));
+  }
+
+  for (int level = 1; level <= coarse; level++) {
+    int s = LevelSize(level), fs = LevelSize(level - 1);
+    const Rows& fine = RowsOf(level - 1, rank);
+    const Rows& r = RowsOf(level, rank);
+    PackedConstraints& target = level == coarse ? coarseRows : strips[level].constraints;
+    target = PackedConstraints(s, r.first, r.last - r.first);
+    Constraints(level - 1, [&](const auto& c) {
+      Stencil::Restrict(c, Layout::Strip(fs, fine.first), target, Layout::Strip(s, r.first), s, r.first, r.last);
+    });
+  }
+
+  for (int level = 0; level < coarse; level++) {
+    int s = LevelSize(level);
+    const Rows& r = RowsOf(level, rank);
+    Strip& st = strips[level];
+    Constraints(level, [&](const auto& c) { st.cells.BuildWindow(c, Layout::Strip(s, r.first), s, r.lo, 0, r.hi, s); });
+    st.a = ScalarField2D(s, r.last - r.first);
+    st.b = ScalarField2D(s, r.last - r.first);
+  }
+  return true;
+}
+
+/*!
+\brief Coarse levels, by rank 0: the first coarse level from the rows of all the ranks, then the same solve as the
+levels of SimpleGeometricMultigridFloat below it. Its solution is left in the shared memory.
+*/
+void DomainDecomposition::SolveCoarse()
+{
+  int s = LevelSize(coarse), words = (s + 31) / 32;
+  const float* v = Shared<float>(COARSE_VALUES);
+  const unsigned int* fixed = Shared<unsigned int>(COARSE_FIXED);
+  ScalarField2D a(s, s), alt(s, s), lap(s, s);
+  for (int i = 0; i < s; i++) {
+    for (int j = 0; j < s; j++) {
+      int idx = i * s + j;
+      a[idx] = (fixed[i * words + (j >> 5)] >> (j & 31)) & 1u ? 0.0f : 1.0f;
+      alt[idx] = lap[idx] = v[idx];
+    }
+  }
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  SimpleGeometricMultigridFloat solver(move(a), move(alt), move(lap));
+  solver.InitCPU();
+  solver.bufferA[0] = ScalarField2D(s, s); // a coarse level of the whole hierarchy starts from 0, not from alpha
+  solver.Solve();
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  memcpy(Shared<float>(COARSE_SOLUTION), solver.bufferA[0].View().Data(), size_t(s) * s * sizeof(float));
+  peak = max(peak, StripMemory() + solver.HostMemory());
+}
+
+/*!
+\brief Rows of the strip of a rank sent at an exchange: the first and the last exchanged[level] rows.
+*/
+void DomainDecomposition::Publish(int level, int rank, int copy)
+{
+  int s = LevelSize(level), n = exchanged[level];
+  const Rows& r = RowsOf(level, rank);
+  const float* a = strips[level].a.View().Data();
+  int top = min(r.r1, r.r0 + n), bottom = max(r.r0, r.r1 - n);
+  memcpy(Slot(level, rank, 0, copy), a + size_t(r.r0 - r.first) * s, size_t(top - r.r0) * s * sizeof(float));
+  memcpy(Slot(level, rank, 1, copy) + size_t(bottom - (r.r1 - n)) * s, a + size_t(bottom - r.first) * s, size_t(r.r1 - bottom) * s * sizeof(float));
+}
+
+/*!
+\brief Rows of the window of a rank outside its strip, from the slots of the ranks that own them, in both buffers.
+*/
+void DomainDecomposition::Fetch(int level, int rank, int copy)
+{
+  int s = LevelSize(level), n = exchanged[level];
+  const Rows& r = RowsOf(level, rank);
+  Strip& strip = strips[level];
+  for (int i = r.lo; i < r.hi; i++) {
+    if (i == r.r0)
+      i = r.r1;
+    if (i >= r.hi)
+      break;
+    int q = rank;
+    while (i < RowsOf(level, q).r0)
+      q--;
+    while (i >= RowsOf(level, q).r1)
+      q++;
+    const Rows& o = RowsOf(level, q);
+    const float* row = q < rank ? Slot(level, q, 1, copy) + size_t(i - (o.r1 - n)) * s : Slot(level, q, 0, copy) + size_t(i - o.r0) * s;
+    memcpy(&strip.a[0] + size_t(i - r.first) * s, row, s * sizeof(float));
+    memcpy(&strip.b[0] + size_t(i - r.first) * s, row, s * sizeof(float));
+  }
+}
+
+/*!
+\brief Levels [0, coarse) of the strips of a rank, same operations as SimpleGeometricMultigridFloat::SolveLevelCPU
+on the rows of its window. Every rank runs the same number of exchanges. A strip is released once the finer one has
+been prolongated from it.
+\return false if the solve has been aborted
+*/
+bool DomainDecomposition::SolveStrips(int rank)
+{
+  for (int level = coarse - 1; level >= 0; level--) {
+    int s = LevelSize(level), cs = LevelSize(level + 1);
+    int nit = 50 + (10 * (mgsize - level));
+    const Rows& r = RowsOf(level, rank);
+    Strip& strip = strips[level];
+    Layout::Strip l(s, r.first);
+    float* a = &strip.a[0];
+    if (level + 1 == coarse)
+      Stencil::Prolongate(Shared<float>(COARSE_SOLUTION), Layout::Strip(cs, 0), a, l, r.lo, 0, r.hi, s);
+    else {
+      Stencil::Prolongate(&strips[level + 1].a[0], Layout::Strip(cs, RowsOf(level + 1, rank).first), a, l, r.lo, 0, r.hi, s);
+      strips[level + 1] = Strip();
+    }
+
+    // the rows of the halo are a Dirichlet boundary between two exchanges: the error of the boundary moves by one row
+    // per sweep, the rows of the strip are exact until the next exchange
+    memcpy(&strip.b[0] + size_t(r.lo - r.first) * s, a + size_t(r.lo - r.first) * s, size_t(r.hi - r.lo) * s * sizeof(float));
+    bool aborted = false;
+    Constraints(level, [&](const auto& c) {
+      Stencil::WriteFixed(c, &strip.b[0], strip.cells);
+      int copy = 0;
+      for (int step = 0; step < nit && !aborted; step++) {
+        Stencil::Step(c, l, strip.a.View().Data(), &strip.b[0], s, strip.cells, strip.cells.interior);
+        strip.a.Swap(strip.b);
+        if (step == 0)
+          Stencil::WriteFixed(c, &strip.b[0], strip.cells);
+        if ((step + 1) % halo != 0 && step != nit - 1)
+          continue;
+        Publish(level, rank, copy);
+        if (!Wait())
+          aborted = true;
+        else
+          Fetch(level, rank, copy);
+        copy ^= 1;
+      }
+    });
+    if (aborted)
+      return false;
+  }
+  return true;
+}
+
+/*!
+\brief Solve of a rank: its strips, its rows of the first coarse level to rank 0, the coarse levels by rank 0, then
+the fine levels. Its peak memory is left in the shared memory.
+\return false if the solve has been aborted
+*/
+bool DomainDecomposition::SolveRank(int rank)
+{
+  peak = 0;
+  if (!BuildStrips(rank))
+    return false;
+  peak = StripMemory();
+  int s = LevelSize(coarse), words = (s + 31) / 32;
+  const Rows& r = RowsOf(coarse, rank);
+  if (r.r1 > r.r0) {
+    memcpy(Shared<float>(COARSE_VALUES) + size_t(r.r0) * s, coarseRows.value.View().Data(), size_t(r.r1 - r.r0) * s * sizeof(float));
+    memcpy(Shared<unsigned int>(COARSE_FIXED) + size_t(r.r0) * words, coarseRows.fixed.data(), size_t(r.r1 - r.r0) * words * sizeof(unsigned int));
+  }
+  coarseRows = PackedConstraints();
+  if (!Wait())
+    return false;
+  if (rank == 0)
+    SolveCoarse();
+  if (!Wait() || !SolveStrips(rank))
+    return false;
+  Shared<size_t>(MEMORY)[rank] = peak;
+  return true;
+}
+
+/*!
+\brief Rows of level 0 of a rank, to rank 0.
+*/
+bool DomainDecomposition::Send(int rank, int output)
+{
+#ifdef _WIN32
+  return false;
+#else
+  const Rows& r = RowsOf(0, rank);
+  const char* data = reinterpret_cast<const char*>(strips[0].a.View().Data() + size_t(r.r0 - r.first) * nx);
+  size_t bytes = size_t(r.r1 - r.r0) * nx * sizeof(float);
+  while (bytes > 0) {
+    ssize_t n = write(output, data, bytes);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    bytes -= size_t(n);
+  }
+  close(output);
+  return true;
+#endif
+}
+
+/*!
+\brief Level 0 in the result, by rank 0: its own rows, then the rows of the other ranks from their pipes.
+\param inputs pipe of each rank from 1 to processes - 1
+*/
+bool DomainDecomposition::Gather(const std::vector<int>& inputs)
+{
+#ifdef _WIN32
+  return false;
+#else
+  result = ScalarField2D(nx, nx);
+  const Rows& r = RowsOf(0, 0);
+  memcpy(&result[0] + size_t(r.r0) * nx, strips[0].a.View().Data() + size_t(r.r0 - r.first) * nx, size_t(r.r1 - r.r0) * nx * sizeof(float));
+  peak = max(peak, StripMemory() + result.Memory());
+  Shared<size_t>(MEMORY)[0] = peak;
+  strips.clear();
+  for (int rank = 1; rank < processes; rank++) {
+    const Rows& o = RowsOf(0, rank);
+    char* data = reinterpret_cast<char*>(&result[0] + size_t(o.r0) * nx);
+    size_t bytes = size_t(o.r1 - o.r0) * nx * sizeof(float);
+    while (bytes > 0) {
+      ssize_t n = read(inputs[rank - 1], data, bytes);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        cerr << "[error] the process of rank " << rank << " has ended before sending its rows" << endl;
+        return false;
+      }
+      data += n;
+      bytes -= size_t(n);
+    }
+  }
+  return true;
+#endif
+}
+
+/*!
+\brief Solve of the scene by all the processes. The other processes are started for each solve, and end with it;
+each one builds its own strips from its rows of the inputs.
+\return false if the processes or the shared memory could not be created, or if a process has died during the solve
+*/
+bool DomainDecomposition::Solve()
+{
+#ifdef _WIN32
+  cerr << "[error] DomainDecomposition requires fork, not available on Windows" << endl;
+  return false;
+#else
+  if (halo < 1) {
+    cerr << "[error] the halo of the strips must have at least one row" << endl;
+    return false;
+  }
+  Plan();
+  memory.assign(processes, 0);
+  if (coarse == 0) {
+    // no level large enough to be split
+    SimpleGeometricMultigridFloat solver(alpha, altitude, laplacian);
+    solver.InitCPU();
+    solver.Solve();
+    result = solver.GetResult();
+    memory[0] = solver.HostMemory() + result.Memory();
+    return true;
+  }
+  if (SimpleGeometricMultigridFloat::verbose)
+    cout << "levels 0 to " << coarse - 1 << " in " << processes << " strips, exchanges every " << halo << " sweeps" << endl;
+
+  // shared memory: the barrier, the memory of the ranks, the first coarse level and its solution, then the slots of
+  // the exchanges of each level, all aligned on 64 bytes
+  int cs = LevelSize(coarse);
+  size_t bytes = 64;
+  offsets.assign(SLOTS + coarse, 0);
+  auto reserve = [&](int part, size_t size) {
+    offsets[part] = bytes;
+    bytes += (size + 63) & ~size_t(63);
+  };
+  reserve(MEMORY, sizeof(size_t) * processes);
+  reserve(COARSE_VALUES, sizeof(float) * cs * cs);
+  reserve(COARSE_FIXED, sizeof(unsigned int) * cs * ((cs + 31) / 32));
+  reserve(COARSE_SOLUTION, sizeof(float) * cs * cs);
+  for (int level = 0; level < coarse; level++)
+    reserve(SLOTS + level, sizeof(float) * 4 * processes * exchanged[level] * LevelSize(level));
+  void* shared = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    cerr << "[error] cannot map " << bytes << " bytes of shared memory" << endl;
+    return false;
+  }
+  sharedBytes = bytes;
+  barrier = new (shared) Barrier();
+  barrier->arrived = 0;
+  barrier->generation = 0;
+  barrier->aborted = 0;
+  barrier->general = 0;
+
+  // the threads of each process share the cores
+  int threads = ThreadCount();
+  SetThreadCount(max(1, threads / processes));
+  bool success = true;
+  vector<int> inputs, outputs;
+  for (int rank = 1; rank < processes && success; rank++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      cerr << "[error] cannot create the pipe of rank " << rank << endl;
+      success = false;
+      break;
+    }
+    inputs.push_back(fds[0]);
+    outputs.push_back(fds[1]);
+  }
+  pid_t self = getpid();
+  workers.clear();
+  for (int rank = 1; rank < processes && success; rank++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      for (unsigned int k = 0; k < inputs.size(); k++) {
+        close(inputs[k]);
+        if (int(k) != rank - 1)
+          close(outputs[k]);
+      }
+      workers.clear();
+      parent = self;
+      _exit(SolveRank(rank) && Send(rank, outputs[rank - 1]) ? 0 : 1);
+    }
+    if (pid < 0) {
+      cerr << "[error] cannot start the process of rank " << rank << endl;
+      success = false;
+      break;
+    }
+    workers.push_back(pid);
+  }
+  for (int output : outputs)
+    close(output);
+  success = success && SolveRank(0) && Gather(inputs);
+  if (!success)
+    Abort();
+  for (pid_t worker : workers) {
+    int status = 0;
+    waitpid(worker, &status, 0);
+    success = success && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  workers.clear();
+  for (int input : inputs)
+    close(input);
+  SetThreadCount(threads);
+  strips.clear();
+  if (success)
+    for (int rank = 0; rank < processes; rank++)
+      memory[rank] = Shared<size_t>(MEMORY)[rank];
+  munmap(barrier, sharedBytes);
+  barrier = nullptr;
+  return success;
+#endif
+}
+
+/*!
+\brief Result of the last solve.
+*/
+ScalarField2D DomainDecomposition::GetResult() const
+{
+  return result;
+}
+
+int DomainDecomposition::Processes() const
+{
+  return processes;
+}
+
+/*!
+\brief Peak memory of a rank during the last solve, in bytes: its strips, and for rank 0 the coarse solver and the
+result.
+*/
+size_t DomainDecomposition::Memory(int rank) const
+{
+  return memory[rank];
+}
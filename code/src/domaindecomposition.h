@@ -0,0 +1,92 @@
+#pragma once
+#include "diffusionterrain.h"
+#include <atomic>
+
+// DomainDecomposition. Solve of one scene by several processes of the same machine, same schedule and same result as
+// SimpleGeometricMultigridFloat on the CPU. The fine levels, from level 0 down to the first level smaller than
+// coarseSize, are split in strips of rows, one per process (rank). Each rank only builds the constraints and the
+// solution of its strip and of its halo, from its rows of the inputs, and restricts them down to its rows of the
+// first coarse level. These rows are gathered by rank 0, which builds and solves the coarse levels, then gives back
+// the solution of the first coarse level for the prolongation of the strips. The strips are solved with a halo of
+// rows of their neighbours: with as many rows in the halo as sweeps between two exchanges (every `halo` sweeps), the
+// rows of each strip are computed exactly as by a single process. An exchange only sends the rows at the top and at
+// the bottom of each strip, through shared memory, written alternately in two copies so that a single barrier per
+// exchange is needed. Level 0 is gathered by rank 0 at the end, through one pipe per rank.
+// The processes only share these messages, not the hierarchy: each one could run on its own node and read its rows
+// of the inputs. Here they are started by fork, so POSIX only, Solve fails on Windows.
+// If a process dies during the solve, rank 0 finds it while waiting at the barrier, stops the others and Solve fails.
+class DomainDecomposition {
+public:
+    DomainDecomposition(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+        const ConstScalarField2DView& laplacian, int processes);
+    bool Solve();
+    ScalarField2D GetResult() const;
+    int Processes() const;
+    size_t Memory(int rank) const;
+    int halo;                         //!< Rows of the halo of a strip, sweeps between two exchanges, 4 by default
+    int coarseSize;                   //!< Levels smaller than this size are solved by rank 0 only, 129 by default
+protected:
+    // Parts of the shared memory, after the barrier
+    enum Part {
+        MEMORY,                       //!< Peak memory of each rank
+        COARSE_VALUES,                //!< Constraints of the first coarse level, gathered by rank 0
+        COARSE_FIXED,
+        COARSE_SOLUTION,              //!< Solution of the first coarse level, read by the prolongation of each rank
+        SLOTS                         //!< Rows sent by the exchanges of each level, then one part per level
+    };
+    struct Barrier {
+        std::atomic<int> arrived;
+        std::atomic<int> generation;
+        std::atomic<int> aborted;     //!< Set by rank 0 when a process has died, the others stop
+        std::atomic<int> general;     //!< Alpha is not binary on the rows of a rank, level 0 is not packed
+    };
+    // Rows of a level for one rank
+    struct Rows {
+        int r0, r1;                   //!< Rows solved by the rank
+        int lo, hi;                   //!< Window: rows of the rank, its halo and the rows read by the finer prolongation
+        int first, last;              //!< Rows of the strip: window, and the rows read by the coarser restriction
+    };
+    // Strip of a level held by a rank, constraints and solution of the rows [first, last) in Layout::Strip
+    struct Strip {
+        PackedConstraints constraints;            //!< Empty on level 0 if alpha is not binary on these rows
+        ScalarField2D alpha, altitude, laplacian; //!< Level 0 only, if alpha is not binary on these rows
+        Stencil::CellList cells;                  //!< Free and fixed cells of the window
+        ScalarField2D a, b;                       //!< Solution buffers
+        size_t Memory() const;
+    };
+    bool Wait();
+    void Abort();
+    void Plan();
+    const Rows& RowsOf(int level, int rank) const;
+    int LevelSize(int level) const;
+    template<typename F> void Constraints(int level, F f) const;
+    template<typename T> T* Shared(int part) const;
+    float* Slot(int level, int rank, int side, int copy) const;
+    bool SolveRank(int rank);
+    bool BuildStrips(int rank);
+    void SolveCoarse();
+    bool SolveStrips(int rank);
+    void Publish(int level, int rank, int copy);
+    void Fetch(int level, int rank, int copy);
+    bool Send(int rank, int output);
+    bool Gather(const std::vector<int>& inputs);
+    size_t StripMemory() const;
+
+    ConstScalarField2DView alpha, altitude, laplacian; //!< Inputs, each rank only reads the rows of its strip
+    int nx;
+    int processes;
+    int mgsize;                       //!< Number of levels of the whole hierarchy
+    int coarse;                       //!< First level solved by rank 0 only
+    std::vector<Rows> rows;           //!< Rows of each rank on the levels 0 to coarse
+    std::vector<int> exchanged;       //!< Rows sent at the top and at the bottom of each strip, per level
+    std::vector<Strip> strips;        //!< Strips of this process, levels 0 to coarse - 1
+    PackedConstraints coarseRows;     //!< Rows of this process on the first coarse level, sent to rank 0
+    Barrier* barrier;                 //!< Start of the shared memory
+    size_t sharedBytes;
+    std::vector<size_t> offsets;      //!< Offset of each part in the shared memory, in bytes
+    std::vector<int> workers;         //!< Processes of the ranks 1 to processes - 1 (pid), in rank 0
+    int parent;                       //!< Process of rank 0 (pid), in the others
+    size_t peak;                      //!< Largest memory of the strips and solvers of this process during the solve
+    std::vector<size_t> memory;       //!< Peak memory of each rank during the last solve, in bytes
+    ScalarField2D result;
+};
@@ -0,0 +1,128 @@
+#pragma once
+// Expression templates for scalar field arithmetic.
+// An expression such as (lap - 0.5f) * 0.03f or a * x + (1.0f - a) * y builds a tree of lightweight nodes,
+// evaluated in a single (vectorized and parallel) loop when assigned to a ScalarField2D: no temporary field is
+// allocated and memory is traversed once.
+// Nodes compute in the type of their operands, with the usual promotions: float expressions stay in float, an
+// expression mixing float and double fields is computed in double. Constants take the type of the other operand.
+#include <cstddef>
+#include <utility>
+
+template<typename T>
+class ScalarField2DT;
+
+// FieldExpression. Base class of the nodes (CRTP), E provides Value(index), SizeX() and SizeY(). The size of an
+// expression combining fields of different sizes is negative, it evaluates to an empty field with an error.
+template<typename E>
+struct FieldExpression
+{
+	inline const E& Derived() const
+	{
+		return static_cast<const E&>(*this);
+	}
+};
+
+// How an operand is stored in a node: fields by reference, other nodes and constants by value.
+template<typename E>
+struct FieldOperand
+{
+	typedef E Type;
+};
+
+template<typename T>
+struct FieldOperand<ScalarField2DT<T> >
+{
+	typedef const ScalarField2DT<T>& Type;
+};
+
+// Scalar type of the values of an expression.
+template<typename E>
+struct FieldScalar
+{
+	typedef decltype(std::declval<const E&>().Value(0)) Type;
+};
+
+// Size of an expression from the sizes of its two operands: -1 for a constant, -2 if both are fields of different sizes
+inline int FieldSize(int l, int r)
+{
+	if (l == -1)
+		return r;
+	if (r == -1)
+		return l;
+	return l == r ? l : -2;
+}
+
+// FieldConstant. Scalar operand, broadcast to the size of the other operand.
+template<typename T>
+struct FieldConstant : public FieldExpression<FieldConstant<T> >
+{
+	T value;
+
+	inline explicit FieldConstant(T value) : value(value) {}
+	inline T Value(size_t) const { return value; }
+	inline int SizeX() const { return -1; }
+	inline int SizeY() const { return -1; }
+};
+
+// FieldBinary. Element-wise operation between two operands.
+template<typename L, typename R, typename Op>
+struct FieldBinary : public FieldExpression<FieldBinary<L, R, Op> >
+{
+	typename FieldOperand<L>::Type l;
+	typename FieldOperand<R>::Type r;
+
+	inline FieldBinary(const L& l, const R& r) : l(l), r(r) {}
+	inline auto Value(size_t i) const { return Op::Apply(l.Value(i), r.Value(i)); }
+	inline int SizeX() const { return FieldSize(l.SizeX(), r.SizeX()); }
+	inline int SizeY() const { return FieldSize(l.SizeY(), r.SizeY()); }
+};
+
+// FieldNegate. Element-wise negation.
+template<typename E>
+struct FieldNegate : public FieldExpression<FieldNegate<E> >
+{
+	typename FieldOperand<E>::Type e;
+
+	inline explicit FieldNegate(const E& e) : e(e) {}
+	inline auto Value(size_t i) const { return -e.Value(i); }
+	inline int SizeX() const { return e.SizeX(); }
+	inline int SizeY() const { return e.SizeY(); }
+};
+
+namespace FieldOperators
+{
+	struct Add { template<typename A, typename B> static inline auto Apply(A a, B b) { return a + b; } };
+	struct Sub { template<typename A, typename B> static inline auto Apply(A a, B b) { return a - b; } };
+	struct Mul { template<typename A, typename B> static inline auto Apply(A a, B b) { return a * b; } };
+	struct Div { template<typename A, typename B> static inline auto Apply(A a, B b) { return a / b; } };
+}
+
+#define FIELD_EXPRESSION_OPERATOR(op, Op) \
+	template<typename L, typename R> \
+	inline FieldBinary<L, R, FieldOperators::Op> operator op(const FieldExpression<L>& l, const FieldExpression<R>& r) \
+	{ \
+		return FieldBinary<L, R, FieldOperators::Op>(l.Derived(), r.Derived()); \
+	} \
+	template<typename L, typename T = typename FieldScalar<L>::Type> \
+	inline FieldBinary<L, FieldConstant<T>, FieldOperators::Op> operator op(const FieldExpression<L>& l, typename FieldScalar<L>::Type r) \
+	{ \
+		return FieldBinary<L, FieldConstant<T>, FieldOperators::Op>(l.Derived(), FieldConstant<T>(r)); \
+	} \
+	template<typename R, typename T = typename FieldScalar<R>::Type> \
+	inline FieldBinary<FieldConstant<T>, R, FieldOperators::Op> operator op(typename FieldScalar<R>::Type l, const FieldExpression<R>& r) \
+	{ \
+		return FieldBinary<FieldConstant<T>, R, FieldOperators::Op>(FieldConstant<T>(l), r.Derived()); \
+	}
+
+FIELD_EXPRESSION_OPERATOR(+, Add)
+FIELD_EXPRESSION_OPERATOR(-, Sub)
+FIELD_EXPRESSION_OPERATOR(*, Mul)
+FIELD_EXPRESSION_OPERATOR(/, Div)
+
+#undef FIELD_EXPRESSION_OPERATOR
+
+template<typename E>
+inline FieldNegate<E> operator-(const FieldExpression<E>& e)
+{
+	return FieldNegate<E>(e.Derived());
+}
@@ -0,0 +1,151 @@
+#pragma once
+// Row kernels of the scalar field algorithms, vectorized with SSE2 when available (always on x86-64).
+// They only use exact IEEE operations in the same order as the scalar code: the results are bit-identical.
+// The template versions at the end are the scalar code for the other types (double).
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FIELD_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace FieldKernels
+{
+	/*!
+	\brief Min, max, sum and sum of squares of a row, in one pass. The accumulators are updated, not reset.
+	*/
+	inline void Statistics(const float* p, int n, float& min, float& max, double& sum, double& sumsq)
+	{
+		int j = 0;
+#ifdef FIELD_KERNELS_SSE2
+		if (n >= 4) {
+			__m128 vmin = _mm_set1_ps(min);
+			__m128 vmax = _mm_set1_ps(max);
+			// float partial sums are flushed in double every block to keep the precision on long rows
+			const int block = 1024;
+			while (j + 4 <= n) {
+				__m128 vsum = _mm_setzero_ps();
+				__m128 vsumsq = _mm_setzero_ps();
+				int end = j + block < n ? j + block : n;
+				for (; j + 4 <= end; j += 4) {
+					__m128 v = _mm_loadu_ps(p + j);
+					vmin = _mm_min_ps(vmin, v);
+					vmax = _mm_max_ps(vmax, v);
+					vsum = _mm_add_ps(vsum, v);
+					vsumsq = _mm_add_ps(vsumsq, _mm_mul_ps(v, v));
+				}
+				float s[4], sq[4];
+				_mm_storeu_ps(s, vsum);
+				_mm_storeu_ps(sq, vsumsq);
+				sum += double(s[0]) + double(s[1]) + double(s[2]) + double(s[3]);
+				sumsq += double(sq[0]) + double(sq[1]) + double(sq[2]) + double(sq[3]);
+			}
+			float m[4], M[4];
+			_mm_storeu_ps(m, vmin);
+			_mm_storeu_ps(M, vmax);
+			for (int k = 0; k < 4; k++) {
+				min = m[k] < min ? m[k] : min;
+				max = M[k] > max ? M[k] : max;
+			}
+		}
+#endif
+		for (; j < n; j++) {
+			float v = p[j];
+			min = v < min ? v : min;
+			max = v > max ? v : max;
+			sum += v;
+			sumsq += double(v) * v;
+		}
+	}
+
+	/*!
+	\brief Affine transform of a row, v' = a*v+b
+	*/
+	inline void Affine(float* p, int n, float a, float b)
+	{
+		int j = 0;
+#ifdef FIELD_KERNELS_SSE2
+		__m128 va = _mm_set1_ps(a);
+		__m128 vb = _mm_set1_ps(b);
+		for (; j + 4 <= n; j += 4)
+			_mm_storeu_ps(p + j, _mm_add_ps(_mm_mul_ps(va, _mm_loadu_ps(p + j)), vb));
+#endif
+		for (; j < n; j++)
+			p[j] = a * p[j] + b;
+	}
+
+	/*!
+	\brief Normalize a row then apply an affine transform, v' = a*((v-min)/(max-min))+b
+	*/
+	inline void Normalize(float* p, int n, float min, float max, float a, float b)
+	{
+		int j = 0;
+		float range = max - min;
+#ifdef FIELD_KERNELS_SSE2
+		__m128 vmin = _mm_set1_ps(min);
+		__m128 vrange = _mm_set1_ps(range);
+		__m128 va = _mm_set1_ps(a);
+		__m128 vb = _mm_set1_ps(b);
+		for (; j + 4 <= n; j += 4) {
+			__m128 v = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(p + j), vmin), vrange);
+			_mm_storeu_ps(p + j, _mm_add_ps(_mm_mul_ps(va, v), vb));
+		}
+#endif
+		for (; j < n; j++)
+			p[j] = a * ((p[j] - min) / range) + b;
+	}
+
+	/*!
+	\brief Divergence of a row of a gradient field (forward differences), for the columns 1 <= j < n-1 of an interior row:
+	out[j] = scale * ((gx[j] - gx[j-1]) + (gy[j] - gyUp[j])), gyUp being the y component of the previous row.
+	*/
+	inline void Divergence(const float* gx, const float* gy, const float* gyUp, int n, float scale, float* out)
+	{
+		int j = 1;
+#ifdef FIELD_KERNELS_SSE2
+		__m128 vscale = _mm_set1_ps(scale);
+		for (; j + 4 <= n - 1; j += 4) {
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(gx + j), _mm_loadu_ps(gx + j - 1));
+			__m128 dy = _mm_sub_ps(_mm_loadu_ps(gy + j), _mm_loadu_ps(gyUp + j));
+			_mm_storeu_ps(out + j, _mm_mul_ps(vscale, _mm_add_ps(dx, dy)));
+		}
+#endif
+		for (; j < n - 1; j++)
+			out[j] = scale * ((gx[j] - gx[j - 1]) + (gy[j] - gyUp[j]));
+	}
+
+	/*!
+	\brief Scalar version of Statistics for any type.
+	*/
+	template<typename T>
+	inline void Statistics(const T* p, int n, T& min, T& max, double& sum, double& sumsq)
+	{
+		for (int j = 0; j < n; j++) {
+			T v = p[j];
+			min = v < min ? v : min;
+			max = v > max ? v : max;
+			sum += v;
+			sumsq += double(v) * v;
+		}
+	}
+
+	/*!
+	\brief Scalar version of Affine for any type.
+	*/
+	template<typename T>
+	inline void Affine(T* p, int n, T a, T b)
+	{
+		for (int j = 0; j < n; j++)
+			p[j] = a * p[j] + b;
+	}
+
+	/*!
+	\brief Scalar version of Normalize for any type.
+	*/
+	template<typename T>
+	inline void Normalize(T* p, int n, T min, T max, T a, T b)
+	{
+		T range = max - min;
+		for (int j = 0; j < n; j++)
+			p[j] = a * ((p[j] - min) / range) + b;
+	}
+}
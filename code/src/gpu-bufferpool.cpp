@@ -0,0 +1,120 @@
+#include "gpu-bufferpool.h"
+
+/*!
+\brief Returns the pool shared by all the solvers of the current OpenGL context.
+*/
+GPUBufferPool& GPUBufferPool::Instance()
+{
+  static GPUBufferPool pool;
+  return pool;
+}
+
+GPUBufferPool::GPUBufferPool() : allocations(0), allocatedBytes(0)
+{
+  // Empty
+}
+
+/*!
+\brief Get a buffer of the given size, reusing a released one if possible.
+\param bytes size of the buffer
+\param data optional data uploaded in the buffer, the content is undefined otherwise
+\param flags storage flags, data can only be given with GL_DYNAMIC_STORAGE_BIT
+*/
+GLuint GPUBufferPool::Acquire(GLsizeiptr bytes, const void* data, GLbitfield flags)
+{
+  std::vector<GLuint>& candidates = available[Key(flags, bytes)];
+  if (!candidates.empty()) {
+    GLuint buffer = candidates.back();
+    candidates.pop_back();
+    if (data != nullptr)
+      glNamedBufferSubData(buffer, 0, bytes, data);
+    return buffer;
+  }
+
+  // immutable storage: the size never changes, only the content is updated
+  GLuint buffer;
+  glCreateBuffers(1, &buffer);
+  glNamedBufferStorage(buffer, bytes, data, flags);
+  Storage storage = { bytes, flags, nullptr };
+  if (flags & GL_MAP_PERSISTENT_BIT)
+    storage.mapping = glMapNamedBufferRange(buffer, 0, bytes, flags & (GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT));
+  storages[buffer] = storage;
+  allocations++;
+  allocatedBytes += bytes;
+  return buffer;
+}
+
+/*!
+\brief Returns the persistent mapping of a buffer, nullptr if it was not allocated with GL_MAP_PERSISTENT_BIT.
+*/
+void* GPUBufferPool::Mapping(GLuint buffer) const
+{
+  std::map<GLuint, Storage>::const_iterator it = storages.find(buffer);
+  if (it == storages.end())
+    return nullptr;
+  return it->second.mapping;
+}
+
+/*!
+\brief Give a buffer back to the pool, it is not deleted.
+*/
+void GPUBufferPool::Release(GLuint buffer)
+{
+  std::map<GLuint, Storage>::const_iterator it = storages.find(buffer);
+  if (it == storages.end())
+    return;
+  available[Key(it->second.flags, it->second.bytes)].push_back(buffer);
+}
+
+/*!
+\brief Give an array of buffers back to the pool.
+*/
+void GPUBufferPool::Release(int n, const GLuint* buffers)
+{
+  for (int i = 0; i < n; i++)
+    Release(buffers[i]);
+}
+
+/*!
+\brief Delete the released buffers. Must be called while the OpenGL context is still alive.
+*/
+void GPUBufferPool::Clear()
+{
+  for (std::map<Key, std::vector<GLuint> >::iterator it = available.begin(); it != available.end(); ++it) {
+    if (it->second.empty())
+      continue;
+    glDeleteBuffers(GLsizei(it->second.size()), &(it->second[0])); // persistent mappings are released with the buffer
+    for (unsigned int i = 0; i < it->second.size(); i++) {
+      allocatedBytes -= storages[it->second[i]].bytes;
+      storages.erase(it->second[i]);
+    }
+  }
+  available.clear();
+}
+
+/*!
+\brief Number of buffers allocated by the driver since the start.
+*/
+int GPUBufferPool::Allocations() const
+{
+  return allocations;
+}
+
+/*!
+\brief Total size of the buffers owned by the pool, in use or not.
+*/
+size_t GPUBufferPool::AllocatedBytes() const
+{
+  return allocatedBytes;
+}
+
+/*!
+\brief Total size of the buffers waiting to be reused.
+*/
+size_t GPUBufferPool::AvailableBytes() const
+{
+  size_t bytes = 0;
+  for (std::map<Key, std::vector<GLuint> >::const_iterator it = available.begin(); it != available.end(); ++it)
+    bytes += it->first.second * it->second.size();
+  return bytes;
+}
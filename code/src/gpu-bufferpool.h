@@ -0,0 +1,40 @@
+#pragma once
+#include <GL/glew.h>
+#include <map>
+#include <vector>
+
+// GPUBufferPool. Recycles immutable shader storage buffers (glBufferStorage) between solver instances and levels.
+// Buffers are keyed by their size in bytes and storage flags: releasing a buffer puts it back in the pool instead of
+// deleting it, so that a batch of same-sized solves only allocates GPU memory once.
+// Persistent buffers (GL_MAP_PERSISTENT_BIT) are mapped once at allocation and stay mapped during their whole life.
+class GPUBufferPool {
+public:
+  static const GLbitfield STORAGE_DEFAULT = GL_DYNAMIC_STORAGE_BIT;
+  static const GLbitfield STORAGE_READBACK = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  static GPUBufferPool& Instance();
+
+  GLuint Acquire(GLsizeiptr bytes, const void* data = nullptr, GLbitfield flags = STORAGE_DEFAULT);
+  void* Mapping(GLuint buffer) const;
+  void Release(GLuint buffer);
+  void Release(int n, const GLuint* buffers);
+  void Clear();
+
+  int Allocations() const;
+  size_t AllocatedBytes() const;
+  size_t AvailableBytes() const;
+protected:
+  GPUBufferPool();
+
+  struct Storage {
+    GLsizeiptr bytes;
+    GLbitfield flags;
+    void* mapping;
+  };
+  typedef std::pair<GLbitfield, GLsizeiptr> Key;
+
+  std::map<Key, std::vector<GLuint> > available;         //!< Released buffers, per flags and size
+  std::map<GLuint, Storage> storages;                    //!< Storage of every buffer owned by the pool
+  int allocations;                                       //!< Number of glBufferStorage calls since the start
+  size_t allocatedBytes;                                 //!< Total size of the buffers owned by the pool
+};
@@ -0,0 +1,106 @@
+#include "gpu-readback.h"
+#include "gpu-bufferpool.h"
+#include <cstring>
+#include <stdexcept>
+
+/*!
+\brief Returns the queue shared by all the solvers of the current OpenGL context.
+*/
+GPUReadbackQueue& GPUReadbackQueue::Instance()
+{
+  static GPUReadbackQueue queue;
+  return queue;
+}
+
+/*!
+\brief Start the download of a buffer of nx * ny floats.
+\param buffer source buffer, it can be modified as soon as this function returns
+\param nx size in x axis
+\param ny size in y axis
+*/
+std::future<ScalarField2D> GPUReadbackQueue::Enqueue(GLuint buffer, int nx, int ny)
+{
+  GLsizeiptr bytes = GLsizeiptr(nx) * ny * sizeof(float);
+  pending.push_back(Readback());
+  Readback& readback = pending.back();
+  readback.nx = nx;
+  readback.ny = ny;
+  readback.staging = GPUBufferPool::Instance().Acquire(bytes, nullptr, GPUBufferPool::STORAGE_READBACK);
+
+  // the copy is ordered after the previous commands, no need to wait for them
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  glCopyNamedBufferSubData(buffer, readback.staging, 0, 0, bytes);
+  readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush(); // make sure the fence will be signaled without any other GL call
+
+  return readback.promise.get_future();
+}
+
+/*!
+\brief Fulfill the futures of the readbacks that have been completed by the GPU. A readback whose fence cannot be
+waited for, or is still not signaled after 10 blocking waits of 1 s, fails: its future throws a runtime_error.
+\param wait if true, block until at most keep readbacks are still pending
+\param keep number of the most recent readbacks that are not waited for
+\return the number of completed readbacks
+*/
+int GPUReadbackQueue::Poll(bool wait, int keep)
+{
+  const int TIMEOUTS = 10; // blocking waits of 1 s before a readback is given up (lost context)
+  GPUBufferPool& pool = GPUBufferPool::Instance();
+  int completed = 0;
+  int timeouts = 0;
+  // fences are signaled in order, stop at the first one that is not
+  while (!pending.empty()) {
+    Readback& readback = pending.front();
+    bool block = wait && int(pending.size()) > keep;
+    GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, block ? GLuint64(1000000000) : 0);
+    if (status == GL_TIMEOUT_EXPIRED && block && ++timeouts < TIMEOUTS)
+      continue;
+    if (status == GL_WAIT_FAILED || (status == GL_TIMEOUT_EXPIRED && block)) {
+      // the future fails instead of blocking its reader forever
+      glDeleteSync(readback.fence);
+      pool.Release(readback.staging);
+      readback.promise.set_exception(std::make_exception_ptr(std::runtime_error(status == GL_WAIT_FAILED ?
+        "readback failed, the fence cannot be waited for" : "readback failed, the fence is not signaled")));
+      pending.pop_front();
+      timeouts = 0;
+      continue;
+    }
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      break;
+    glDeleteSync(readback.fence);
+    timeouts = 0;
+
+    // coherent mapping: the data is visible as soon as the fence is signaled
+    ScalarField2D field(readback.nx, readback.ny);
+    memcpy(&field[0], pool.Mapping(readback.staging), size_t(readback.nx) * readback.ny * sizeof(float));
+    pool.Release(readback.staging);
+    readback.promise.set_value(std::move(field));
+    pending.pop_front();
+    completed++;
+  }
+  return completed;
+}
+
+/*!
+\brief Number of readbacks not yet completed.
+*/
+int GPUReadbackQueue::Pending() const
+{
+  return int(pending.size());
+}
+
+/*!
+\brief Wait for the field of a readback.
+\return the field, empty if the readback has failed
+*/
+ScalarField2D GPUReadbackQueue::Result(std::future<ScalarField2D>& result)
+{
+  try {
+    return result.get();
+  }
+  catch (const std::runtime_error& error) {
+    std::cerr << "[error] " << error.what() << std::endl;
+    return ScalarField2D();
+  }
+}
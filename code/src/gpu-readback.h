@@ -0,0 +1,29 @@
+#pragma once
+#include <GL/glew.h>
+#include <future>
+#include <list>
+#include "basics.h"
+
+// GPUReadbackQueue. Asynchronous download of GPU buffers into scalar fields.
+// The buffer is copied into a persistently mapped staging buffer and a fence is inserted, the CPU is not stalled.
+// Fences can only be tested by the thread owning the OpenGL context: Poll must be called regularly by this thread,
+// other threads may wait on the returned futures. A failed readback (lost context) makes its future throw, Result
+// reports it and gives an empty field instead.
+class GPUReadbackQueue {
+public:
+  static GPUReadbackQueue& Instance();
+
+  std::future<ScalarField2D> Enqueue(GLuint buffer, int nx, int ny);
+  int Poll(bool wait = false, int keep = 0);
+  int Pending() const;
+  static ScalarField2D Result(std::future<ScalarField2D>& result);
+protected:
+  struct Readback {
+    GLsync fence;                          //!< Signaled when the copy into the staging buffer is done
+    GLuint staging;                        //!< Persistently mapped buffer, from the pool
+    int nx, ny;                            //!< Size of the field
+    std::promise<ScalarField2D> promise;   //!< Fulfilled by Poll
+  };
+
+  std::list<Readback> pending;             //!< Readbacks in submission order
+};
@@ -207,6 +207,18 @@ GLuint read_program(const char* filename, const char* definitions)
   return program;
 }
 
+// largest number of work groups along x of a dispatch, at least 65535, queried once
+int max_work_group_count()
+{
+  static int count = 0;
+  if (count == 0)
+  {
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &count);
+    count = std::max(count, 65535);
+  }
+  return count;
+}
+
 int release_program(const GLuint program)
 {
   if (program == 0)
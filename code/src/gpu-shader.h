@@ -10,5 +10,6 @@ int release_program(const GLuint program);
 int reload_program(const GLuint program, const char* filename, const char* definitions = "");
 int program_format_errors(const GLuint program, std::string& errors);
 int program_print_errors(const GLuint program);
+int max_work_group_count();
 
 #endif // !_SHADER_UTILS:_
@@ -0,0 +1,136 @@
+#include "gradient.h"
+#include "parallel.h"
+#include <cstring>
+
+using namespace std;
+
+/*!
+\brief Gradient of a heightfield, forward differences.
+*/
+GradientField2D::GradientField2D(const ConstScalarField2DView& heightfield)
+  : x(heightfield.SizeX(), heightfield.SizeY()), y(heightfield.SizeX(), heightfield.SizeY())
+{
+  int nx = heightfield.SizeX(), ny = heightfield.SizeY();
+  ParallelFor(0, ny, heightfield.RowGrain(), [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      for (int j = 0; j < nx; j++) {
+        float h = heightfield.Get(i, j);
+        x.Set(i, j, j < nx - 1 ? heightfield.Get(i, j + 1) - h : 0.0f);
+        y.Set(i, j, i < ny - 1 ? heightfield.Get(i + 1, j) - h : 0.0f);
+      }
+    }
+  });
+}
+
+// Byte swap of the values read from a big-endian file
+static void SwapBytes(float* values, size_t n)
+{
+  for (size_t k = 0; k < n; k++) {
+    unsigned char* b = reinterpret_cast<unsigned char*>(&values[k]);
+    swap(b[0], b[3]);
+    swap(b[1], b[2]);
+  }
+}
+
+static bool LittleEndian()
+{
+  unsigned int one = 1;
+  unsigned char first;
+  memcpy(&first, &one, 1);
+  return first == 1;
+}
+
+/*!
+\brief Read a gradient field from a color PFM file (PF), the third channel is ignored.
+\return false if the file cannot be read, or if it is a greyscale one (Pf), which has no y component
+*/
+bool GradientField2D::LoadPFM(const string& filename)
+{
+  ifstream file(filename, ios::binary);
+  if (!file.is_open())
+    return false;
+  string magic;
+  int nx = 0, ny = 0;
+  float scale = 0.0f;
+  file >> magic >> nx >> ny >> scale;
+  if (magic != "PF" || nx <= 0 || ny <= 0 || scale == 0.0f)
+    return false;
+  file.get(); // single whitespace before the data
+
+  vector<float> row(size_t(nx) * 3);
+  x = ScalarField2D(nx, ny);
+  y = ScalarField2D(nx, ny);
+  for (int k = 0; k < ny; k++) {
+    if (!file.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float)))
+      return false;
+    if ((scale < 0.0f) != LittleEndian())
+      SwapBytes(row.data(), row.size());
+    int i = ny - 1 - k; // bottom to top
+    for (int j = 0; j < nx; j++) {
+      x.Set(i, j, row[3 * j]);
+      y.Set(i, j, row[3 * j + 1]);
+    }
+  }
+  return true;
+}
+
+/*!
+\brief Save the gradient field in a PFM file, in the byte order of the machine.
+*/
+bool GradientField2D::SavePFM(const string& filename) const
+{
+  ofstream file(filename, ios::binary);
+  if (!file.is_open())
+    return false;
+  int nx = SizeX(), ny = SizeY();
+  file << "PF\n" << nx << " " << ny << "\n" << (LittleEndian() ? "-1.0" : "1.0") << "\n";
+  vector<float> row(size_t(nx) * 3, 0.0f);
+  for (int k = 0; k < ny; k++) {
+    int i = ny - 1 - k;
+    for (int j = 0; j < nx; j++) {
+      row[3 * j] = x.Get(i, j);
+      row[3 * j + 1] = y.Get(i, j);
+    }
+    file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+  }
+  return bool(file);
+}
+
+/*!
+\brief Laplacian input of the solver: divergence of the gradient divided by the number of neighbours of each cell,
+in one parallel pass. The interior of the rows is vectorized (FieldKernels::Divergence).
+\param scale factor applied to the result
+*/
+ScalarField2D GradientField2D::Laplacian(float scale) const
+{
+  int nx = SizeX(), ny = SizeY();
+  ScalarField2D laplacian(nx, ny);
+  const float* gx = x.View().Data();
+  const float* gy = y.View().Data();
+  float* out = &laplacian[0];
+  // any cell, only the neighbours that exist
+  auto cell = [&](int i, int j) {
+    size_t idx = size_t(i) * nx + j;
+    int cpt = 0;
+    float dx = 0.0f, dy = 0.0f;
+    if (j < nx - 1) { dx += gx[idx]; cpt++; }
+    if (j > 0) { dx -= gx[idx - 1]; cpt++; }
+    if (i < ny - 1) { dy += gy[idx]; cpt++; }
+    if (i > 0) { dy -= gy[idx - nx]; cpt++; }
+    out[idx] = cpt > 0 ? (scale / float(cpt)) * (dx + dy) : 0.0f;
+  };
+  ParallelFor(0, ny, max(1, 65536 / max(1, nx)), [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      if (i == 0 || i == ny - 1 || nx < 3) {
+        for (int j = 0; j < nx; j++)
+          cell(i, j);
+        continue;
+      }
+      size_t row = size_t(i) * nx;
+      FieldKernels::Divergence(gx + row, gy + row, gy + row - nx, nx, scale * 0.25f, out + row);
+      cell(i, 0);
+      cell(i, nx - 1);
+    }
+  });
+  return laplacian;
+}
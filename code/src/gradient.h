@@ -0,0 +1,24 @@
+#pragma once
+#include "basics.h"
+#include <string>
+
+// GradientField2D. Gradient of a heightfield h on a grid (nx * ny), as two float channels: x along the columns, y along
+// the rows, forward differences x(i, j) = h(i, j+1) - h(i, j) and y(i, j) = h(i+1, j) - h(i, j), 0 past the last
+// column (row). Laplacian is the input of the solver computed from it: the sum of the differences with the existing
+// neighbours divided by their number, the same stencil as the smoother, so that the divergence of the gradient of a
+// heightfield gives back the heightfield where it is free.
+// Files are PFM (three float channels, x, y and an ignored one), rows stored bottom to top as the format requires.
+struct GradientField2D {
+  ScalarField2D x;                //!< Derivative along the columns
+  ScalarField2D y;                //!< Derivative along the rows
+
+  GradientField2D() {}
+  explicit GradientField2D(const ConstScalarField2DView& heightfield);
+
+  inline int SizeX() const { return x.SizeX(); }
+  inline int SizeY() const { return x.SizeY(); }
+
+  bool LoadPFM(const std::string& filename);
+  bool SavePFM(const std::string& filename) const;
+  ScalarField2D Laplacian(float scale = 1.0f) const;
+};
@@ -0,0 +1,85 @@
+#include "layout.h"
+#include "parallel.h"
+
+namespace Layout
+{
+  /*!
+  \brief Name of a layout, as given on the command line.
+  */
+  const char* Name(Order order)
+  {
+    switch (order) {
+    case TILED: return "tiled";
+    case MORTON: return "morton";
+    default: return "row";
+    }
+  }
+
+  /*!
+  \brief Layout from its name, returns false if the name is unknown.
+  */
+  bool Parse(const std::string& name, Order& order)
+  {
+    for (int o = ROW_MAJOR; o <= MORTON; o++) {
+      if (name == Name(Order(o))) {
+        order = Order(o);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /*!
+  \brief Definitions selecting the layout in the compute shaders.
+  */
+  std::string Definitions(Order order)
+  {
+    std::string definitions = "#define LAYOUT_TILE_BITS " + std::to_string(TILE_BITS) + "\n";
+    if (order == TILED)
+      definitions += "#define LAYOUT_TILED\n";
+    else if (order == MORTON)
+      definitions += "#define LAYOUT_MORTON\n";
+    return definitions;
+  }
+
+  /*!
+  \brief Copy a square row-major field in a given layout, the padding is set to 0.
+  */
+  ScalarField2D ToLayout(Order order, const ConstScalarField2DView& field)
+  {
+    int s = field.SizeX();
+    int padded = Padded(order, s);
+    ScalarField2D stored(padded, padded);
+    float* v = &stored[0];
+    Dispatch(order, s, [&](auto layout) {
+      ParallelFor(0, s, field.RowGrain(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+          for (int j = 0; j < s; j++)
+            v[layout.Index(i, j)] = field.Get(i, j);
+      });
+    });
+    return stored;
+  }
+
+  /*!
+  \brief Row-major copy of a level of size s stored in a given layout.
+  */
+  template<typename T>
+  ScalarField2DT<T> FromLayout(Order order, const ScalarField2DT<T>& stored, int s)
+  {
+    ScalarField2DT<T> field(s, s);
+    const T* v = stored.View().Data();
+    T* f = &field[0];
+    Dispatch(order, s, [&](auto layout) {
+      ParallelFor(0, s, std::max(1, 65536 / s), [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+          for (int j = 0; j < s; j++)
+            f[i * s + j] = v[layout.Index(i, j)];
+      });
+    });
+    return field;
+  }
+
+  template ScalarField2D FromLayout(Order order, const ScalarField2D& stored, int s);
+  template ScalarField2DD FromLayout(Order order, const ScalarField2DD& stored, int s);
+}
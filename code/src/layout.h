@@ -0,0 +1,143 @@
+#pragma once
+#include <string>
+#include "basics.h"
+
+// Memory layouts of the square levels of the solver. A level of size s is stored in a padded square of Padded(s)^2
+// floats, cell (i, j) at Index(i, j):
+// - RowMajor : i * s + j, the layout of ScalarField2D
+// - Tiled : tiles of TILE x TILE cells stored one after the other, row-major inside a tile
+// - Morton : same tiles, Z-order (Morton) inside a tile. A global Morton order would pad 2^n+1 grids to 2^(n+1).
+// Vertical neighbours are a row apart in row-major order, 16 floats apart inside a tile.
+// The kernels are templated by the layout, Layout::Dispatch calls them with the layout selected at run time.
+// Same indexing as LayoutOffset in mgstepfloat.glsl and mgprolongfloat.glsl.
+namespace Layout
+{
+  enum Order {
+    ROW_MAJOR,
+    TILED,
+    MORTON
+  };
+
+  static const int TILE_BITS = 4;
+  static const int TILE = 1 << TILE_BITS;
+
+  struct RowMajor {
+    int s;
+    explicit RowMajor(int s) : s(s) {}
+    inline int Index(int i, int j) const { return i * s + j; }
+    inline void Cell(int idx, int& i, int& j) const { i = idx / s; j = idx - i * s; }
+    // Neighbours of the cell stored at idx, they must exist
+    inline int Up(int idx) const { return idx - s; }
+    inline int Down(int idx) const { return idx + s; }
+    inline int Left(int idx) const { return idx - 1; }
+    inline int Right(int idx) const { return idx + 1; }
+  };
+
+  // Rows [row0, ...) of a level only, row-major: the strips of DomainDecomposition
+  struct Strip {
+    int s, row0;
+    Strip(int s, int row0) : s(s), row0(row0) {}
+    inline int Index(int i, int j) const { return (i - row0) * s + j; }
+    inline void Cell(int idx, int& i, int& j) const { i = idx / s; j = idx - i * s; i += row0; }
+    inline int Up(int idx) const { return idx - s; }
+    inline int Down(int idx) const { return idx + s; }
+    inline int Left(int idx) const { return idx - 1; }
+    inline int Right(int idx) const { return idx + 1; }
+  };
+
+  struct Tiled {
+    int tiles;                         //!< Number of tiles per row
+    explicit Tiled(int s) : tiles((s + TILE - 1) / TILE) {}
+    inline int Index(int i, int j) const {
+      int tile = (i >> TILE_BITS) * tiles + (j >> TILE_BITS);
+      return (tile << (2 * TILE_BITS)) + ((i & (TILE - 1)) << TILE_BITS) + (j & (TILE - 1));
+    }
+    inline void Cell(int idx, int& i, int& j) const {
+      int tile = idx >> (2 * TILE_BITS);
+      int ti = tile / tiles;
+      i = (ti << TILE_BITS) + ((idx >> TILE_BITS) & (TILE - 1));
+      j = ((tile - ti * tiles) << TILE_BITS) + (idx & (TILE - 1));
+    }
+    // Neighbours inside the tile are at a constant offset, across a tile border in the same row (column) of the next tile
+    inline int Up(int idx) const { return (idx & ROW) != 0 ? idx - TILE : idx - (tiles << (2 * TILE_BITS)) + ROW; }
+    inline int Down(int idx) const { return (idx & ROW) != ROW ? idx + TILE : idx + (tiles << (2 * TILE_BITS)) - ROW; }
+    inline int Left(int idx) const { return (idx & COLUMN) != 0 ? idx - 1 : idx - TILE * TILE + COLUMN; }
+    inline int Right(int idx) const { return (idx & COLUMN) != COLUMN ? idx + 1 : idx + TILE * TILE - COLUMN; }
+    static const int ROW = (TILE - 1) << TILE_BITS;      //!< Bits of the row inside a tile
+    static const int COLUMN = TILE - 1;                  //!< Bits of the column inside a tile
+  };
+
+  struct Morton {
+    int tiles;                         //!< Number of tiles per row
+    explicit Morton(int s) : tiles((s + TILE - 1) / TILE) {}
+    // Spread the 4 bits of x on the even bits
+    static inline int Spread(int x) {
+      x = (x | (x << 2)) & 0x33;
+      return (x | (x << 1)) & 0x55;
+    }
+    inline int Index(int i, int j) const {
+      int tile = (i >> TILE_BITS) * tiles + (j >> TILE_BITS);
+      return (tile << (2 * TILE_BITS)) + (Spread(i & (TILE - 1)) << 1) + Spread(j & (TILE - 1));
+    }
+    // Inverse of Spread
+    static inline int Compact(int x) {
+      x &= 0x55;
+      x = (x | (x >> 1)) & 0x33;
+      return (x | (x >> 2)) & 0x0f;
+    }
+    inline void Cell(int idx, int& i, int& j) const {
+      int tile = idx >> (2 * TILE_BITS);
+      int ti = tile / tiles;
+      i = (ti << TILE_BITS) + Compact(idx >> 1);
+      j = ((tile - ti * tiles) << TILE_BITS) + Compact(idx);
+    }
+    // Neighbours: increment or decrement of the interleaved row (odd bits) or column (even bits) of the tile,
+    // the other bits are kept. Across a tile border, the row (column) wraps around in the next tile.
+    inline int Up(int idx) const {
+      int row = idx & ROW;
+      return row != 0 ? (idx & ~ROW) | ((row - 1) & ROW) : idx - (tiles << (2 * TILE_BITS)) + ROW;
+    }
+    inline int Down(int idx) const {
+      int row = idx & ROW;
+      return row != ROW ? (idx & ~ROW) | (((row | COLUMN) + 1) & ROW) : idx + (tiles << (2 * TILE_BITS)) - ROW;
+    }
+    inline int Left(int idx) const {
+      int column = idx & COLUMN;
+      return column != 0 ? (idx & ~COLUMN) | ((column - 1) & COLUMN) : idx - TILE * TILE + COLUMN;
+    }
+    inline int Right(int idx) const {
+      int column = idx & COLUMN;
+      return column != COLUMN ? (idx & ~COLUMN) | (((column | ROW) + 1) & COLUMN) : idx + TILE * TILE - COLUMN;
+    }
+    static const int ROW = 0xaa;                         //!< Bits of the row inside a tile
+    static const int COLUMN = 0x55;                      //!< Bits of the column inside a tile
+  };
+
+  /*!
+  \brief Call f with the index function of a layout for a level of size s.
+  */
+  template<typename F>
+  inline void Dispatch(Order order, int s, F f)
+  {
+    switch (order) {
+    case TILED: f(Tiled(s)); break;
+    case MORTON: f(Morton(s)); break;
+    default: f(RowMajor(s)); break;
+    }
+  }
+
+  /*!
+  \brief Size of the padded square storing a level of size s.
+  */
+  inline int Padded(Order order, int s)
+  {
+    return order == ROW_MAJOR ? s : ((s + TILE - 1) / TILE) * TILE;
+  }
+
+  const char* Name(Order order);
+  bool Parse(const std::string& name, Order& order);
+  std::string Definitions(Order order);
+  ScalarField2D ToLayout(Order order, const ConstScalarField2DView& field);
+  template<typename T>
+  ScalarField2DT<T> FromLayout(Order order, const ScalarField2DT<T>& stored, int s);
+}
@@ -1,55 +1,347 @@
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
 #include "diffusionterrain.h"
+#include "gpu-bufferpool.h"
+#include "batch.h"
+#include "benchmark.h"
+#include "system-info.h"
+#include "parallel.h"
 
 
-int main(void) {
+static void Usage()
+{
+	std::cout << "usage: main [--cpu | --backend b] [--layout l] [--storage s] [--hybrid h] [--quantize] [--gradient g.pfm] [--progressive ms]  solve the example scene (../data/004_*.pgm)" << std::endl;
+	std::cout << "       main --batch manifest [--cpu | --backend b] [--interleave] [--layout l] [--storage s] [--hybrid h] [--quantize] [--loaders n] [--writers n] [--queue n]" << std::endl;
+	std::cout << "       main --bench-stencil [size] [--cpu]  generic vs specialized stencil kernels (default size 1025)" << std::endl;
+	std::cout << "       main --bench-layout [size] [--cpu]   memory layouts of the solver (default size 1025)" << std::endl;
+	std::cout << "       main --bench-storage [size]          GL solution levels in buffers vs textures (default size 1025)" << std::endl;
+	std::cout << "       main --bench-quantize [size] [--cpu] error of the 16-bit constraints (default size 1025)" << std::endl;
+	std::cout << "       main --bench-refine [size] [--cpu]   float vs double solver and mixed-precision refinement (default size 1025)" << std::endl;
+	std::cout << "       main --bench-interleave [size]       batch of CPU solves, one per scene vs interleaved (default size 257)" << std::endl;
+	std::cout << "       main --bench-atlas [size]            batch of 64 GL solves of mixed sizes, one per scene vs atlas (default size 65)" << std::endl;
+	std::cout << "       main --bench-region [size]           CPU solve of the whole scene vs of a region of 1/8 of its size (default size 1025)" << std::endl;
+	std::cout << "       main --bench-stream [size]           CPU tiles of an unbounded world around a moving camera (default size 129)" << std::endl;
+	std::cout << "       main --bench-domain [size]           CPU solve by one process vs domain decomposition on several (default size 1025)" << std::endl;
+	std::cout << "options of all the modes: [--threads n] [--affinity]" << std::endl;
+	std::cout << "--threads: threads of the CPU stages (default: all the cores), shared by all the stages and nested loops" << std::endl;
+	std::cout << "--affinity: each worker thread of the CPU stages pinned to a core (Linux)" << std::endl;
+	std::cout << "--quantize: constraints quantized on 16 bits per level, computations stay in float" << std::endl;
+	std::cout << "--interleave: batch on the CPU, up to 8 scenes of the same size solved at once, vectorized across the scenes;" << std::endl;
+	std::cout << "              on the GL backend, groups of small scenes of any size packed in atlases, one dispatch per sweep" << std::endl;
+	std::cout << "layout: row (default), tiled, morton, or auto to measure the fastest one for the backend at startup" << std::endl;
+	std::cout << "storage: buffers, images (row layout only), or auto (default) to measure the fastest one at startup" << std::endl;
+	std::cout << "backend: auto (default) for the fastest one for the size of each scene according to the cost model calibrated" << std::endl;
+	std::cout << "         on this machine (measured the first time, stored in calibration.txt), gl, or cpu (same as --cpu)" << std::endl;
+	std::cout << "hybrid: GL backend, levels smaller than a size solved on the CPU: auto (default) for the size calibrated on this" << std::endl;
+	std::cout << "        machine (measured the first time, stored in calibration.txt), measure to calibrate again, off, or a size" << std::endl;
+	std::cout << "--progressive: anytime solve of the example scene, the levels reached within a time budget (milliseconds) are" << std::endl;
+	std::cout << "               saved as previews (../results/preview_<level>.pgm), then the solve resumes to level 0" << std::endl;
+	std::cout << "--gradient: gradient field (PFM, x and y channels) replacing the Laplacian map, its divergence is computed at load" << std::endl;
+	std::cout << "manifest: one scene per line, mask altitude laplacian output [laplacian_offset laplacian_scale], laplacian can be a .pfm gradient" << std::endl;
+}
 
-	// initialization of glfw, glfw and the OpenGL context
-	if (!glfwInit())
+int main(int argc, char** argv) {
+
+	// command line
+	std::string manifest;
+	std::string gradient;
+	int benchmarkSize = 0;
+	bool benchmarkLayout = false;
+	bool autoLayout = false;
+	bool benchmarkStorage = false;
+	bool autoStorage = true;
+	bool autoHybrid = true;
+	bool measureHybrid = false;
+	bool autoBackend = true;
+	bool benchmarkPrecision = false;
+	bool benchmarkRefinement = false;
+	bool benchmarkInterleave = false;
+	bool benchmarkAtlas = false;
+	bool benchmarkRegion = false;
+	bool benchmarkStream = false;
+	bool benchmarkDomain = false;
+	int progressive = 0;
+	BatchOptions options;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--cpu") == 0) {
+			options.gpu = false;
+			autoBackend = false;
+		}
+		else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+			std::string name = argv[++i];
+			autoBackend = name == "auto";
+			options.gpu = name != "cpu";
+			if (!autoBackend && name != "gl" && name != "cpu") {
+				Usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+			manifest = argv[++i];
+		else if (strcmp(argv[i], "--gradient") == 0 && i + 1 < argc)
+			gradient = argv[++i];
+		else if (strcmp(argv[i], "--progressive") == 0 && i + 1 < argc)
+			progressive = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--bench-stencil") == 0) {
+			benchmarkSize = 1025;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-layout") == 0) {
+			benchmarkLayout = true;
+			benchmarkSize = 1025;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-storage") == 0) {
+			benchmarkStorage = true;
+			benchmarkSize = 1025;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-quantize") == 0) {
+			benchmarkPrecision = true;
+			benchmarkSize = 1025;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-refine") == 0) {
+			benchmarkRefinement = true;
+			benchmarkSize = 1025;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-interleave") == 0) {
+			benchmarkInterleave = true;
+			benchmarkSize = 257;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-atlas") == 0) {
+			benchmarkAtlas = true;
+			benchmarkSize = 65;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-region") == 0) {
+			benchmarkRegion = true;
+			benchmarkSize = 1025;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-stream") == 0) {
+			benchmarkStream = true;
+			benchmarkSize = 129;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--bench-domain") == 0) {
+			benchmarkDomain = true;
+			benchmarkSize = 1025;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				benchmarkSize = std::max(3, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--quantize") == 0)
+			options.quantizeConstraints = true;
+		else if (strcmp(argv[i], "--interleave") == 0)
+			options.interleave = true;
+		else if (strcmp(argv[i], "--storage") == 0 && i + 1 < argc) {
+			std::string name = argv[++i];
+			autoStorage = name == "auto";
+			if (name == "images")
+				options.storage = SimpleGeometricMultigridFloat::IMAGES;
+			else if (name != "buffers" && !autoStorage) {
+				Usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--hybrid") == 0 && i + 1 < argc) {
+			std::string name = argv[++i];
+			autoHybrid = name == "auto" || name == "measure";
+			measureHybrid = name == "measure";
+			if (name == "off")
+				options.hybridSize = 0;
+			else if (!autoHybrid) {
+				options.hybridSize = atoi(name.c_str());
+				if (options.hybridSize <= 0) {
+					Usage();
+					return 1;
+				}
+			}
+		}
+		else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+			std::string name = argv[++i];
+			autoLayout = name == "auto";
+			if (!autoLayout && !Layout::Parse(name, options.layout)) {
+				Usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			SetThreadCount(std::max(1, atoi(argv[++i])));
+		else if (strcmp(argv[i], "--affinity") == 0)
+			SetThreadAffinity(true);
+		else if (strcmp(argv[i], "--loaders") == 0 && i + 1 < argc)
+			options.loaders = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--writers") == 0 && i + 1 < argc)
+			options.writers = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc)
+			options.queueSize = std::max(1, atoi(argv[++i]));
+		else {
+			Usage();
+			return 1;
+		}
+	}
+
+	GLFWwindow* window = nullptr;
+	// initialization of glfw, glfw and the OpenGL context, the automatic backend falls back to the CPU without them
+	if (options.gpu && !glfwInit())
 	{
 		std::cout << "GLFW failed to initialize" << std::endl;
-		return 1;
-	}
-
-	// a window is necessary to obtain a context, even invisible
-	glfwDefaultWindowHints();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-	GLFWwindow* window = glfwCreateWindow(10,10, "Invisible", NULL, NULL);
-	
-	glfwMakeContextCurrent(window);
-
-	glewInit();
-	
-	GLenum err = glGetError();
-	if (err != GL_NO_ERROR)
-	{
-		std::cout << "GLEW: failed to initialize OpenGL : " << err << std::endl;
+		if (!autoBackend)
+			return 1;
+		options.gpu = false;
+	}
+	if (options.gpu) {
+		// a window is necessary to obtain a context, even invisible
+		glfwDefaultWindowHints();
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(10,10, "Invisible", NULL, NULL);
+
+		glfwMakeContextCurrent(window);
+
+		glewInit();
+
+		GLenum err = glGetError();
+		if (err != GL_NO_ERROR || window == nullptr)
+		{
+			std::cout << "GLEW: failed to initialize OpenGL : " << err << std::endl;
+			glfwTerminate();
+			if (!autoBackend)
+				return 1;
+			options.gpu = false;
+		}
+	}
+	if (autoBackend && !options.gpu)
+		std::cout << "Backend: cpu, no OpenGL context" << std::endl;
+
+	if (autoLayout) {
+		options.layout = BestLayout(513, options.gpu);
+		std::cout << "Layout: " << Layout::Name(options.layout) << std::endl;
+	}
+	if (autoStorage && options.gpu && options.layout == Layout::ROW_MAJOR && benchmarkSize == 0) {
+		options.storage = BestStorage(257);
+		std::cout << "Storage: " << (options.storage == SimpleGeometricMultigridFloat::IMAGES ? "images" : "buffers") << std::endl;
+	}
+	if (autoHybrid && options.gpu && benchmarkSize == 0) {
+		options.hybridSize = SimpleGeometricMultigridFloat::CalibrateHybridSize(measureHybrid);
+		std::cout << "Hybrid: levels smaller than " << options.hybridSize << " on the CPU" << std::endl;
+	}
+	options.autoBackend = autoBackend && options.gpu && benchmarkSize == 0;
+
+	int status = 0;
+	if (benchmarkDomain) {
+		status = RunDomainBenchmark(benchmarkSize);
+	}
+	else if (benchmarkStream) {
+		status = RunStreamBenchmark(benchmarkSize);
+	}
+	else if (benchmarkRegion) {
+		status = RunRegionBenchmark(benchmarkSize);
+	}
+	else if (benchmarkAtlas) {
+		status = options.gpu ? RunAtlasBenchmark(64, benchmarkSize) : 0;
+	}
+	else if (benchmarkInterleave) {
+		status = RunInterleaveBenchmark(benchmarkSize);
+	}
+	else if (benchmarkRefinement) {
+		status = RunRefinementBenchmark(benchmarkSize, options.gpu);
+	}
+	else if (benchmarkPrecision) {
+		status = RunPrecisionBenchmark(benchmarkSize, options.gpu);
+	}
+	else if (benchmarkStorage) {
+		status = options.gpu ? RunStorageBenchmark(benchmarkSize) : 0;
+	}
+	else if (benchmarkLayout) {
+		status = RunLayoutBenchmark(benchmarkSize, options.gpu);
+	}
+	else if (benchmarkSize > 0) {
+		status = RunStencilBenchmark(benchmarkSize, options.gpu);
+	}
+	else if (!manifest.empty()) {
+		// batch mode: pipelined load, solve and save
+		std::vector<Scene> scenes = ReadManifest(manifest);
+		RunBatch(scenes, options);
+	}
+	else {
+		// load the different maps
+		Scene scene;
+		scene.mask = "../data/004_mask.pgm";
+		scene.altitude = "../data/004_alt.pgm";
+		scene.laplacian = "../data/004_lap.pgm"; // this contains the Laplacian, that can be calculated from the divergence of the gradient field
+		if (!gradient.empty())
+			scene.laplacian = gradient; // ... which is done at load for a gradient file
+		scene.Load();
+		if (scene.laplacianField.SizeX() == 0) {
+			std::cerr << "[error] cannot read " << scene.laplacian << std::endl;
+			return 1;
+		}
+
+		// solve and export
+		SimpleGeometricMultigridFloat diffusion(std::move(scene.alphaField), std::move(scene.altitudeField), std::move(scene.laplacianField), options.layout);
+		diffusion.quantizeConstraints = options.quantizeConstraints;
+		diffusion.hybridSize = options.hybridSize;
+		// initialize the opengl shaders, unless the cost model predicts a faster solve on the CPU
+		bool gl = options.gpu;
+		if (options.autoBackend) {
+			int size = diffusion.nx;
+			gl = SimpleGeometricMultigridFloat::SelectBackend(size, options.hybridSize) == SimpleGeometricMultigridFloat::GL;
+			std::cout << "Backend: " << (gl ? "gl" : "cpu") << " (predicted "
+				<< SimpleGeometricMultigridFloat::PredictSolve(size, SimpleGeometricMultigridFloat::GL, options.hybridSize) << " s on gl, "
+				<< SimpleGeometricMultigridFloat::PredictSolve(size, SimpleGeometricMultigridFloat::CPU) << " s on cpu)" << std::endl;
+		}
+		if (gl)
+			diffusion.InitGL(options.storage);
+		else
+			diffusion.InitCPU();
+		// execute the solver
+		if (progressive > 0) {
+			// anytime solve: a preview of each level reached within the budget, then the refinement resumes where it stopped
+			typedef std::chrono::steady_clock Clock;
+			auto preview = [](int level, const ScalarField2D& field) {
+				field.SavePGM("../results/preview_" + std::to_string(level) + ".pgm");
+			};
+			Clock::time_point start = Clock::now();
+			bool done = diffusion.SolveProgressive(start + std::chrono::milliseconds(progressive), diffusion.nx, preview);
+			std::cout << "Progressive: level " << diffusion.SolvedLevel() << " of " << diffusion.mgsize << " in "
+				<< std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms" << std::endl;
+			if (!done)
+				diffusion.SolveProgressive(Clock::time_point::max());
+		}
+		else
+			diffusion.Solve();
+		// get the result and export it
+		ScalarField2D result = diffusion.GetResult();
+		result.SavePGM("../results/result.pgm");
+		std::cout << "Field copies: " << ScalarField2D::Copies() << std::endl;
+	}
+
+	std::cout << "Peak memory: " << PeakResidentMemory() / (1024 * 1024) << " MB" << std::endl;
+
+	if (options.gpu) {
+		// the solvers have given their buffers back to the pool, they must be deleted while the context is alive
+		GPUBufferPool& pool = GPUBufferPool::Instance();
+		std::cout << "GPU buffer pool: " << pool.Allocations() << " allocations, " << pool.AllocatedBytes() << " bytes" << std::endl;
+		pool.Clear();
 		glfwTerminate();
-		return 1;
-	}
-
-	// load the different maps
-	ScalarField2D alpha("../data/004_mask.pgm"); // locations of fixed constraints (Dirichlet) /!\ 0 = fixed constraint, 1 = laplacian
-	alpha.NormalizeField();
-	ScalarField2D altitudes("../data/004_alt.pgm"); // values of fixed constraints (Dirichlet) where alpha = 0 (ignored on other locations)
-	altitudes.NormalizeField();
-	ScalarField2D laplacian("../data/004_lap.pgm"); // this contains the Laplacian, that can be calculated from the divergence of the gradient field
-	laplacian.AffineTransform(1.0f,-0.5f); // center to 0
-	laplacian.AffineTransform(0.03f); // adjust the strength of the Lapacian
-
-	// solve and export
-	SimpleGeometricMultigridFloat diffusion(alpha, altitudes, laplacian);
-	// initialize the opengl shaders
-	diffusion.InitGL();
-	// execute the solver
-	diffusion.Solve();
-	// get the result and export it
-	ScalarField2D result = diffusion.GetResult();
-	result.SavePGM("../results/result.pgm");
-	glfwTerminate();
-	return 0;
-}
\ No newline at end of file
+	}
+	return status;
+}
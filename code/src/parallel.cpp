@@ -0,0 +1,314 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+static int threadCount = 0; // 0 : hardware concurrency
+static bool threadAffinity = false;
+
+namespace
+{
+  // Loop run by ParallelFor, on the stack of its thread until its pending count is 0. The first exception thrown by
+  // a block is kept, and thrown again by ParallelFor once all the blocks are done.
+  struct Loop {
+    const std::function<void(int, int)>* body;
+    std::atomic<int> pending;
+    std::mutex mutex;
+    std::exception_ptr error;
+
+    void Run(int begin, int end)
+    {
+      try {
+        (*body)(begin, end);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  };
+
+  // Block [begin, end) of a loop
+  struct Task {
+    Loop* loop;
+    int begin, end;
+  };
+
+  // Tasks of a thread: the owner pushes and pops at the back (the most recent, still in its cache), the other
+  // threads steal at the front (the oldest, the largest part of the work left)
+  class TaskDeque {
+  public:
+    void Push(const Task& task)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(task);
+    }
+    bool PopBack(Task& task)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tasks.empty())
+        return false;
+      task = tasks.back();
+      tasks.pop_back();
+      return true;
+    }
+    bool PopFront(Task& task)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tasks.empty())
+        return false;
+      task = tasks.front();
+      tasks.pop_front();
+      return true;
+    }
+  protected:
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Scheduler. One deque per worker, and a last one shared by the threads that are not workers (main thread,
+  // loaders and writers of the batch). Idle workers sleep until tasks are queued.
+  // The threads that are not workers share a single compute slot: with the ThreadCount() - 1 workers, at most
+  // ThreadCount() threads run blocks at a time. The thread that holds the slot runs blocks, the others queue all the
+  // blocks of their loop and sleep until they are done, or until the slot is free.
+  class Scheduler {
+  public:
+    Scheduler(int threads, bool pinned);
+    ~Scheduler();
+    void Run(int begin, int n, int blocks, const std::function<void(int, int)>& body);
+    int Threads() const { return threads; }
+    bool Pinned() const { return pinned; }
+  protected:
+    bool RunOne(int self);
+    void Work(int self);
+    void Help(int self, const std::atomic<int>& pending);
+
+    int threads;
+    bool pinned;
+    std::vector<std::unique_ptr<TaskDeque> > deques;
+    std::vector<std::thread> workers;
+    std::atomic<int> queued;           //!< Tasks in the deques, not started
+    std::atomic<bool> slot;            //!< Compute slot of the threads that are not workers is free
+    std::mutex sleep;
+    std::condition_variable wake;      //!< Workers, tasks queued
+    std::condition_variable done;      //!< Other threads, a loop is done or the slot is free
+    bool stop;
+  };
+
+  // Deque of the current thread if it is a worker of the scheduler
+  thread_local const Scheduler* workerOf = nullptr;
+  thread_local int workerIndex = -1;
+  // The current thread runs blocks: a worker, or the thread that holds the compute slot
+  thread_local bool computing = false;
+
+  Scheduler::Scheduler(int threads, bool pinned) : threads(threads), pinned(pinned), queued(0), slot(true), stop(false)
+  {
+    for (int t = 0; t < threads; t++)
+      deques.push_back(std::unique_ptr<TaskDeque>(new TaskDeque()));
+    for (int t = 0; t + 1 < threads; t++) {
+      workers.push_back(std::thread(&Scheduler::Work, this, t));
+#ifdef __linux__
+      if (pinned) {
+        // workers on the cores 1 to threads - 1, the core 0 is left to the main thread
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET((t + 1) % std::max(1, int(std::thread::hardware_concurrency())), &cpus);
+        pthread_setaffinity_np(workers.back().native_handle(), sizeof(cpus), &cpus);
+      }
+#endif
+    }
+  }
+
+  Scheduler::~Scheduler()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleep);
+      stop = true;
+    }
+    wake.notify_all();
+    for (unsigned int t = 0; t < workers.size(); t++)
+      workers[t].join();
+  }
+
+  /*!
+  \brief Run a task of the deque of a thread, or steal one from the other deques.
+  \return false if there was no task
+  */
+  bool Scheduler::RunOne(int self)
+  {
+    Task task;
+    bool found = deques[self]->PopBack(task);
+    for (int k = 1; k < threads && !found; k++)
+      found = deques[(self + k) % threads]->PopFront(task);
+    if (!found)
+      return false;
+    queued--;
+    task.loop->Run(task.begin, task.end);
+    if (task.loop->pending.fetch_sub(1) == 1) {
+      // last block of the loop, its thread may be sleeping
+      std::lock_guard<std::mutex> lock(sleep);
+      done.notify_all();
+    }
+    return true;
+  }
+
+  void Scheduler::Work(int self)
+  {
+    workerOf = this;
+    workerIndex = self;
+    computing = true;
+    while (true) {
+      if (RunOne(self))
+        continue;
+      std::unique_lock<std::mutex> lock(sleep);
+      wake.wait(lock, [&]() { return stop || queued > 0; });
+      if (stop)
+        return;
+    }
+  }
+
+  // Run tasks, own or stolen, until the blocks of a loop are done
+  void Scheduler::Help(int self, const std::atomic<int>& pending)
+  {
+    while (pending > 0)
+      if (!RunOne(self))
+        std::this_thread::yield();
+  }
+
+  /*!
+  \brief Run a loop split in blocks. A thread that runs blocks (or takes the free compute slot) queues the blocks 1 to
+  blocks - 1, runs the block 0, then runs tasks until the blocks of its loop are done. Another thread queues all the
+  blocks and sleeps until they are done, or until it can take the slot and help.
+  An exception thrown by a block is thrown again once all the blocks are done.
+  */
+  void Scheduler::Run(int begin, int n, int blocks, const std::function<void(int, int)>& body)
+  {
+    int self = workerOf == this ? workerIndex : threads - 1;
+    bool owner = false;
+    if (!computing && slot.exchange(false))
+      computing = owner = true;
+    int first = computing ? 1 : 0;
+    Loop loop;
+    loop.body = &body;
+    loop.pending = blocks - first;
+    const std::atomic<int>& pending = loop.pending;
+    for (int t = blocks - 1; t >= first; t--) {
+      Task task = { &loop, begin + int((long long)(n) * t / blocks), begin + int((long long)(n) * (t + 1) / blocks) };
+      deques[self]->Push(task);
+    }
+    if (blocks - first > 0) {
+      queued += blocks - first;
+      {
+        std::lock_guard<std::mutex> lock(sleep); // a worker cannot miss the notification between its test and its wait
+      }
+      wake.notify_all();
+    }
+    if (computing) {
+      if (first == 1)
+        loop.Run(begin, begin + n / blocks);
+      Help(self, pending);
+    }
+    else {
+      while (pending > 0) {
+        if (slot.exchange(false)) {
+          computing = owner = true;
+          Help(self, pending);
+          break;
+        }
+        std::unique_lock<std::mutex> lock(sleep);
+        done.wait(lock, [&]() { return pending == 0 || slot.load(); });
+      }
+    }
+    if (owner) {
+      computing = false;
+      slot.store(true);
+      std::lock_guard<std::mutex> lock(sleep);
+      done.notify_all();
+    }
+    // no task refers to the loop anymore
+    if (loop.error)
+      std::rethrow_exception(loop.error);
+  }
+
+  std::mutex instanceMutex;
+  std::unique_ptr<Scheduler> instance;
+#ifndef _WIN32
+  pid_t instanceProcess = 0;
+#endif
+
+  /*!
+  \brief Scheduler of the current thread count and affinity, started again if they have changed.
+  */
+  Scheduler& Instance()
+  {
+    std::lock_guard<std::mutex> lock(instanceMutex);
+#ifndef _WIN32
+    if (instance && instanceProcess != getpid())
+      instance.release(); // forked process: the workers do not exist here, the scheduler is lost, not destroyed
+    instanceProcess = getpid();
+#endif
+    if (!instance || instance->Threads() != ThreadCount() || instance->Pinned() != threadAffinity) {
+      instance.reset();
+      instance.reset(new Scheduler(ThreadCount(), threadAffinity));
+    }
+    return *instance;
+  }
+}
+
+/*!
+\brief Number of threads used by ParallelFor.
+*/
+int ThreadCount()
+{
+  if (threadCount > 0)
+    return threadCount;
+  return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+/*!
+\brief Set the number of threads used by ParallelFor, 0 to use all the cores.
+*/
+void SetThreadCount(int n)
+{
+  threadCount = std::max(0, n);
+}
+
+/*!
+\brief Pin each worker thread to a core (Linux only), false by default.
+*/
+void SetThreadAffinity(bool pinned)
+{
+  threadAffinity = pinned;
+}
+
+/*!
+\brief Split [begin, end) into contiguous blocks of at least grain indices, processed by concurrent threads.
+\param body called once per block with its bounds [b, e). If a block throws, the first exception is thrown again once
+all the blocks are done.
+*/
+void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body)
+{
+  int n = end - begin;
+  if (n <= 0)
+    return;
+  int blocks = std::max(1, std::min(ThreadCount(), (n + grain - 1) / std::max(1, grain)));
+  if (blocks == 1 && computing) { // a small loop of another thread still waits for the compute slot
+    body(begin, end);
+    return;
+  }
+  Instance().Run(begin, n, blocks, body);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <functional>
+
+// Parallel loops over index ranges, used by the CPU stages (input and output, preprocessing, hierarchy, smoothing).
+// The blocks of every loop are tasks of a single work-stealing scheduler: ThreadCount() - 1 worker threads, each one
+// with its own deque of tasks, plus one compute slot shared by the other threads that call ParallelFor (main thread,
+// loaders and writers of the batch). The thread that holds the slot runs tasks until its blocks are done, the others
+// queue their blocks and sleep until the workers are done with them, or until the slot is free.
+// A loop inside a block of another loop (scenes x rows) pushes its blocks to the same workers: at most ThreadCount()
+// threads run blocks, whatever the nesting and the number of calling threads (threads that do not call ParallelFor,
+// such as the file reads of the batch, are not counted). The blocks of a loop only depend on the thread count.
+// The workers are started by the first parallel loop, and again after SetThreadCount or SetThreadAffinity, which
+// must not be called during a loop, and in a process created by fork.
+int ThreadCount();
+void SetThreadCount(int n);
+void SetThreadAffinity(bool pinned);
+void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
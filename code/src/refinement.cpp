@@ -0,0 +1,361 @@
+#include "refinement.h"
+#include "parallel.h"
+#include <cmath>
+
+// Average of the neighbours of the cell idx = i * s + j that exist, as in the solver (Stencil::Generic)
+static inline double Average(const double* v, int s, int i, int j, int idx)
+{
+  double l = 0.0;
+  int cpt = 0;
+  if (i > 0) { l += v[idx - s]; cpt++; }
+  if (i < s - 1) { l += v[idx + s]; cpt++; }
+  if (j < s - 1) { l += v[idx + 1]; cpt++; }
+  if (j > 0) { l += v[idx - 1]; cpt++; }
+  return l / cpt;
+}
+
+/*!
+\brief Residual of the level 0 equations for a solution x, computed in double.
+*/
+ScalarField2DD Residual(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+  const ConstScalarField2DView& laplacian, const ScalarField2DD& x)
+{
+  int s = x.SizeX();
+  ScalarField2DD r(s, s);
+  const double* v = x.View().Data();
+  double* res = &r[0];
+  ParallelFor(0, s, std::max(1, 65536 / s), [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      for (int j = 0; j < s; j++) {
+        int idx = i * s + j;
+        double al = alpha.Get(i, j);
+        res[idx] = al * (Average(v, s, i, j, idx) - double(laplacian.Get(i, j))) + (1.0 - al) * double(altitude.Get(i, j)) - v[idx];
+      }
+    }
+  });
+  return r;
+}
+
+// Linear part of the equations, x - alpha * avg(x): the residual is the right-hand side minus Operator(x)
+static ScalarField2DD Operator(const ConstScalarField2DView& alpha, const ScalarField2DD& x)
+{
+  int s = x.SizeX();
+  ScalarField2DD y(s, s);
+  const double* v = x.View().Data();
+  double* out = &y[0];
+  ParallelFor(0, s, std::max(1, 65536 / s), [&](int begin, int end) {
+    for (int i = begin; i < end; i++)
+      for (int j = 0; j < s; j++) {
+        int idx = i * s + j;
+        out[idx] = v[idx] - double(alpha.Get(i, j)) * Average(v, s, i, j, idx);
+      }
+  });
+  return y;
+}
+
+// Dot product of two fields of the same size
+static double Dot(const ScalarField2DD& a, const ScalarField2DD& b)
+{
+  const double* u = a.View().Data();
+  const double* v = b.View().Data();
+  double sum = 0.0;
+  for (size_t i = 0; i < size_t(a.SizeX()) * a.SizeY(); i++)
+    sum += u[i] * v[i];
+  return sum;
+}
+
+/*!
+\brief Largest absolute value of a field.
+*/
+double MaxNorm(const ScalarField2DD& field)
+{
+  double norm = 0.0;
+  const double* v = field.View().Data();
+  for (size_t i = 0; i < size_t(field.SizeX()) * field.SizeY(); i++)
+    norm = std::max(norm, std::fabs(v[i]));
+  return norm;
+}
+
+// Level of the correction solver. The equations e - alpha * avg(e) = r are multiplied by the number of neighbours of
+// each cell, n * e - alpha * sum(e) = n * r: the operator M of level 0, a 5-point stencil computed from alpha. The
+// coarse levels have the Galerkin operator P^T M P of the finer one, a 9-point stencil stored per cell.
+struct CorrectionLevel {
+  int s;
+  std::vector<float> alpha;     //!< Level 0 only
+  std::vector<float> stencil;   //!< Coarse levels only, 9 coefficients per cell, (di + 1) * 3 + (dj + 1)
+  std::vector<float> e, b, res; //!< Correction, right-hand side, residual
+};
+
+// Number of neighbours of a cell that exist
+static inline int Neighbours(int s, int i, int j)
+{
+  return (i > 0) + (i < s - 1) + (j > 0) + (j < s - 1);
+}
+
+// Coefficient k of the operator of a level at the cell (i, j)
+static inline float Coefficient(const CorrectionLevel& l, int i, int j, int k)
+{
+  if (l.alpha.empty())
+    return l.stencil[9 * (size_t(i) * l.s + j) + k];
+  if (k == 4)
+    return float(Neighbours(l.s, i, j));
+  int di = k / 3 - 1, dj = k % 3 - 1;
+  if (di != 0 && dj != 0)
+    return 0.0f;
+  int ni = i + di, nj = j + dj;
+  return ni >= 0 && ni < l.s && nj >= 0 && nj < l.s ? -l.alpha[size_t(i) * l.s + j] : 0.0f;
+}
+
+// Weight of the coarse cell c in the bilinear prolongation to the fine cell f, along one axis
+static inline float Prolongation(int f, int c)
+{
+  int d = f - 2 * c;
+  return d == 0 ? 1.0f : (d == 1 || d == -1 ? 0.5f : 0.0f);
+}
+
+// Operator of a level applied to e at the cell (i, j), without its diagonal
+static inline float OffDiagonal(const CorrectionLevel& l, int i, int j)
+{
+  int s = l.s;
+  size_t idx = size_t(i) * s + j;
+  const float* e = l.e.data();
+  if (!l.alpha.empty()) {
+    float sum = 0.0f;
+    if (i > 0) sum += e[idx - s];
+    if (i < s - 1) sum += e[idx + s];
+    if (j < s - 1) sum += e[idx + 1];
+    if (j > 0) sum += e[idx - 1];
+    return -l.alpha[idx] * sum;
+  }
+  const float* m = &l.stencil[9 * idx];
+  if (i > 0 && i < s - 1 && j > 0 && j < s - 1)
+    return m[0] * e[idx - s - 1] + m[1] * e[idx - s] + m[2] * e[idx - s + 1] + m[3] * e[idx - 1]
+      + m[5] * e[idx + 1] + m[6] * e[idx + s - 1] + m[7] * e[idx + s] + m[8] * e[idx + s + 1];
+  float sum = 0.0f;
+  for (int k = 0; k < 9; k++) {
+    int ni = i + k / 3 - 1, nj = j + k % 3 - 1;
+    if (k != 4 && ni >= 0 && ni < l.s && nj >= 0 && nj < l.s)
+      sum += Coefficient(l, i, j, k) * l.e[size_t(ni) * l.s + nj];
+  }
+  return sum;
+}
+
+/*!
+\brief Gauss-Seidel sweeps, the cells of each color in parallel: 2 colors for the 5-point stencil of level 0, 4 for the
+9-point stencils (no two cells of a color are neighbours).
+*/
+static void SmoothCorrection(CorrectionLevel& l, int sweeps)
+{
+  int s = l.s;
+  int colors = l.alpha.empty() ? 4 : 2;
+  for (int sweep = 0; sweep < sweeps; sweep++) {
+    for (int color = 0; color < colors; color++) {
+      ParallelFor(0, s, std::max(1, 16384 / s), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          if (colors == 4 && i % 2 != color / 2)
+            continue;
+          int first = colors == 4 ? color % 2 : (i + color) % 2;
+          for (int j = first; j < s; j += 2) {
+            size_t idx = size_t(i) * s + j;
+            l.e[idx] = (l.b[idx] - OffDiagonal(l, i, j)) / Coefficient(l, i, j, 4);
+          }
+        }
+      });
+    }
+  }
+}
+
+// Residual of a level, b - M e
+static void CorrectionResidual(CorrectionLevel& l)
+{
+  int s = l.s;
+  ParallelFor(0, s, std::max(1, 16384 / s), [&](int begin, int end) {
+    for (int i = begin; i < end; i++)
+      for (int j = 0; j < s; j++) {
+        size_t idx = size_t(i) * s + j;
+        l.res[idx] = l.b[idx] - OffDiagonal(l, i, j) - Coefficient(l, i, j, 4) * l.e[idx];
+      }
+  });
+}
+
+/*!
+\brief Galerkin operator of the coarse level, P^T M P: for each coarse cell X, the sum over the fine cells f of its
+prolongation of P(f, X) * M(f, g) * P(g, Y), for the neighbours Y of X.
+*/
+static void CoarseOperator(const CorrectionLevel& fine, CorrectionLevel& coarse)
+{
+  int s = fine.s, cs = coarse.s;
+  coarse.stencil.assign(9 * size_t(cs) * cs, 0.0f);
+  ParallelFor(0, cs, std::max(1, 4096 / cs), [&](int begin, int end) {
+    for (int ci = begin; ci < end; ci++)
+      for (int cj = 0; cj < cs; cj++) {
+        float* row = &coarse.stencil[9 * (size_t(ci) * cs + cj)];
+        for (int fi = std::max(0, 2 * ci - 1); fi <= std::min(s - 1, 2 * ci + 1); fi++)
+          for (int fj = std::max(0, 2 * cj - 1); fj <= std::min(s - 1, 2 * cj + 1); fj++) {
+            float pf = Prolongation(fi, ci) * Prolongation(fj, cj);
+            for (int k = 0; k < 9; k++) {
+              int gi = fi + k / 3 - 1, gj = fj + k % 3 - 1;
+              if (gi < 0 || gi >= s || gj < 0 || gj >= s)
+                continue;
+              float m = pf * Coefficient(fine, fi, fj, k);
+              if (m == 0.0f)
+                continue;
+              // coarse cells Y whose prolongation reaches g, all neighbours of X
+              for (int yi = gi / 2; yi <= std::min(cs - 1, (gi + 1) / 2); yi++)
+                for (int yj = gj / 2; yj <= std::min(cs - 1, (gj + 1) / 2); yj++)
+                  row[(yi - ci + 1) * 3 + (yj - cj + 1)] += m * Prolongation(gi, yi) * Prolongation(gj, yj);
+            }
+          }
+      }
+  });
+}
+
+/*!
+\brief V-cycle of the correction solver from a level: Gauss-Seidel, the residual restricted by P^T, the correction of
+the coarser level prolongated, Gauss-Seidel. The coarsest level is solved by many sweeps.
+*/
+static void CorrectionCycle(std::vector<CorrectionLevel>& levels, int k)
+{
+  CorrectionLevel& l = levels[k];
+  if (k + 1 == int(levels.size())) {
+    SmoothCorrection(l, 200);
+    return;
+  }
+  SmoothCorrection(l, 2);
+  CorrectionResidual(l);
+  CorrectionLevel& c = levels[k + 1];
+  int s = l.s, cs = c.s;
+  ParallelFor(0, cs, std::max(1, 16384 / cs), [&](int begin, int end) {
+    for (int ci = begin; ci < end; ci++)
+      for (int cj = 0; cj < cs; cj++) {
+        float sum = 0.0f;
+        for (int fi = std::max(0, 2 * ci - 1); fi <= std::min(s - 1, 2 * ci + 1); fi++)
+          for (int fj = std::max(0, 2 * cj - 1); fj <= std::min(s - 1, 2 * cj + 1); fj++)
+            sum += Prolongation(fi, ci) * Prolongation(fj, cj) * l.res[size_t(fi) * s + fj];
+        c.b[size_t(ci) * cs + cj] = sum;
+      }
+  });
+  std::fill(c.e.begin(), c.e.end(), 0.0f);
+  CorrectionCycle(levels, k + 1);
+  // bilinear prolongation of the coarse correction, same weights as the solver
+  ParallelFor(0, s, std::max(1, 16384 / s), [&](int begin, int end) {
+    for (int i = begin; i < end; i++)
+      for (int j = 0; j < s; j++) {
+        int i0 = i / 2, j0 = j / 2, i1 = i0 + i % 2, j1 = j0 + j % 2;
+        l.e[size_t(i) * s + j] += 0.25f * (c.e[size_t(i0) * cs + j0] + c.e[size_t(i0) * cs + j1]
+          + c.e[size_t(i1) * cs + j0] + c.e[size_t(i1) * cs + j1]);
+      }
+  });
+  SmoothCorrection(l, 2);
+}
+
+/*!
+\brief Levels of the correction solver, down to 5x5 cells.
+*/
+static std::vector<CorrectionLevel> CorrectionLevels(const ConstScalarField2DView& alpha)
+{
+  std::vector<CorrectionLevel> levels(1);
+  int s = alpha.SizeX();
+  levels[0].s = s;
+  levels[0].alpha.resize(size_t(s) * s);
+  for (int i = 0; i < s; i++)
+    for (int j = 0; j < s; j++)
+      levels[0].alpha[size_t(i) * s + j] = alpha.Get(i, j);
+  while (levels.back().s > 5) {
+    CorrectionLevel coarse;
+    coarse.s = levels.back().s / 2 + 1;
+    CoarseOperator(levels.back(), coarse);
+    levels.push_back(std::move(coarse));
+  }
+  for (CorrectionLevel& l : levels) {
+    l.e.assign(size_t(l.s) * l.s, 0.0f);
+    l.b.assign(size_t(l.s) * l.s, 0.0f);
+    l.res.assign(size_t(l.s) * l.s, 0.0f);
+  }
+  return levels;
+}
+
+/*!
+\brief Correction of a residual in float: V-cycles until the residual of the correction is reduced by the tolerance of
+the options, or their largest number.
+*/
+static ScalarField2DD SolveCorrection(std::vector<CorrectionLevel>& levels, const ScalarField2DD& r,
+  const RefinementOptions& options)
+{
+  CorrectionLevel& l = levels[0];
+  int s = l.s;
+  const double* rv = r.View().Data();
+  float norm = 0.0f;
+  for (int i = 0; i < s; i++)
+    for (int j = 0; j < s; j++) {
+      size_t idx = size_t(i) * s + j;
+      l.b[idx] = float(Neighbours(s, i, j)) * float(rv[idx]);
+      norm = std::max(norm, std::fabs(float(rv[idx])));
+    }
+  std::fill(l.e.begin(), l.e.end(), 0.0f);
+  for (int cycle = 0; cycle < options.cycles; cycle++) {
+    CorrectionCycle(levels, 0);
+    // residual of the equations of r, the one of M divided by the number of neighbours
+    CorrectionResidual(l);
+    float residual = 0.0f;
+    for (int i = 0; i < s; i++)
+      for (int j = 0; j < s; j++)
+        residual = std::max(residual, std::fabs(l.res[size_t(i) * s + j]) / float(Neighbours(s, i, j)));
+    if (residual <= options.reduction * norm)
+      break;
+  }
+  ScalarField2DD e(s, s);
+  for (size_t i = 0; i < l.e.size(); i++)
+    e[int(i)] = double(l.e[i]);
+  return e;
+}
+
+// One float solve, returned in double
+static ScalarField2DD SolveFloat(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+  const ConstScalarField2DView& laplacian, const RefinementOptions& options)
+{
+  SimpleGeometricMultigridFloat solver(alpha, altitude, laplacian, options.layout);
+  if (options.gpu)
+    solver.InitGL(options.storage);
+  else
+    solver.InitCPU();
+  solver.Solve();
+  return solver.GetResultDouble();
+}
+
+/*!
+\brief Solve the diffusion system with float solves and double residuals (see refinement.h).
+\param residuals if not null, receives the largest residual of the first solution and after every correction
+*/
+ScalarField2DD SolveRefined(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+  const ConstScalarField2DView& laplacian, const RefinementOptions& options, std::vector<double>* residuals)
+{
+  ScalarField2DD x = SolveFloat(alpha, altitude, laplacian, options);
+  std::vector<CorrectionLevel> levels = CorrectionLevels(alpha);
+  std::vector<ScalarField2DD> directions, images; // previous corrections and their image by the operator
+  for (int k = 0; ; k++) {
+    ScalarField2DD r = Residual(alpha, altitude, laplacian, x);
+    double norm = MaxNorm(r);
+    if (residuals != nullptr)
+      residuals->push_back(norm);
+    if (norm <= options.tolerance || k == options.iterations)
+      break;
+    ScalarField2DD e = SolveCorrection(levels, r, options);
+    ScalarField2DD q = Operator(alpha, e);
+    // orthogonal to the previous images, then the step minimizing the residual (generalized conjugate residual)
+    for (unsigned int i = 0; i < directions.size(); i++) {
+      double beta = Dot(q, images[i]) / Dot(images[i], images[i]);
+      e -= beta * directions[i];
+      q -= beta * images[i];
+    }
+    double step = Dot(r, q) / Dot(q, q);
+    x += step * e;
+    if (int(directions.size()) == RefinementOptions::DIRECTIONS) {
+      directions.erase(directions.begin());
+      images.erase(images.begin());
+    }
+    directions.push_back(std::move(e));
+    images.push_back(std::move(q));
+  }
+  return x;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "basics.h"
+#include "layout.h"
+#include "diffusionterrain.h"
+#include <vector>
+
+// Mixed-precision iterative refinement of the diffusion system. The float solver (CPU or GL) gives a first solution x,
+// then each iteration computes the residual of the level 0 equations in double,
+//   r = alpha * (avg(x) - laplacian) + (1 - alpha) * altitude - x,
+// solves for the correction e of the same operator, e - alpha * avg(e) = r, in float, and adds it to x in double.
+// The cascadic solve of the solver restricts the constraints, not the residual: it only reduces the residual of a
+// correction a few times, and the refinement stalled at its contraction. The corrections are solved on the CPU by
+// multigrid V-cycles on the residual instead, with Galerkin coarse operators (P^T M P, which keep the weight of the
+// fixed cells on the coarse levels), until the residual of the correction is reduced by `reduction`. The residual of x
+// then decreases by about as much per iteration, down to the rounding of double.
+// Each correction is also made orthogonal to the last DIRECTIONS ones, then scaled to minimize the residual (truncated
+// generalized conjugate residual).
+// Cost: the V-cycles on the CPU dominate, the refined solve is not at the cost of a float solve. On 257x257 (one
+// core), it takes about 9 times a float solve (0.32 s against 0.035 s) for 3 corrections.
+struct RefinementOptions {
+  bool gpu = false;               //!< First float solve on the GL backend, requires a current OpenGL context
+  Layout::Order layout = Layout::ROW_MAJOR; //!< Memory layout of the float solver
+  SimpleGeometricMultigridFloat::Storage storage = SimpleGeometricMultigridFloat::BUFFERS; //!< Solution storage of the GL backend
+  int iterations = 8;             //!< Largest number of corrections
+  double tolerance = 1e-9;        //!< Stop once the largest residual is below this value
+  int cycles = 10;                //!< Largest number of V-cycles per correction
+  float reduction = 1e-2f;        //!< V-cycles of a correction stop once its residual is reduced by this factor
+
+  static const int DIRECTIONS = 4; //!< Number of previous corrections kept by the acceleration
+};
+
+ScalarField2DD Residual(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+  const ConstScalarField2DView& laplacian, const ScalarField2DD& x);
+double MaxNorm(const ScalarField2DD& field);
+ScalarField2DD SolveRefined(const ConstScalarField2DView& alpha, const ConstScalarField2DView& altitude,
+  const ConstScalarField2DView& laplacian, const RefinementOptions& options, std::vector<double>* residuals = nullptr);
@@ -0,0 +1,378 @@
+#pragma once
+#include <cstdlib>
+#include <vector>
+#include "basics.h"
+
+// Range16. Quantization of the values of [min, max] on 16 bits: value = offset + q * step, q in [0, 65535].
+// Decode is a single multiply-add in float, the same in mgstepfloat.glsl.
+struct Range16 {
+  float offset;
+  float step;
+
+  Range16() : offset(0.0f), step(0.0f) {}
+  Range16(float min, float max) : offset(min), step((max - min) / 65535.0f) {}
+
+  inline unsigned short Encode(float v) const {
+    float q = step > 0.0f ? (v - offset) / step + 0.5f : 0.0f;
+    return (unsigned short)(std::min(std::max(q, 0.0f), 65535.0f)); // rounded to nearest
+  }
+  inline float Decode(unsigned short q) const { return offset + float(q) * step; }
+};
+
+// PackedConstraints. Constraints of a level where alpha is exactly 0 or 1: a single value per cell, the Dirichlet
+// altitude where the fixed bit is set, the Laplacian elsewhere. The bits are stored in 32-bit words and every row
+// starts on a new word, so that rows can be written in parallel. The values are stored in the layout of the solver,
+// in a padded square (see layout.h), the bits are always row-major.
+// Compress replaces the values by 16-bit ones, quantized over the range of the altitudes of the level for the fixed
+// cells and of the Laplacian for the free ones. The solver still accumulates in float.
+// A strip holds the rows [row0, row0 + rows) of a level only (DomainDecomposition), its values in Layout::Strip.
+struct PackedConstraints {
+  ScalarField2D value;                 //!< Altitude of the fixed cells, Laplacian of the others
+  std::vector<unsigned short> value16; //!< Same values on 16 bits once compressed, value is then empty
+  Range16 altitude16;                  //!< Quantization of the altitudes
+  Range16 laplacian16;                 //!< Quantization of the Laplacian
+  std::vector<unsigned int> fixed;     //!< One bit per cell, set for the fixed cells
+  int words;                           //!< Number of words per row
+  int row0;                            //!< First row stored, 0 unless this is a strip
+
+  PackedConstraints() : words(0), row0(0) {}
+  PackedConstraints(int s, int padded) : value(padded, padded), fixed(size_t(s) * size_t((s + 31) / 32), 0u), words((s + 31) / 32), row0(0) {}
+  PackedConstraints(int s, int row0, int rows) : value(s, rows), fixed(size_t(rows) * size_t((s + 31) / 32), 0u), words((s + 31) / 32),
+    row0(row0) {}
+
+  inline bool Fixed(int i, int j) const { return (fixed[(i - row0) * words + (j >> 5)] >> (j & 31)) & 1u; }
+  inline void SetFixed(int i, int j) { fixed[(i - row0) * words + (j >> 5)] |= 1u << (j & 31); }
+  inline bool Compressed() const { return !value16.empty(); }
+  inline size_t Memory() const { return value.Memory() + sizeof(unsigned short) * value16.size() + sizeof(unsigned int) * fixed.size(); }
+
+  /*!
+  \brief Store the values of a level of size s on 16 bits, in the same layout. The size is rounded up to an even
+  number of values, so that the GPU can read them by pairs.
+  */
+  template<typename L>
+  void Compress(const L& layout, int s)
+  {
+    const float* v = value.View().Data();
+    float range[2][2] = { { 1e30f, -1e30f }, { 1e30f, -1e30f } }; // altitude, Laplacian
+    for (int i = 0; i < s; i++) {
+      for (int j = 0; j < s; j++) {
+        float* r = range[Fixed(i, j) ? 0 : 1];
+        r[0] = std::min(r[0], v[layout.Index(i, j)]);
+        r[1] = std::max(r[1], v[layout.Index(i, j)]);
+      }
+    }
+    altitude16 = range[0][0] <= range[0][1] ? Range16(range[0][0], range[0][1]) : Range16();
+    laplacian16 = range[1][0] <= range[1][1] ? Range16(range[1][0], range[1][1]) : Range16();
+    value16.assign((size_t(value.SizeX()) * value.SizeY() + 1) & ~size_t(1), 0);
+    for (int i = 0; i < s; i++) {
+      for (int j = 0; j < s; j++) {
+        int idx = layout.Index(i, j);
+        value16[idx] = Fixed(i, j) ? altitude16.Encode(v[idx]) : laplacian16.Encode(v[idx]);
+      }
+    }
+    value = ScalarField2D();
+  }
+};
+
+// CPU versions of the Jacobi step of mgstepfloat.glsl, from bufferA (a) to bufferB (b) on a s x s grid.
+// Only the free cells are smoothed, from a list built once per level (Stencil::CellList): the interior cells with an
+// unconditional kernel, the border cells with the bounds checks. The fixed cells are written once in each buffer.
+// The kernels are templated by the storage of the constraints, Stencil::Fields or Stencil::Packed, which also give
+// the restriction its inputs, by the memory layout of the level (layout.h) and by the type T of the solution, float
+// or double: the constraints are always stored in float and converted to T before any arithmetic. Accessors take the
+// cell (i, j) and its index idx in the layout.
+
+namespace Stencil
+{
+  // Three separate fields alpha, altitude and laplacian, alpha can take any value in [0, 1].
+  struct Fields {
+    const float* alpha;
+    const float* altitude;
+    const float* laplacian;
+
+    inline float Alpha(int, int, int idx) const { return alpha[idx]; }
+    inline float Altitude(int, int, int idx) const { return altitude[idx]; }
+    inline float Laplacian(int, int, int idx) const { return laplacian[idx]; }
+    // Laplace component only where alpha is not null
+    inline bool Free(int, int, int idx) const { return alpha[idx] > 0.; }
+    // Value of a cell that is not free
+    template<typename T>
+    inline T Constrained(int idx) const {
+      T al = alpha[idx];
+      return al * T(0) + (T(1) - al) * T(altitude[idx]);
+    }
+    // Final combination, avg is the average of the neighbours
+    template<typename T>
+    inline T Combine(int idx, T avg) const {
+      T al = alpha[idx];
+      return al * (avg - T(laplacian[idx])) + (T(1) - al) * T(altitude[idx]);
+    }
+  };
+
+  // Packed constraints: a fixed cell keeps its altitude, a free cell is the average of its neighbours minus the Laplacian.
+  // The fixed bits are always row-major, the values follow the layout.
+  struct Packed {
+    const float* value;
+    const unsigned int* fixed;
+    int words;
+    int row0;
+
+    explicit Packed(const PackedConstraints& c) : value(c.value.View().Data()), fixed(c.fixed.data()), words(c.words), row0(c.row0) {}
+
+    inline bool Fixed(int i, int j) const { return (fixed[(i - row0) * words + (j >> 5)] >> (j & 31)) & 1u; }
+    inline float Alpha(int i, int j, int) const { return Fixed(i, j) ? 0.0f : 1.0f; }
+    inline float Altitude(int i, int j, int idx) const { return Fixed(i, j) ? value[idx] : 0.0f; }
+    inline float Laplacian(int i, int j, int idx) const { return Fixed(i, j) ? 0.0f : value[idx]; }
+    inline bool Free(int i, int j, int) const { return !Fixed(i, j); }
+    template<typename T> inline T Constrained(int idx) const { return T(value[idx]); }
+    template<typename T> inline T Combine(int idx, T avg) const { return avg - T(value[idx]); }
+  };
+
+  // Packed constraints stored on 16 bits, see PackedConstraints::Compress.
+  struct Packed16 {
+    const unsigned short* value;
+    const unsigned int* fixed;
+    int words;
+    int row0;
+    Range16 altitude, laplacian;
+
+    explicit Packed16(const PackedConstraints& c) : value(c.value16.data()), fixed(c.fixed.data()), words(c.words),
+      row0(c.row0), altitude(c.altitude16), laplacian(c.laplacian16) {}
+
+    inline bool Fixed(int i, int j) const { return (fixed[(i - row0) * words + (j >> 5)] >> (j & 31)) & 1u; }
+    inline float Alpha(int i, int j, int) const { return Fixed(i, j) ? 0.0f : 1.0f; }
+    inline float Altitude(int i, int j, int idx) const { return Fixed(i, j) ? altitude.Decode(value[idx]) : 0.0f; }
+    inline float Laplacian(int i, int j, int idx) const { return Fixed(i, j) ? 0.0f : laplacian.Decode(value[idx]); }
+    inline bool Free(int i, int j, int) const { return !Fixed(i, j); }
+    template<typename T> inline T Constrained(int idx) const { return T(altitude.Decode(value[idx])); }
+    template<typename T> inline T Combine(int idx, T avg) const { return avg - T(laplacian.Decode(value[idx])); }
+  };
+
+  // CellList. Cells of a level in the order of the smoother: free interior cells, free border cells, then fixed
+  // cells, row-major in each group, stored as their index in the layout. The per-sweep cost is proportional to the number of free cells.
+  struct CellList {
+    std::vector<unsigned int> cells;
+    int interior;                      //!< Number of free interior cells
+    int free;                          //!< Number of free cells
+    int total;                         //!< Number of cells, kept when the list itself is released
+
+    CellList() : interior(0), free(0), total(0) {}
+
+    template<typename C, typename L>
+    void Build(const C& c, const L& layout, int s)
+    {
+      BuildWindow(c, layout, s, 0, 0, s, s);
+    }
+
+    // Cells of the window [i0, i1) x [j0, j1) of the level only. The rows and columns of the border of the window
+    // that are inside the level are a Dirichlet boundary: their free cells are not listed and keep their value.
+    template<typename C, typename L>
+    void BuildWindow(const C& c, const L& layout, int s, int i0, int j0, int i1, int j1)
+    {
+      std::vector<unsigned int> border, fixed;
+      cells.clear();
+      for (int i = i0; i < i1; i++) {
+        for (int j = j0; j < j1; j++) {
+          unsigned int cell = (unsigned int)layout.Index(i, j);
+          if (!c.Free(i, j, int(cell)))
+            fixed.push_back(cell);
+          else if ((i == i0 && i0 > 0) || (j == j0 && j0 > 0) || (i == i1 - 1 && i1 < s) || (j == j1 - 1 && j1 < s))
+            continue;
+          else if (i == 0 || j == 0 || i == s - 1 || j == s - 1)
+            border.push_back(cell);
+          else
+            cells.push_back(cell);
+        }
+      }
+      interior = int(cells.size());
+      free = interior + int(border.size());
+      cells.insert(cells.end(), border.begin(), border.end());
+      cells.insert(cells.end(), fixed.begin(), fixed.end());
+      total = int(cells.size());
+    }
+    inline size_t Memory() const { return sizeof(unsigned int) * cells.size(); }
+  };
+
+  // Jacobi step of the free cells cells[begin, end), any position: the average is taken over the neighbours that exist (cpt of them).
+  template<typename T, typename C, typename L>
+  inline void Generic(const T* a, T* b, const C& c, const L& layout, int s, const unsigned int* cells, int begin, int end)
+  {
+    for (int k = begin; k < end; k++) {
+      int idx = cells[k], i, j;
+      layout.Cell(idx, i, j);
+      T l = 0;
+      int cpt = 0;
+      if (i > 0) { l += a[layout.Up(idx)]; cpt++; }
+      if (i < s - 1) { l += a[layout.Down(idx)]; cpt++; }
+      if (j < s - 1) { l += a[layout.Right(idx)]; cpt++; }
+      if (j > 0) { l += a[layout.Left(idx)]; cpt++; }
+      b[idx] = c.Combine(idx, l / T(cpt));
+    }
+  }
+
+  // Jacobi step of the free interior cells cells[begin, end): four neighbours, no bounds check.
+  template<typename T, typename C, typename L>
+  inline void Interior(const T* a, T* b, const C& c, const L& layout, const unsigned int* cells, int begin, int end)
+  {
+    for (int k = begin; k < end; k++) {
+      int idx = cells[k];
+      T l = a[layout.Up(idx)] + a[layout.Down(idx)] + a[layout.Right(idx)] + a[layout.Left(idx)]; // same order as the generic version
+      b[idx] = c.Combine(idx, l / T(4));
+    }
+  }
+
+  // Value of the fixed cells cells[begin, end).
+  template<typename T, typename C>
+  inline void Fixed(T* b, const C& c, const unsigned int* cells, int begin, int end)
+  {
+    for (int k = begin; k < end; k++)
+      b[cells[k]] = c.template Constrained<T>(cells[k]);
+  }
+
+  // Jacobi step of the free cells of a list, in parallel: cells[0, split) with the interior kernel, the others with the generic one.
+  template<typename T, typename C, typename L>
+  inline void Step(const C& constraints, const L& layout, const T* a, T* b, int s, const CellList& list, int split)
+  {
+    const unsigned int* cells = list.cells.data();
+    ParallelFor(0, list.free, 16384, [&](int begin, int end) {
+      int middle = std::min(std::max(begin, split), end);
+      Interior(a, b, constraints, layout, cells, begin, middle);
+      Generic(a, b, constraints, layout, s, cells, middle, end);
+    });
+  }
+
+  // Values of the fixed cells of a list, in parallel.
+  template<typename T, typename C>
+  inline void WriteFixed(const C& constraints, T* b, const CellList& list)
+  {
+    const unsigned int* cells = list.cells.data();
+    ParallelFor(list.free, list.total, 16384, [&](int begin, int end) {
+      Fixed(b, constraints, cells, begin, end);
+    });
+  }
+
+  // Bilinear prolongation of a coarse level (layout cl) on the window [i0, i1) x [j0, j1) of the fine one (layout fl).
+  template<typename T, typename L>
+  inline void Prolongate(const T* coarse, const L& cl, T* fine, const L& fl, int i0, int j0, int i1, int j1)
+  {
+    ParallelFor(i0, i1, std::max(1, 16384 / (j1 - j0)), [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        for (int j = j0; j < j1; j++) {
+          T val = 0;
+          if (i % 2 == 0 && j % 2 == 0) { // both even row and column
+            val = coarse[cl.Index(i / 2, j / 2)];
+          }
+          else if (i % 2 == 0 && j % 2 == 1) { // even row and odd column
+            val = T(0.5) * coarse[cl.Index(i / 2, j / 2)] + T(0.5) * coarse[cl.Index(i / 2, j / 2 + 1)];
+          }
+          else if (i % 2 == 1 && j % 2 == 0) { // odd row and even column
+            val = T(0.5) * coarse[cl.Index(i / 2, j / 2)] + T(0.5) * coarse[cl.Index(i / 2 + 1, j / 2)];
+          }
+          else { // odd column and row
+            val = T(0.25) * coarse[cl.Index(i / 2, j / 2)] + T(0.25) * coarse[cl.Index(i / 2, j / 2 + 1)]
+              + T(0.25) * coarse[cl.Index(i / 2 + 1, j / 2)] + T(0.25) * coarse[cl.Index(i / 2 + 1, j / 2 + 1)];
+          }
+          fine[fl.Index(i, j)] = val;
+        }
+      }
+    });
+  }
+
+  // Write the restriction of one coarse cell: the altitude if some fine cells were fixed, the Laplacian otherwise.
+  inline void StoreCoarse(PackedConstraints& coarse, int idx, int i, int j, bool fixed, float maltitude, float nfixed, float sumlap)
+  {
+    if (fixed) {
+      coarse.SetFixed(i, j);
+      coarse.value[idx] = maltitude / nfixed; // geometric-weighted average if several cells were concerned
+    }
+    else // only laplacian
+      coarse.value[idx] = sumlap;
+  }
+
+  // Restriction of one coarse cell (i, j), with the bounds checks needed on the border of the grid.
+  template<typename C, typename L>
+  inline void RestrictCell(const C& fine, const L& fl, PackedConstraints& coarse, const L& cl, int s, int i, int j)
+  {
+    int ii, jj;
+    int iimin = -1;
+    int jjmin = -1;
+    int iimax = 1;
+    int jjmax = 1;
+    if (i == 0)
+      iimin = 0;
+    else if (i == s - 1)
+      iimax = 0;
+    if (j == 0)
+      jjmin = 0;
+    else if (j == s - 1)
+      jjmax = 0;
+    bool fixed = false;
+    float maltitude = .0;
+    float nfixed = .0;
+    float sumlap = .0;
+    for (ii = iimin; ii <= iimax; ii++)
+    {
+      for (jj = jjmin; jj <= jjmax; jj++)
+      {
+        int fi = 2 * i + ii, fj = 2 * j + jj, idx = fl.Index(fi, fj);
+        float coef = 1.0f / float((1 << std::abs(ii)) * (1 << std::abs(jj)));
+        float a = fine.Alpha(fi, fj, idx);
+        if (a < 1.0f) // there is a fixed altitude constraint
+        {
+          fixed = true;
+          maltitude += coef * (1.0f - a) * fine.Altitude(fi, fj, idx);
+          nfixed += coef * (1.0f - a);
+        }
+        if (a > .0) // there is a laplacian constraint here
+          sumlap += coef * a * fine.Laplacian(fi, fj, idx); // not an average, a geometric-weighted sum
+      }
+    }
+    StoreCoarse(coarse, cl.Index(i, j), i, j, fixed, maltitude, nfixed, sumlap);
+  }
+
+  // Restriction of the interior cells of a coarse row, 1 <= j <= s-2: all the 3x3 taps exist.
+  // No branch: a tap that does not contribute adds a (signed) zero, which leaves the sums bit-identical to the
+  // conditional accumulation of RestrictCell as long as the inputs are finite.
+  template<typename C, typename L>
+  inline void RestrictInteriorRow(const C& fine, const L& fl, PackedConstraints& coarse, const L& cl, int s, int i)
+  {
+    static const float coefs[3] = { 0.5f, 1.0f, 0.5f }; // 1 / (1 << abs(ii)), products are exact
+    for (int j = 1; j < s - 1; j++) {
+      bool fixed = false;
+      float maltitude = .0;
+      float nfixed = .0;
+      float sumlap = .0;
+      for (int ii = -1; ii <= 1; ii++) {
+        for (int jj = -1; jj <= 1; jj++) {
+          int fi = 2 * i + ii, fj = 2 * j + jj, idx = fl.Index(fi, fj);
+          float coef = coefs[ii + 1] * coefs[jj + 1];
+          float aa = fine.Alpha(fi, fj, idx);
+          fixed |= aa < 1.0f;
+          maltitude += coef * (1.0f - aa) * fine.Altitude(fi, fj, idx);
+          nfixed += coef * (1.0f - aa);
+          sumlap += coef * aa * fine.Laplacian(fi, fj, idx);
+        }
+      }
+      StoreCoarse(coarse, cl.Index(i, j), i, j, fixed, maltitude, nfixed, sumlap);
+    }
+  }
+
+  // Restriction of the rows [i0, i1) of a coarse level of size s, in parallel: interior cells with the branch-free
+  // kernel, border cells separately. The fine level must hold its rows [2 * i0 - 1, 2 * i1) that exist.
+  template<typename C, typename L>
+  inline void Restrict(const C& fine, const L& fl, PackedConstraints& coarse, const L& cl, int s, int i0, int i1)
+  {
+    ParallelFor(i0, i1, std::max(1, 16384 / s), [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        if (i == 0 || i == s - 1) {
+          for (int j = 0; j < s; j++)
+            RestrictCell(fine, fl, coarse, cl, s, i, j);
+          continue;
+        }
+        RestrictCell(fine, fl, coarse, cl, s, i, 0);
+        RestrictInteriorRow(fine, fl, coarse, cl, s, i);
+        RestrictCell(fine, fl, coarse, cl, s, i, s - 1);
+      }
+    });
+  }
+}
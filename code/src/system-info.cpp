@@ -0,0 +1,62 @@
+#include "system-info.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+#include <cstdlib>
+#include <fstream>
+
+/*!
+\brief Peak resident set size of the process since its start, in bytes (0 if unknown).
+*/
+size_t PeakResidentMemory()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return size_t(counters.PeakWorkingSetSize);
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return size_t(usage.ru_maxrss); // bytes on macOS
+#else
+  return size_t(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+#endif
+}
+
+/*!
+\brief Name of the processor, as reported by the system (empty if unknown).
+*/
+std::string ProcessorName()
+{
+#if defined(_WIN32)
+  const char* name = std::getenv("PROCESSOR_IDENTIFIER");
+  return name != nullptr ? name : "";
+#elif defined(__APPLE__)
+  char name[256];
+  size_t size = sizeof(name);
+  if (sysctlbyname("machdep.cpu.brand_string", name, &size, nullptr, 0) != 0)
+    return "";
+  return std::string(name);
+#else
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      size_t colon = line.find(':');
+      return colon != std::string::npos && colon + 2 <= line.size() ? line.substr(colon + 2) : "";
+    }
+  }
+  return "";
+#endif
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// System queries used to report the resources of a run.
+size_t PeakResidentMemory();
+std::string ProcessorName();
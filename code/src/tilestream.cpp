@@ -0,0 +1,177 @@
+#include "tilestream.h"
+#include "diffusionterrain.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+/*!
+\brief Empty world, tiles are generated by Tile or Update.
+\param size size of a tile, 2^n+1 is the size the hierarchy is built for
+\param capacity number of tiles kept, at least the 9 tiles of a neighbourhood
+*/
+TileStream::TileStream(int size, const Source& source, int capacity) : margin(32), size(size), source(source),
+  capacity(max(9, capacity)), generated(0)
+{
+}
+
+/*!
+\brief Cache entry of a tile, its constraints are loaded from the source if it is not cached. The entry becomes the
+most recently used one.
+*/
+TileStream::Entry& TileStream::Load(int ti, int tj)
+{
+  Key key(ti, tj);
+  map<Key, Entry>::iterator it = entries.find(key);
+  if (it != entries.end()) {
+    order.splice(order.begin(), order, it->second.use);
+    return it->second;
+  }
+  Entry& entry = entries[key];
+  source(ti, tj, entry.alpha, entry.altitude, entry.laplacian);
+  order.push_front(key);
+  entry.use = order.begin();
+  return entry;
+}
+
+/*!
+\brief Remove the least recently used tiles beyond the capacity.
+*/
+void TileStream::Evict()
+{
+  while (int(order.size()) > capacity) {
+    entries.erase(order.back());
+    order.pop_back();
+  }
+}
+
+/*!
+\brief Solve a tile in the scene of its 3x3 neighbourhood, the solved neighbours as fixed cells.
+*/
+void TileStream::Solve(int ti, int tj)
+{
+  int n = 3 * (size - 1) + 1;
+  ScalarField2D alpha(n, n), altitude(n, n), laplacian(n, n);
+  auto copy = [&](const Entry& entry, int di, int dj, bool fixed) {
+    int i0 = (di + 1) * (size - 1), j0 = (dj + 1) * (size - 1);
+    for (int i = 0; i < size; i++) {
+      for (int j = 0; j < size; j++) {
+        alpha.Set(i0 + i, j0 + j, fixed ? 0.0f : entry.alpha.Get(i, j));
+        altitude.Set(i0 + i, j0 + j, fixed ? entry.solution.Get(i, j) : entry.altitude.Get(i, j));
+        laplacian.Set(i0 + i, j0 + j, fixed ? 0.0f : entry.laplacian.Get(i, j));
+      }
+    }
+  };
+  // the constraints of the tile and of its unsolved neighbours, then the solved neighbours over them: their shared
+  // rows and columns are fixed
+  const Entry* neighbours[3][3];
+  for (int di = -1; di <= 1; di++)
+    for (int dj = -1; dj <= 1; dj++)
+      neighbours[di + 1][dj + 1] = &Load(ti + di, tj + dj);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int di = -1; di <= 1; di++) {
+      for (int dj = -1; dj <= 1; dj++) {
+        const Entry& entry = *neighbours[di + 1][dj + 1];
+        bool solved = entry.solution.SizeX() > 0 && !(di == 0 && dj == 0);
+        if (solved == (pass == 1))
+          copy(entry, di, dj, solved);
+      }
+    }
+  }
+
+  bool verbose = SimpleGeometricMultigridFloat::verbose;
+  SimpleGeometricMultigridFloat::verbose = false;
+  SimpleGeometricMultigridFloat solver(std::move(alpha), std::move(altitude), std::move(laplacian));
+  solver.InitCPU();
+  ScalarField2D solution = solver.SolveRegion(size - 1, size - 1, size, size, margin);
+  SimpleGeometricMultigridFloat::verbose = verbose;
+  Load(ti, tj).solution.Swap(solution);
+  generated++;
+  if (verbose)
+    cout << "Tile (" << ti << ", " << tj << ") solved, " << order.size() << " tiles in the cache" << endl;
+}
+
+/*!
+\brief Solution of a tile, solved first if it is not in the cache. The reference is valid until the next call.
+*/
+const ScalarField2D& TileStream::Tile(int ti, int tj)
+{
+  if (!Solved(ti, tj))
+    Solve(ti, tj);
+  const ScalarField2D& tile = Load(ti, tj).solution;
+  Evict();
+  return tile;
+}
+
+/*!
+\brief Generate the tiles around the camera, nearest first, until the deadline: at least one tile is solved if some
+are missing. The tiles already solved become the most recently used, the cache should hold all the tiles of the radius.
+\param i, j position of the camera, in cells of the world
+\param radius distance from the camera to the centre of the tiles to generate, in cells
+\return the number of tiles solved
+*/
+int TileStream::Update(double i, double j, double radius, std::chrono::steady_clock::time_point deadline)
+{
+  double step = size - 1;
+  int r = int(ceil(radius / step)) + 1;
+  int ci = int(floor(i / step)), cj = int(floor(j / step));
+  vector<pair<double, Key> > tiles;
+  for (int ti = ci - r; ti <= ci + r; ti++) {
+    for (int tj = cj - r; tj <= cj + r; tj++) {
+      double di = (ti + 0.5) * step - i, dj = (tj + 0.5) * step - j;
+      double distance = sqrt(di * di + dj * dj);
+      if (distance <= radius)
+        tiles.push_back(make_pair(distance, Key(ti, tj)));
+    }
+  }
+  sort(tiles.begin(), tiles.end());
+  // the farthest first, so that the nearest are the most recently used
+  for (int k = int(tiles.size()) - 1; k >= 0; k--)
+    if (Solved(tiles[k].second.first, tiles[k].second.second))
+      Load(tiles[k].second.first, tiles[k].second.second);
+  int count = 0;
+  for (const pair<double, Key>& tile : tiles) {
+    if (Solved(tile.second.first, tile.second.second))
+      continue;
+    if (count > 0 && std::chrono::steady_clock::now() >= deadline)
+      break;
+    Solve(tile.second.first, tile.second.second);
+    Evict();
+    count++;
+  }
+  return count;
+}
+
+/*!
+\brief Check if a tile is solved and in the cache.
+*/
+bool TileStream::Solved(int ti, int tj) const
+{
+  map<Key, Entry>::const_iterator it = entries.find(Key(ti, tj));
+  return it != entries.end() && it->second.solution.SizeX() > 0;
+}
+
+/*!
+\brief Size of a tile.
+*/
+int TileStream::Size() const
+{
+  return size;
+}
+
+/*!
+\brief Number of tiles in the cache, solved or only loaded as the context of their neighbours.
+*/
+int TileStream::Cached() const
+{
+  return int(order.size());
+}
+
+/*!
+\brief Number of tiles solved since the start, the ones generated again after an eviction included.
+*/
+int TileStream::Generated() const
+{
+  return generated;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "basics.h"
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+
+// TileStream. Solver of an unbounded world generated tile by tile, on demand around a camera. Tile (ti, tj) covers the
+// cells [ti * (size - 1), ti * (size - 1) + size) x [tj * (size - 1), tj * (size - 1) + size) of the world: neighbouring
+// tiles share a row or a column. The constraints of each tile come from a user function (Source).
+// A tile is solved in the context of its 3x3 neighbourhood: one scene of the constraints of the nine tiles, where the
+// solved neighbours replace their constraints by their solution, fixed (Dirichlet) cells. The shared rows and columns
+// of a solved neighbour are then the same in both tiles, and the unsolved ones give the Laplacian and the constraints
+// beyond the tile. Only the tile itself is solved at full resolution (SimpleGeometricMultigridFloat::SolveRegion), the
+// rest of the neighbourhood only on the coarse levels, so the cost of a tile does not grow with the world.
+// Tiles are kept in a least recently used cache, with the constraints of the neighbours loaded as context. An evicted
+// tile that is generated again takes its cached neighbours as borders, the seams stay continuous.
+class TileStream {
+public:
+  // Constraints of the tile (ti, tj), size x size fields
+  typedef std::function<void(int ti, int tj, ScalarField2D& alpha, ScalarField2D& altitude, ScalarField2D& laplacian)> Source;
+
+  TileStream(int size, const Source& source, int capacity = 64);
+  const ScalarField2D& Tile(int ti, int tj);
+  int Update(double i, double j, double radius, std::chrono::steady_clock::time_point deadline);
+  bool Solved(int ti, int tj) const;
+  int Size() const;
+  int Cached() const;
+  int Generated() const;
+  int margin;                              //!< Margin of the windows of the fine levels, see SolveRegion
+protected:
+  typedef std::pair<int, int> Key;
+  struct Entry {
+    ScalarField2D alpha, altitude, laplacian; //!< Constraints given by the source
+    ScalarField2D solution;                   //!< Empty until the tile is solved
+    std::list<Key>::iterator use;             //!< Position in the cache order
+  };
+  Entry& Load(int ti, int tj);
+  void Solve(int ti, int tj);
+  void Evict();
+
+  int size;                                //!< Size of a tile
+  Source source;
+  int capacity;                            //!< Number of tiles kept, solved or context only
+  int generated;                           //!< Number of tiles solved since the start
+  std::map<Key, Entry> entries;
+  std::list<Key> order;                    //!< Tiles of the cache, most recently used first
+};
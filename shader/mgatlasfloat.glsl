@@ -0,0 +1,96 @@
+#version 430
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+# ifdef COMPUTE_SHADER
+
+// One level of many scenes packed in an atlas (see diffusionatlas.h): each scene has a row-major region of the atlas
+// buffers, starting on a work group boundary. A dispatch covers all the regions, the work group finds its scene in the
+// group table, then the offset and the size of the region in the scene table.
+
+// per scene: offset of the region, size of the level, offset of the region of the coarser level (prolongation), first
+// work group of the region
+uniform uint GroupFirst; // first work group of the dispatch, large atlases are solved in several dispatches
+
+layout(std430, binding=6) buffer Scenes {
+    ivec4 scenes[];
+};
+
+layout(std430, binding=7) buffer Groups {
+    uint groups[]; // scene of each work group
+};
+
+layout(std430, binding=2) buffer Coefficients {
+    vec2 coefficients[]; // step of each cell, b = a * avg + c
+};
+
+layout(std430, binding=3) buffer BufferA {
+    float bufferA[]; // solution, read by the step, written by the prolongation
+};
+
+layout(std430, binding=4) buffer BufferB {
+    float bufferB[]; // solution written by the step, coarse level read by the prolongation
+};
+
+layout(local_size_x = WORK_GROUP_SIZE,  local_size_y = 1, local_size_z = 1) in;
+
+// Two variants, selected by a definition at compile time:
+// - ATLAS_PROLONG : bilinear prolongation of the coarse level (bufferB) as the initial guess of the level (bufferA),
+//   same operations as mgprolongfloat.glsl
+// - otherwise : Jacobi step of every cell, same operations as mgstepfloat.glsl, fixed cells (a = 0) keep their value
+void main()
+{
+    uint group = GroupFirst + gl_WorkGroupID.x;
+    ivec4 scene = scenes[groups[group]];
+    int k = int(group - uint(scene.w)) * WORK_GROUP_SIZE + int(gl_LocalInvocationID.x);
+    int s = scene.y;
+    if (k >= s * s) return;
+    int i = k / s;
+    int j = k - i * s;
+    int idx = scene.x + k;
+
+#ifdef ATLAS_PROLONG
+    int cs = s / 2 + 1;
+    int c = scene.z + (i / 2) * cs + j / 2;
+    precise float val;
+    if (i % 2 == 0 && j % 2 == 0) {
+        val = bufferB[c];
+    }
+    else if (i % 2 == 0) {
+        val = 0.5 * bufferB[c] + 0.5 * bufferB[c + 1];
+    }
+    else if (j % 2 == 0) {
+        val = 0.5 * bufferB[c] + 0.5 * bufferB[c + cs];
+    }
+    else {
+        val = 0.25 * bufferB[c] + 0.25 * bufferB[c + 1] + 0.25 * bufferB[c + cs] + 0.25 * bufferB[c + cs + 1];
+    }
+    bufferA[idx] = val;
+#else
+    vec2 ac = coefficients[idx];
+    if (ac.x == 0.0) { // fixed cell, a * avg + c is c
+        bufferB[idx] = ac.y;
+        return;
+    }
+    precise float avg;
+    if (i > 0 && i < s - 1 && j > 0 && j < s - 1) {
+        float lap = bufferA[idx - s] + bufferA[idx + s] + bufferA[idx + 1] + bufferA[idx - 1];
+        avg = lap / 4.0;
+    }
+    else {
+        // existing neighbours, same order as the single scene solver
+        int cpt = 0;
+        float lap = 0.0;
+        if (i > 0) { lap += bufferA[idx - s]; cpt++; }
+        if (i < s - 1) { lap += bufferA[idx + s]; cpt++; }
+        if (j < s - 1) { lap += bufferA[idx + 1]; cpt++; }
+        if (j > 0) { lap += bufferA[idx - 1]; cpt++; }
+        float c = cpt;
+        avg = lap / c;
+    }
+    precise float v = ac.x * avg + ac.y;
+    bufferB[idx] = v;
+#endif
+}
+
+#endif
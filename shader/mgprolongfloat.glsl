@@ -0,0 +1,89 @@
+#version 430
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+# ifdef COMPUTE_SHADER
+
+uniform int GridSizeX; // fine level
+uniform int GridSizeY;
+
+#ifdef IMAGE_STORAGE
+// GL_R32F textures, texel (j, i) is cell (i, j)
+layout(binding=0) uniform sampler2D Coarse; // coarse level, bilinear filter, clamped to the edges
+layout(r32f, binding=1) writeonly uniform image2D ImageA; // fine level, written
+#else
+layout(std430, binding=3) buffer BufferA {
+    float bufferA[]; // fine level, written
+};
+
+layout(std430, binding=4) buffer BufferCoarse {
+    float coarse[]; // coarse level, size (GridSizeX/2+1) x (GridSizeY/2+1)
+};
+#endif
+
+layout(local_size_x = WORK_GROUP_SIZE_X,  local_size_y = WORK_GROUP_SIZE_Y, local_size_z = 1) in;
+
+// offset of cell (i, j) in a level of size n: row-major, or tiles of 2^LAYOUT_TILE_BITS cells, row-major or
+// Z-order inside a tile (same layouts as layout.h)
+int LayoutOffset(int i, int j, int n)
+{
+#if defined(LAYOUT_TILED) || defined(LAYOUT_MORTON)
+    const int T = 1 << LAYOUT_TILE_BITS;
+    int tile = (i >> LAYOUT_TILE_BITS) * ((n + T - 1) / T) + (j >> LAYOUT_TILE_BITS);
+    int ii = i & (T - 1);
+    int jj = j & (T - 1);
+#ifdef LAYOUT_MORTON
+    ii = (ii | (ii << 2)) & 0x33;
+    ii = (ii | (ii << 1)) & 0x55;
+    jj = (jj | (jj << 2)) & 0x33;
+    jj = (jj | (jj << 1)) & 0x55;
+    return (tile << (2 * LAYOUT_TILE_BITS)) + (ii << 1) + jj;
+#else
+    return (tile << (2 * LAYOUT_TILE_BITS)) + (ii << LAYOUT_TILE_BITS) + jj;
+#endif
+#else
+    return i * n + j;
+#endif
+}
+
+int GetCoarseOffset(int i, int j)
+{
+    return LayoutOffset(i, j, GridSizeY / 2 + 1);
+}
+
+// prolongation operator : bilinear interpolation of the coarse level, same operations as the CPU version
+void main()
+{
+    int i = int(gl_GlobalInvocationID.x);
+    int j = int(gl_GlobalInvocationID.y);
+
+    if (i >= GridSizeX) return;
+    if (j >= GridSizeY) return;
+
+#ifdef IMAGE_STORAGE
+    // cell (i, j) is at (i / 2, j / 2) on the coarse grid: the filter computes the same weights, 1, 1/2 or 1/4
+    vec2 size = vec2(GridSizeY / 2 + 1, GridSizeX / 2 + 1);
+    float val = textureLod(Coarse, (vec2(j, i) * 0.5 + 0.5) / size, 0.0).r;
+    imageStore(ImageA, ivec2(j, i), vec4(val));
+#else
+    int ci = i / 2;
+    int cj = j / 2;
+    precise float val;
+    if (i % 2 == 0 && j % 2 == 0) { // both even row and column
+        val = coarse[GetCoarseOffset(ci, cj)];
+    }
+    else if (i % 2 == 0) { // even row and odd column
+        val = 0.5 * coarse[GetCoarseOffset(ci, cj)] + 0.5 * coarse[GetCoarseOffset(ci, cj + 1)];
+    }
+    else if (j % 2 == 0) { // odd row and even column
+        val = 0.5 * coarse[GetCoarseOffset(ci, cj)] + 0.5 * coarse[GetCoarseOffset(ci + 1, cj)];
+    }
+    else { // odd column and row
+        val = 0.25 * coarse[GetCoarseOffset(ci, cj)] + 0.25 * coarse[GetCoarseOffset(ci, cj + 1)]
+            + 0.25 * coarse[GetCoarseOffset(ci + 1, cj)] + 0.25 * coarse[GetCoarseOffset(ci + 1, cj + 1)];
+    }
+    bufferA[LayoutOffset(i, j, GridSizeY)] = val;
+#endif
+}
+
+#endif
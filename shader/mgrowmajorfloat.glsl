@@ -0,0 +1,55 @@
+#version 430
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+# ifdef COMPUTE_SHADER
+
+uniform int GridSizeX; // level 0
+uniform int GridSizeY;
+
+layout(std430, binding=3) buffer BufferA {
+    float bufferA[]; // solution, in the layout of the solver
+};
+
+layout(std430, binding=4) buffer BufferRowMajor {
+    float rowMajor[]; // written, GridSizeX x GridSizeY
+};
+
+layout(local_size_x = WORK_GROUP_SIZE_X,  local_size_y = WORK_GROUP_SIZE_Y, local_size_z = 1) in;
+
+// offset of cell (i, j) in a level of size n: row-major, or tiles of 2^LAYOUT_TILE_BITS cells, row-major or
+// Z-order inside a tile (same layouts as layout.h)
+int LayoutOffset(int i, int j, int n)
+{
+#if defined(LAYOUT_TILED) || defined(LAYOUT_MORTON)
+    const int T = 1 << LAYOUT_TILE_BITS;
+    int tile = (i >> LAYOUT_TILE_BITS) * ((n + T - 1) / T) + (j >> LAYOUT_TILE_BITS);
+    int ii = i & (T - 1);
+    int jj = j & (T - 1);
+#ifdef LAYOUT_MORTON
+    ii = (ii | (ii << 2)) & 0x33;
+    ii = (ii | (ii << 1)) & 0x55;
+    jj = (jj | (jj << 2)) & 0x33;
+    jj = (jj | (jj << 1)) & 0x55;
+    return (tile << (2 * LAYOUT_TILE_BITS)) + (ii << 1) + jj;
+#else
+    return (tile << (2 * LAYOUT_TILE_BITS)) + (ii << LAYOUT_TILE_BITS) + jj;
+#endif
+#else
+    return i * n + j;
+#endif
+}
+
+// copy of the solution in row-major order, before the readback
+void main()
+{
+    int i = int(gl_GlobalInvocationID.x);
+    int j = int(gl_GlobalInvocationID.y);
+
+    if (i >= GridSizeX) return;
+    if (j >= GridSizeY) return;
+
+    rowMajor[i * GridSizeY + j] = bufferA[LayoutOffset(i, j, GridSizeY)];
+}
+
+#endif
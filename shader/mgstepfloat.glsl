@@ -7,6 +7,24 @@
 uniform int GridSizeX;
 uniform int GridSizeY;
 
+uniform int CellFirst; // range of the cell list processed by the dispatch
+uniform int CellCount;
+
+#if defined(PACKED16)
+// packed constraints on 16 bits, two per word, the first one in the low bits: the altitude of the fixed cells or the
+// Laplacian of the others, quantized over the range of the level, value = offset + q * step
+uniform vec2 AltitudeRange; // offset, step
+uniform vec2 LaplacianRange;
+
+layout(std430, binding=2) buffer Constraint {
+    uint constraint[];
+};
+#elif defined(PACKED_CONSTRAINTS)
+// packed constraints (alpha is 0 or 1): the altitude of the fixed cells or the Laplacian of the others
+layout(std430, binding=2) buffer Constraint {
+    float constraint[];
+};
+#else
 layout(std430, binding=1) buffer Alpha {
     float alpha[];
 };
@@ -14,7 +32,13 @@ layout(std430, binding=1) buffer Alpha {
 layout(std430, binding=2) buffer Altitude {
     float altitude[];
 };
+#endif
 
+#ifdef IMAGE_STORAGE
+// solution levels in GL_R32F textures (row-major layout): texel (j, i) is cell (i, j)
+layout(binding=0) uniform sampler2D TextureA;
+layout(r32f, binding=1) writeonly uniform image2D ImageB;
+#else
 layout(std430, binding=3) buffer BufferA {
     float bufferA[];
 };
@@ -22,29 +46,141 @@ layout(std430, binding=3) buffer BufferA {
 layout(std430, binding=4) buffer BufferB {
     float bufferB[];
 };
+#endif
 
+#ifndef PACKED_CONSTRAINTS
 layout(std430, binding=5) buffer BufferLaplacian {
     float laplacian[];
 };
+#endif
+
+// cells of the level, built once by the solver: free interior cells, free border cells, then fixed cells,
+// as their offset in the layout
+layout(std430, binding=6) buffer Cells {
+    uint cells[];
+};
 
-layout(local_size_x = WORK_GROUP_SIZE_X,  local_size_y = WORK_GROUP_SIZE_Y, local_size_z = 1) in;
+// Three variants, selected by a definition at compile time, all run over a range of the cell list:
+// - STENCIL_INTERIOR : Jacobi step of free interior cells, the four neighbours always exist, no bounds check
+// - STENCIL_FIXED : writes the value of fixed cells in bufferB, only needed when it does not hold them yet
+// - otherwise : Jacobi step of any free cell, with bounds checks
+// The interior variant produces exactly the same values as the generic one.
+// PACKED_CONSTRAINTS (and PACKED16 for the 16-bit values) selects the storage of the constraints, independently of the variant.
+
+layout(local_size_x = WORK_GROUP_SIZE,  local_size_y = 1, local_size_z = 1) in;
+
+// offset of cell (i, j) in a level of size n: row-major, or tiles of 2^LAYOUT_TILE_BITS cells, row-major or
+// Z-order inside a tile (same layouts as layout.h)
+int LayoutOffset(int i, int j, int n)
+{
+#if defined(LAYOUT_TILED) || defined(LAYOUT_MORTON)
+    const int T = 1 << LAYOUT_TILE_BITS;
+    int tile = (i >> LAYOUT_TILE_BITS) * ((n + T - 1) / T) + (j >> LAYOUT_TILE_BITS);
+    int ii = i & (T - 1);
+    int jj = j & (T - 1);
+#ifdef LAYOUT_MORTON
+    ii = (ii | (ii << 2)) & 0x33;
+    ii = (ii | (ii << 1)) & 0x55;
+    jj = (jj | (jj << 2)) & 0x33;
+    jj = (jj | (jj << 1)) & 0x55;
+    return (tile << (2 * LAYOUT_TILE_BITS)) + (ii << 1) + jj;
+#else
+    return (tile << (2 * LAYOUT_TILE_BITS)) + (ii << LAYOUT_TILE_BITS) + jj;
+#endif
+#else
+    return i * n + j;
+#endif
+}
 
 int GetOffset(int i, int j)
 {
-    return i * GridSizeY + j;
+    return LayoutOffset(i, j, GridSizeY);
 }
 
-float A(int i, int j, inout int cpt)
+#if defined(LAYOUT_TILED) || defined(LAYOUT_MORTON)
+const int LAYOUT_TILE = 1 << LAYOUT_TILE_BITS;
+#ifdef LAYOUT_MORTON
+const int LAYOUT_ROW = 0xaa; // interleaved bits of the row and the column inside a tile
+const int LAYOUT_COLUMN = 0x55;
+#else
+const int LAYOUT_ROW = (LAYOUT_TILE - 1) << LAYOUT_TILE_BITS;
+const int LAYOUT_COLUMN = LAYOUT_TILE - 1;
+#endif
+
+int Compact(int x)
 {
-    if (i < 0) return 0;
-    if (j < 0) return 0;
-    if (i >= GridSizeX) return 0;
-    if (j >= GridSizeY) return 0;
-	cpt++;
-    return bufferA[GetOffset(i, j)];
+    x &= 0x55;
+    x = (x | (x >> 1)) & 0x33;
+    return (x | (x >> 2)) & 0x0f;
 }
+#endif
 
-float Aspecial(int i, int j, int di, int dj, inout int cpt)
+// cell (i, j) stored at offset idx, inverse of GetOffset
+ivec2 GetCell(int idx)
+{
+#if defined(LAYOUT_TILED) || defined(LAYOUT_MORTON)
+    int tiles = (GridSizeY + LAYOUT_TILE - 1) / LAYOUT_TILE;
+    int tile = idx >> (2 * LAYOUT_TILE_BITS);
+    int ti = tile / tiles;
+#ifdef LAYOUT_MORTON
+    return ivec2((ti << LAYOUT_TILE_BITS) + Compact(idx >> 1), ((tile - ti * tiles) << LAYOUT_TILE_BITS) + Compact(idx));
+#else
+    return ivec2((ti << LAYOUT_TILE_BITS) + ((idx >> LAYOUT_TILE_BITS) & LAYOUT_COLUMN), ((tile - ti * tiles) << LAYOUT_TILE_BITS) + (idx & LAYOUT_COLUMN));
+#endif
+#else
+    int i = idx / GridSizeY;
+    return ivec2(i, idx - i * GridSizeY);
+#endif
+}
+
+// offsets of the neighbours of the cell stored at idx, they must exist (same as layout.h)
+#if defined(LAYOUT_TILED) || defined(LAYOUT_MORTON)
+int TileRow() { return ((GridSizeY + LAYOUT_TILE - 1) / LAYOUT_TILE) << (2 * LAYOUT_TILE_BITS); }
+#ifdef LAYOUT_MORTON
+int Up(int idx) { int r = idx & LAYOUT_ROW; return r != 0 ? (idx & ~LAYOUT_ROW) | ((r - 1) & LAYOUT_ROW) : idx - TileRow() + LAYOUT_ROW; }
+int Down(int idx) { int r = idx & LAYOUT_ROW; return r != LAYOUT_ROW ? (idx & ~LAYOUT_ROW) | (((r | LAYOUT_COLUMN) + 1) & LAYOUT_ROW) : idx + TileRow() - LAYOUT_ROW; }
+int Left(int idx) { int c = idx & LAYOUT_COLUMN; return c != 0 ? (idx & ~LAYOUT_COLUMN) | ((c - 1) & LAYOUT_COLUMN) : idx - LAYOUT_TILE * LAYOUT_TILE + LAYOUT_COLUMN; }
+int Right(int idx) { int c = idx & LAYOUT_COLUMN; return c != LAYOUT_COLUMN ? (idx & ~LAYOUT_COLUMN) | (((c | LAYOUT_ROW) + 1) & LAYOUT_COLUMN) : idx + LAYOUT_TILE * LAYOUT_TILE - LAYOUT_COLUMN; }
+#else
+int Up(int idx) { return (idx & LAYOUT_ROW) != 0 ? idx - LAYOUT_TILE : idx - TileRow() + LAYOUT_ROW; }
+int Down(int idx) { return (idx & LAYOUT_ROW) != LAYOUT_ROW ? idx + LAYOUT_TILE : idx + TileRow() - LAYOUT_ROW; }
+int Left(int idx) { return (idx & LAYOUT_COLUMN) != 0 ? idx - 1 : idx - LAYOUT_TILE * LAYOUT_TILE + LAYOUT_COLUMN; }
+int Right(int idx) { return (idx & LAYOUT_COLUMN) != LAYOUT_COLUMN ? idx + 1 : idx + LAYOUT_TILE * LAYOUT_TILE - LAYOUT_COLUMN; }
+#endif
+#else
+int Up(int idx) { return idx - GridSizeY; }
+int Down(int idx) { return idx + GridSizeY; }
+int Left(int idx) { return idx - 1; }
+int Right(int idx) { return idx + 1; }
+#endif
+
+#if defined(PACKED16)
+// same as the float version, the values are decoded like Range16::Decode
+float Value16(int idx, vec2 range) { precise float v = range.x + float((constraint[idx >> 1] >> (16 * (idx & 1))) & 0xffffu) * range.y; return v; }
+float Constrained(int idx) { return Value16(idx, AltitudeRange); }
+float Combine(int idx, float avg) { precise float v = avg - Value16(idx, LaplacianRange); return v; }
+#elif defined(PACKED_CONSTRAINTS)
+// the value of a fixed cell never changes, the others are the average of their neighbours minus the Laplacian
+float Constrained(int idx) { return constraint[idx]; }
+float Combine(int idx, float avg) { precise float v = avg - constraint[idx]; return v; }
+#else
+float Constrained(int idx) { float a = alpha[idx]; return a * 0.0 + (1.0 - a) * altitude[idx]; }
+float Combine(int idx, float avg) { float a = alpha[idx]; precise float v = a * (avg - laplacian[idx]) + (1.0 - a) * altitude[idx]; return v; }
+#endif
+
+#ifdef IMAGE_STORAGE
+ivec2 texel; // texel of the current cell
+
+// neighbor (i + di, j + dj) of the current cell, through the texture cache
+float Neighbor(int idx, int di, int dj) { return texelFetch(TextureA, texel + ivec2(dj, di), 0).r; }
+void Store(int idx, float v) { imageStore(ImageB, texel, vec4(v)); }
+#else
+// neighbor (i + di, j + dj) of the cell stored at idx, one of the four direct neighbors
+float Neighbor(int idx, int di, int dj) { return bufferA[di < 0 ? Up(idx) : di > 0 ? Down(idx) : dj > 0 ? Right(idx) : Left(idx)]; }
+void Store(int idx, float v) { bufferB[idx] = v; }
+#endif
+
+float Aspecial(int idx, int i, int j, int di, int dj, inout int cpt)
 {
 	int ii = i+di;
 	int jj = j+dj;
@@ -52,36 +188,37 @@ float Aspecial(int i, int j, int di, int dj, inout int cpt)
     if (jj < 0) return 0;
     if (ii >= GridSizeX) return 0;
     if (jj >= GridSizeY) return 0;
-	int idx = GetOffset(ii, jj);
 	
 	cpt++;
-    return bufferA[GetOffset(ii, jj)];
+    return Neighbor(idx, di, dj);
 }
 
-
 void main()
 {
-    int i = int(gl_GlobalInvocationID.x);
-    int j = int(gl_GlobalInvocationID.y);
-
-	if (i < 0) return;
-    if (j < 0) return;
-    if (i >= GridSizeX) return;
-    if (j >= GridSizeY) return;
-    
-	int idx = GetOffset(i,j);
-	
-	float a = alpha[idx]; // fetch alpha
-	
-	float lap = .0;
+    int k = int(gl_GlobalInvocationID.x);
+    if (k >= CellCount) return;
+    int idx = int(cells[CellFirst + k]);
+#ifdef IMAGE_STORAGE
+    texel = GetCell(idx).yx;
+#endif
+
+#if defined(STENCIL_FIXED)
+	Store(idx, Constrained(idx));
+#elif defined(STENCIL_INTERIOR)
+	// four neighbors, same order as the generic version
+	float lap = Neighbor(idx,-1,0)+Neighbor(idx,1,0)+Neighbor(idx,0,1)+Neighbor(idx,0,-1);
+	precise float avg = lap/4.0;
+	Store(idx, Combine(idx, avg)); // final combination
+#else
+	ivec2 cell = GetCell(idx);
+	int i = cell.x;
+	int j = cell.y;
 	int cpt = 0;
-	if (a>0.) { // Laplace component is the average of neighbors, only if alpha is not null
-		lap = Aspecial(i,j,-1,0,cpt)+Aspecial(i,j,1,0,cpt)+Aspecial(i,j,0,1,cpt)+Aspecial(i,j,0,-1,cpt);
-		float c = cpt;
-		lap = lap/c-laplacian[idx];
-	}
-	
-	bufferB[idx] = a*lap+(1.0-a)*altitude[idx]; // final combination
+	float lap = Aspecial(idx,i,j,-1,0,cpt)+Aspecial(idx,i,j,1,0,cpt)+Aspecial(idx,i,j,0,1,cpt)+Aspecial(idx,i,j,0,-1,cpt);
+	float c = cpt;
+	precise float avg = lap/c; // precise: IEEE division and no contraction, same values as the CPU solver
+	Store(idx, Combine(idx, avg)); // final combination
+#endif
 }
 
-#endif
\ No newline at end of file
+#endif